@@ -0,0 +1,1678 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include "dehydrator.h"
+
+
+// dispatchers, dispatch_cursor, dispatch_current and dehydrator_count are guarded by
+// dehydrators_lock, since Redis frees values on its background threads too (FLUSHALL ASYNC,
+// replica full syncs)
+Dehydrator* dispatchers = NULL;
+Dehydrator* dispatch_cursor = NULL;
+Dehydrator* dispatch_current = NULL;
+long long dehydrator_count = 0;
+static pthread_mutex_t dehydrators_lock;
+static pthread_once_t dehydrators_lock_once = PTHREAD_ONCE_INIT;
+
+
+//##########################################################
+//#
+//#                    C Utilities
+//#
+//#########################################################
+
+char* string_append(char* a, const char* b)
+{
+    char* retstr = RedisModule_Alloc(strlen(a)+strlen(b)+1);
+    strcpy(retstr, a);
+    strcat(retstr, b);
+    // printf("printing: %s", retstr);
+    RedisModule_Free(a);
+    return retstr;
+}
+
+
+static long long clock_offset_us = 0; // the wall clock minus the monotonic clock, taken on load
+
+static inline long long _monotonic_time_us(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (long long)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+// anchor the module's clock to the wall clock, once on load
+void init_clock(void)
+{
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_offset_us = (long long)wall.tv_sec * 1000000 + wall.tv_nsec / 1000 - _monotonic_time_us();
+}
+
+// microseconds since the epoch, as of the wall clock when the module was loaded. the clock
+// never steps back (or jumps ahead) when the wall clock is set, so expirations stay ordered.
+long long current_time_us(void)
+{
+    return _monotonic_time_us() + clock_offset_us;
+}
+
+// milliseconds since the epoch, see current_time_us
+long long current_time_ms(void)
+{
+    return current_time_us() / 1000;
+}
+
+// parse an id that is the canonical decimal form of a 64 bit integer ("12", "-3" but
+// not "012", "+1" or "-0"), returns 0 for any other id
+int parse_integer_id(const char* id, size_t len, long long* value)
+{
+    if ((len == 0) || (len > 20)) { return 0; }
+
+    size_t i = 0;
+    int negative = (id[0] == '-');
+    if (negative)
+    {
+        ++i;
+        if ((len == 1) || (id[1] == '0')) { return 0; }
+    }
+    if ((id[i] == '0') && (len > 1)) { return 0; }
+
+    unsigned long long magnitude = 0;
+    for (; i < len; ++i)
+    {
+        unsigned digit = (unsigned char)id[i] - '0';
+        if (digit > 9) { return 0; }
+        if (magnitude > (ULLONG_MAX - digit) / 10) { return 0; }
+        magnitude = magnitude * 10 + digit;
+    }
+
+    if (negative)
+    {
+        if (magnitude > (unsigned long long)LLONG_MAX + 1) { return 0; }
+        *value = (long long)(0 - magnitude);
+    }
+    else
+    {
+        if (magnitude > (unsigned long long)LLONG_MAX) { return 0; }
+        *value = (long long)magnitude;
+    }
+    return 1;
+}
+
+
+//##########################################################
+//#
+//#               Queue Heap Functions
+//#
+//#########################################################
+
+#define QUEUE_HEAP_INITIAL_CAPACITY 16
+
+void _queueHeapInit(QueueHeap* heap)
+{
+    heap->lists = NULL;
+    heap->len = 0;
+    heap->capacity = 0;
+}
+
+
+void _queueHeapDestroy(QueueHeap* heap)
+{
+    if (heap->lists != NULL)
+    {
+        RedisModule_Free(heap->lists);
+    }
+    _queueHeapInit(heap);
+}
+
+
+// the heap only holds non-empty lists, so the head is always there
+static inline long long _queueHeapKey(QueueHeap* heap, int index)
+{
+    return heap->lists[index]->head->expiration;
+}
+
+
+static inline void _queueHeapSet(QueueHeap* heap, int index, ElementList* list)
+{
+    heap->lists[index] = list;
+    list->heap_index = index;
+}
+
+
+void _queueHeapSiftUp(QueueHeap* heap, int index)
+{
+    ElementList* list = heap->lists[index];
+    long long key = list->head->expiration;
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (_queueHeapKey(heap, parent) <= key) { break; }
+        _queueHeapSet(heap, index, heap->lists[parent]);
+        index = parent;
+    }
+    _queueHeapSet(heap, index, list);
+}
+
+
+void _queueHeapSiftDown(QueueHeap* heap, int index)
+{
+    ElementList* list = heap->lists[index];
+    long long key = list->head->expiration;
+    while (1)
+    {
+        int child = 2 * index + 1;
+        if (child >= heap->len) { break; }
+        if ((child + 1 < heap->len) && (_queueHeapKey(heap, child + 1) < _queueHeapKey(heap, child)))
+        {
+            ++child; // right child is earlier then the left one
+        }
+        if (key <= _queueHeapKey(heap, child)) { break; }
+        _queueHeapSet(heap, index, heap->lists[child]);
+        index = child;
+    }
+    _queueHeapSet(heap, index, list);
+}
+
+
+// add a (non-empty) list to the heap
+void _queueHeapInsert(QueueHeap* heap, ElementList* list)
+{
+    if (heap->len == heap->capacity)
+    {
+        heap->capacity = (heap->capacity == 0) ? QUEUE_HEAP_INITIAL_CAPACITY : heap->capacity * 2;
+        heap->lists = RedisModule_Realloc(heap->lists, heap->capacity * sizeof(ElementList*));
+    }
+    _queueHeapSet(heap, heap->len, list);
+    heap->len = heap->len + 1;
+    _queueHeapSiftUp(heap, list->heap_index);
+}
+
+
+// restore heap order after the head of a list has changed
+void _queueHeapUpdate(QueueHeap* heap, ElementList* list)
+{
+    _queueHeapSiftUp(heap, list->heap_index);
+    _queueHeapSiftDown(heap, list->heap_index);
+}
+
+
+void _queueHeapRemove(QueueHeap* heap, ElementList* list)
+{
+    int index = list->heap_index;
+    if (index < 0) { return; } // not in the heap
+
+    heap->len = heap->len - 1;
+    list->heap_index = -1;
+    if (index == heap->len) { return; } // was the last one, nothing to fix
+
+    // move the last list into the hole and restore heap order around it
+    ElementList* moved = heap->lists[heap->len];
+    _queueHeapSet(heap, index, moved);
+    _queueHeapUpdate(heap, moved);
+}
+
+
+// the list with the earliest expiring head, NULL if there are no lists
+ElementList* _queueHeapTop(QueueHeap* heap)
+{
+    return (heap->len > 0) ? heap->lists[0] : NULL;
+}
+
+
+// gather the lists whose head expired by `now` into `lists` (room for heap->len of them),
+// returns their number. below a list that has not expired nothing has, so only the expired
+// part of the heap is walked, using `lists` itself as the queue of the walk.
+int _queueHeapExpired(QueueHeap* heap, long long now, ElementList** lists)
+{
+    if ((heap->len == 0) || (_queueHeapKey(heap, 0) > now)) { return 0; }
+    int count = 0, i;
+    lists[count++] = heap->lists[0];
+    for (i = 0; i < count; ++i)
+    {
+        int child = 2 * lists[i]->heap_index + 1;
+        for (; (child < heap->len) && (child <= 2 * lists[i]->heap_index + 2); ++child)
+        {
+            if (_queueHeapKey(heap, child) <= now) { lists[count++] = heap->lists[child]; }
+        }
+    }
+    return count;
+}
+
+
+//##########################################################
+//#
+//#               Slab Allocator Functions
+//#
+//#########################################################
+
+void _slabInit(SlabAllocator* allocator)
+{
+    memset(allocator, 0, sizeof(SlabAllocator));
+}
+
+
+// free every slab, whatever is still allocated from them goes away too
+void _slabDestroy(SlabAllocator* allocator)
+{
+    int i;
+    long long j;
+    for (i = 0; i < SLAB_CLASS_COUNT; ++i)
+    {
+        SlabClass* slab_class = &allocator->classes[i];
+        for (j = 0; j < slab_class->slab_count; ++j)
+        {
+            RedisModule_Free(slab_class->slabs[j]);
+        }
+        if (slab_class->slabs != NULL)
+        {
+            RedisModule_Free(slab_class->slabs);
+        }
+    }
+    _slabInit(allocator);
+}
+
+
+// thread all the objects of a slab onto its free list
+void _slabAddToFreeList(Slab* slab, size_t object_size)
+{
+    char* object = (char*)(slab + 1);
+    long long i;
+    slab->free_list = NULL;
+    for (i = 0; i < slab->objects; ++i, object += object_size)
+    {
+        *(void**)object = slab->free_list;
+        slab->free_list = object;
+    }
+}
+
+
+// the position of the last slab of the class that starts at or before `object`,
+// which is the slab holding it when it was allocated from the class
+long long _slabIndex(SlabClass* slab_class, const void* object)
+{
+    long long low = 0;
+    long long high = slab_class->slab_count - 1;
+    while (low < high)
+    {
+        long long middle = (low + high + 1) / 2;
+        if ((uintptr_t)slab_class->slabs[middle] <= (uintptr_t)object) { low = middle; }
+        else { high = middle - 1; }
+    }
+    return low;
+}
+
+
+// slabs with free objects are kept in a list, so allocations do not look for them
+void _slabLinkPartial(SlabClass* slab_class, Slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = slab_class->partial;
+    if (slab_class->partial != NULL) { slab_class->partial->prev = slab; }
+    slab_class->partial = slab;
+}
+
+
+void _slabUnlinkPartial(SlabClass* slab_class, Slab* slab)
+{
+    if (slab->prev != NULL) { slab->prev->next = slab->next; }
+    else { slab_class->partial = slab->next; }
+    if (slab->next != NULL) { slab->next->prev = slab->prev; }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+
+// a new slab goes into the class' slabs, kept in address order
+void _slabInsert(SlabClass* slab_class, Slab* slab)
+{
+    if (slab_class->slab_count == slab_class->slab_capacity)
+    {
+        slab_class->slab_capacity = (slab_class->slab_capacity == 0) ? 8 : slab_class->slab_capacity * 2;
+        slab_class->slabs = RedisModule_Realloc(slab_class->slabs, slab_class->slab_capacity * sizeof(Slab*));
+    }
+    long long index = 0;
+    if (slab_class->slab_count > 0)
+    {
+        index = _slabIndex(slab_class, slab);
+        if ((uintptr_t)slab_class->slabs[index] < (uintptr_t)slab) { ++index; }
+    }
+    memmove(slab_class->slabs + index + 1, slab_class->slabs + index, (slab_class->slab_count - index) * sizeof(Slab*));
+    slab_class->slabs[index] = slab;
+    slab_class->slab_count = slab_class->slab_count + 1;
+    slab_class->objects = slab_class->objects + slab->objects;
+}
+
+
+// give an empty slab back to the redis allocator
+void _slabRelease(SlabClass* slab_class, long long index)
+{
+    Slab* slab = slab_class->slabs[index];
+    _slabUnlinkPartial(slab_class, slab);
+    slab_class->slab_count = slab_class->slab_count - 1;
+    slab_class->objects = slab_class->objects - slab->objects;
+    memmove(slab_class->slabs + index, slab_class->slabs + index + 1, (slab_class->slab_count - index) * sizeof(Slab*));
+    RedisModule_Free(slab);
+}
+
+
+// the memory held by the slabs, used or not (large objects are not counted)
+long long _slabBytes(SlabAllocator* allocator)
+{
+    long long total_bytes = 0;
+    int i;
+    for (i = 0; i < SLAB_CLASS_COUNT; ++i)
+    {
+        SlabClass* slab_class = &allocator->classes[i];
+        if (slab_class->slab_count == 0) { continue; }
+        total_bytes += slab_class->slab_count * sizeof(Slab) + slab_class->objects * _slabClassSize(i) +
+            slab_class->slab_capacity * sizeof(Slab*);
+    }
+    return total_bytes;
+}
+
+
+void* _slabAlloc(SlabAllocator* allocator, size_t size)
+{
+    if (size > SLAB_MAX_OBJECT_SIZE)
+    {
+        allocator->large_used = allocator->large_used + 1;
+        allocator->large_bytes = allocator->large_bytes + size;
+        return RedisModule_Alloc(size);
+    }
+
+    int index = _slabClassIndex(size);
+    SlabClass* slab_class = &allocator->classes[index];
+    if (slab_class->partial == NULL)
+    {
+        // small dehydrators stay small, busy ones get large slabs
+        long long objects = (slab_class->slab_count < 6) ? (SLAB_MIN_OBJECTS << slab_class->slab_count) : SLAB_MAX_OBJECTS;
+        Slab* slab = RedisModule_Alloc(sizeof(Slab) + objects * _slabClassSize(index));
+        slab->objects = objects;
+        slab->used = 0;
+        _slabAddToFreeList(slab, _slabClassSize(index));
+        _slabInsert(slab_class, slab);
+        _slabLinkPartial(slab_class, slab);
+    }
+
+    Slab* slab = slab_class->partial;
+    void* object = slab->free_list;
+    slab->free_list = *(void**)object;
+    slab->used = slab->used + 1;
+    if (slab->free_list == NULL) { _slabUnlinkPartial(slab_class, slab); }
+    slab_class->used = slab_class->used + 1;
+    return object;
+}
+
+
+void _slabFree(SlabAllocator* allocator, void* object, size_t size)
+{
+    if (size > SLAB_MAX_OBJECT_SIZE)
+    {
+        allocator->large_used = allocator->large_used - 1;
+        allocator->large_bytes = allocator->large_bytes - size;
+        RedisModule_Free(object);
+        return;
+    }
+
+    SlabClass* slab_class = &allocator->classes[_slabClassIndex(size)];
+    long long index = _slabIndex(slab_class, object);
+    Slab* slab = slab_class->slabs[index];
+    if (slab->free_list == NULL) { _slabLinkPartial(slab_class, slab); } // it was full
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    slab->used = slab->used - 1;
+    slab_class->used = slab_class->used - 1;
+
+    if ((slab->used > 0) || (slab_class->slab_count == 1)) { return; }
+    if (slab_class->used == 0)
+    {
+        // the class drained, give back all the slabs but this one
+        long long i;
+        for (i = slab_class->slab_count - 1; i >= 0; --i)
+        {
+            if (slab_class->slabs[i] != slab) { _slabRelease(slab_class, i); }
+        }
+    }
+    else if (slab_class->objects - slab->objects - slab_class->used >= slab->objects)
+    {
+        // the other slabs can take a slab's worth of allocations, so a class moving
+        // up and down around a slab boundary does not allocate the same slab over and over
+        _slabRelease(slab_class, index);
+    }
+}
+
+
+//##########################################################
+//#
+//#              Linked List Functions
+//#
+//#########################################################
+
+
+//Creates a new Node and returns pointer to it.
+// the id is copied into the node, and so is the element if it fits inline - otherwise
+// the node takes `large_element`, a string holding the same bytes as `element`.
+ElementListNode* _createNewNode(Dehydrator* dehydrator, const char* element_id, size_t id_len,
+    const char* element, size_t element_len, RedisModuleString* large_element, long long ttl, long long expiration)
+{
+    int inline_element = (large_element == NULL);
+    size_t size = sizeof(ElementListNode) + id_len + 1 + (inline_element ? element_len : 0);
+    ElementListNode* newNode
+        = (ElementListNode*)_slabAlloc(&dehydrator->slabs, size);
+
+    newNode->id_len = id_len;
+    memcpy(newNode->data, element_id, id_len);
+    newNode->data[id_len] = '\0';
+    if (inline_element)
+    {
+        newNode->element = NULL;
+        newNode->element_len = element_len;
+        memcpy(newNode->data + id_len + 1, element, element_len);
+    }
+    else
+    {
+        newNode->element = large_element;
+        newNode->element_len = 0;
+        size_t large_len;
+        RedisModule_StringPtrLen(large_element, &large_len);
+        dehydrator->element_bytes = dehydrator->element_bytes + large_len;
+    }
+    newNode->expiration = expiration;
+    newNode->ttl = ttl;
+    newNode->flags = 0;
+    newNode->next = NULL;
+    newNode->prev = NULL;
+    return newNode;
+}
+
+
+void deleteNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    // free everything else related to the node
+    if (node->element != NULL)
+    {
+        size_t large_len;
+        RedisModule_StringPtrLen(node->element, &large_len);
+        dehydrator->element_bytes = dehydrator->element_bytes - large_len;
+        RedisModule_FreeString(NULL, node->element);
+    }
+    _slabFree(&dehydrator->slabs, node, _nodeSize(node));
+}
+
+
+void _listInit(ElementList* list)
+{
+    list->head = NULL;
+    list->tail = NULL;
+    list->len = 0;
+    list->heap_index = -1;
+}
+
+
+//Creates a new Node and returns pointer to it.
+ElementList* _createNewList(Dehydrator* dehydrator)
+{
+    ElementList* list
+        = (ElementList*)_slabAlloc(&dehydrator->slabs, sizeof(ElementList));
+    _listInit(list);
+    return list;
+}
+
+
+// delete the list itself, its nodes are not freed
+void deleteList(Dehydrator* dehydrator, ElementList* list)
+{
+    _slabFree(&dehydrator->slabs, list, sizeof(ElementList));
+}
+
+
+// insert a Node at tail of linked list
+void _listPush(ElementList* list, ElementListNode* node)
+{
+    node->next = NULL;
+    node->prev = NULL;
+    if (list->tail == NULL)
+    {
+        list->head = node;
+    }
+    else
+    {
+        node->prev = list->tail;
+        list->tail->next = node;
+    }
+    list->tail = node;
+    list->len = (list->len) + 1;
+}
+
+
+// insert a Node right after `after`, or at the head of the list if `after` is NULL
+void _listInsertAfter(ElementList* list, ElementListNode* after, ElementListNode* node)
+{
+    if (after == list->tail)
+    {
+        _listPush(list, node);
+        return;
+    }
+
+    node->prev = after;
+    node->next = (after == NULL) ? list->head : after->next;
+    node->next->prev = node;
+    if (after == NULL)
+    {
+        list->head = node;
+    }
+    else
+    {
+        after->next = node;
+    }
+    list->len = (list->len) + 1;
+}
+
+
+// pull and return the element at the first location
+ElementListNode* _listPop(ElementList* list) {
+   if ((list == NULL) || (list->head == NULL)) { return NULL; } // if list empty
+
+   //save current head
+   ElementListNode* node = list->head;
+
+   if (list->len == 1)
+   {
+       list->tail = NULL;
+       list->head = NULL;
+   }
+   else
+   {
+       // swap to new head
+       list->head = list->head->next;
+       list->head->prev = NULL;
+   }
+
+   list->len = list->len - 1;
+   return node;
+
+}
+
+
+// unlink a node from anywhere in the list
+void _listRemove(ElementList* list, ElementListNode* node)
+{
+    if (node == list->head)
+    {
+        list->head = node->next;
+    }
+    else
+    {
+        node->prev->next = node->next;
+    }
+
+    if (node == list->tail)
+    {
+        list->tail = node->prev;
+    }
+    else
+    {
+        node->next->prev = node->prev;
+    }
+
+    node->next = NULL;
+    node->prev = NULL;
+    list->len = list->len - 1;
+}
+
+
+// put `replacement` in the place of `node`, which is left unlinked
+void _listReplace(ElementList* list, ElementListNode* node, ElementListNode* replacement)
+{
+    replacement->next = node->next;
+    replacement->prev = node->prev;
+    if (node == list->head)
+    {
+        list->head = replacement;
+    }
+    else
+    {
+        node->prev->next = replacement;
+    }
+
+    if (node == list->tail)
+    {
+        list->tail = replacement;
+    }
+    else
+    {
+        node->next->prev = replacement;
+    }
+
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+
+// move all the nodes of src to the tail of dst, leaving src empty
+void _listAppendList(ElementList* dst, ElementList* src)
+{
+    if (src->head == NULL) { return; }
+
+    if (dst->tail == NULL)
+    {
+        dst->head = src->head;
+    }
+    else
+    {
+        dst->tail->next = src->head;
+        src->head->prev = dst->tail;
+    }
+    dst->tail = src->tail;
+    dst->len = dst->len + src->len;
+    _listInit(src);
+}
+
+
+void _listPull(Dehydrator* dehydrator, ElementListNode* node)
+{
+    ElementList* list = NULL;
+    khiter_t k = kh_end(dehydrator->timeout_queues);
+    if (node->flags & NODE_LEASED)
+    {
+        list = dehydrator->lease_queue;
+    }
+    else
+    {
+        k = kh_get(16, dehydrator->timeout_queues, node->ttl);  // first have to get iterator
+        if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+        {
+            list = kh_val(dehydrator->timeout_queues, k);
+        }
+    }
+    if (list == NULL) { return; }
+
+    if (list->len == 1)
+    {
+        list->head = NULL;
+        list->tail = NULL;
+        _queueHeapRemove(&dehydrator->queue_heap, list);
+        if (list == dehydrator->lease_queue) { dehydrator->lease_queue = NULL; }
+        else { kh_del(16, dehydrator->timeout_queues, k); }
+        deleteList(dehydrator, list);
+        return;
+    }
+
+    int pulled_head = (node == list->head);
+    _listRemove(list, node);
+
+    if (pulled_head)
+    {
+        // the list has a new head, so its place in the heap may change
+        _queueHeapUpdate(&dehydrator->queue_heap, list);
+    }
+}
+
+char* printNode(ElementListNode* node)
+{
+    size_t element_len;
+    const char* element = _nodeElement(node, &element_len);
+    char* node_str = (char*)RedisModule_Alloc((node->id_len+element_len+50)*sizeof(char));
+    sprintf(node_str, "[id=%s,elem=%.*s,ttl=%d,exp=%lld]", _nodeId(node), (int)element_len, element, node->ttl, node->expiration);
+    return node_str;
+
+}
+
+
+char* printList(ElementList* list)
+{
+    char* list_str = RedisModule_Alloc(32*sizeof(char));
+    ElementListNode* current = list->head;
+    sprintf(list_str, "(elements=%d)\n   head", list->len);
+    // iterate over queue and find the element that has id = element_id
+    while(current != NULL)
+    {
+        list_str = string_append(list_str, "->");
+        char* node_str = printNode(current);
+        list_str = string_append(list_str, node_str);
+        RedisModule_Free(node_str);
+
+        current = current->next;  //move to next node
+    }
+    list_str = string_append(list_str, "\n   tail points to: ");
+    list_str = string_append(list_str, _nodeId(list->tail));
+    list_str = string_append(list_str,"\n");
+    return list_str;
+}
+
+
+//##########################################################
+//#
+//#               Timing Wheel Functions
+//#
+//#########################################################
+
+TimingWheel* _createTimingWheel(long long now)
+{
+    TimingWheel* wheel = (TimingWheel*)RedisModule_Alloc(sizeof(TimingWheel));
+    int level, index;
+    for (level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        for (index = 0; index < WHEEL_SLOTS; ++index)
+        {
+            _listInit(&wheel->slots[level][index]);
+            wheel->earliest[level][index] = LLONG_MAX;
+        }
+        wheel->occupied[level] = 0;
+    }
+    _listInit(&wheel->ready);
+    wheel->base = now;
+    wheel->count = 0;
+    return wheel;
+}
+
+
+// the nodes are owned by the dehydrator's slabs, so only the wheel itself is freed
+void deleteTimingWheel(TimingWheel* wheel)
+{
+    RedisModule_Free(wheel);
+}
+
+
+static inline long long _wheelLevelSpan(int level)
+{
+    return 1LL << (WHEEL_SLOT_BITS * level);
+}
+
+
+static inline int _wheelSlotIndex(long long tick, int level)
+{
+    return (tick >> (WHEEL_SLOT_BITS * level)) & WHEEL_SLOT_MASK;
+}
+
+
+// number of slots (1 to WHEEL_SLOTS) from `from` to the next occupied slot,
+// going around the wheel. `from` itself comes last. -1 if no slot is occupied.
+static inline int _wheelSlotDistance(uint64_t occupied, int from)
+{
+    if (occupied == 0) { return -1; }
+    int start = (from + 1) & WHEEL_SLOT_MASK;
+    uint64_t rotated = (start == 0) ? occupied : ((occupied >> start) | (occupied << (WHEEL_SLOTS - start)));
+    return __builtin_ctzll(rotated) + 1;
+}
+
+
+// park a node in the slot matching its expiration, relative to the wheel base
+void _wheelPlace(TimingWheel* wheel, ElementListNode* node)
+{
+    long long delta = node->expiration - wheel->base;
+    if (delta < 0)
+    {
+        // the wheel already went past this tick, so it is expired
+        node->slot = WHEEL_READY_SLOT;
+        _listPush(&wheel->ready, node);
+        return;
+    }
+
+    int level = 0;
+    while ((level < WHEEL_LEVELS - 1) && (delta >= _wheelLevelSpan(level + 1)))
+    {
+        ++level;
+    }
+
+    long long tick = node->expiration;
+    if (delta >= _wheelLevelSpan(WHEEL_LEVELS))
+    {
+        // beyond the wheel horizon - park it in the farthest slot, it will be
+        // placed again once that slot is cascaded
+        tick = wheel->base + _wheelLevelSpan(WHEEL_LEVELS) - 1;
+    }
+
+    int index = _wheelSlotIndex(tick, level);
+    _listPush(&wheel->slots[level][index], node);
+    wheel->occupied[level] |= (1ULL << index);
+    if (node->expiration < wheel->earliest[level][index])
+    {
+        wheel->earliest[level][index] = node->expiration;
+    }
+    node->slot = level * WHEEL_SLOTS + index;
+    wheel->count = wheel->count + 1;
+}
+
+
+void _wheelRemove(TimingWheel* wheel, ElementListNode* node)
+{
+    if (node->slot == WHEEL_READY_SLOT)
+    {
+        _listRemove(&wheel->ready, node);
+        return;
+    }
+
+    int level = node->slot / WHEEL_SLOTS;
+    int index = node->slot % WHEEL_SLOTS;
+    ElementList* slot = &wheel->slots[level][index];
+    _listRemove(slot, node);
+    if (slot->len == 0)
+    {
+        wheel->occupied[level] &= ~(1ULL << index);
+        wheel->earliest[level][index] = LLONG_MAX;
+    }
+    wheel->count = wheel->count - 1;
+}
+
+
+// take all the nodes out of a slot
+static inline ElementListNode* _wheelTakeSlot(TimingWheel* wheel, int level, int index)
+{
+    ElementList* slot = &wheel->slots[level][index];
+    ElementListNode* head = slot->head;
+    wheel->count = wheel->count - slot->len;
+    wheel->occupied[level] &= ~(1ULL << index);
+    wheel->earliest[level][index] = LLONG_MAX;
+    _listInit(slot);
+    return head;
+}
+
+
+// called whenever the base reaches the start of a level 0 round - the coarse
+// slots that start at this tick are spread over the finer levels below them
+void _wheelCascade(TimingWheel* wheel)
+{
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        int index = _wheelSlotIndex(wheel->base, level);
+        ElementListNode* node = _wheelTakeSlot(wheel, level, index);
+        while (node != NULL)
+        {
+            ElementListNode* next = node->next;
+            _wheelPlace(wheel, node);
+            node = next;
+        }
+
+        if (index != 0) { break; } // higher levels did not start a new round
+    }
+}
+
+
+// the next tick after the base that has work to do, assuming the current tick was handled
+long long _wheelNextTick(TimingWheel* wheel)
+{
+    int current = _wheelSlotIndex(wheel->base, 0);
+    int distance = _wheelSlotDistance(wheel->occupied[0] & ~(1ULL << current), current);
+    long long next_tick = (distance > 0) ? wheel->base + distance : LLONG_MAX;
+
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        distance = _wheelSlotDistance(wheel->occupied[level], _wheelSlotIndex(wheel->base, level));
+        if (distance < 0) { continue; }
+        // a coarse slot has work to do when the base reaches its start
+        long long tick = ((wheel->base >> (WHEEL_SLOT_BITS * level)) + distance) << (WHEEL_SLOT_BITS * level);
+        if (tick < next_tick) { next_tick = tick; }
+    }
+    return next_tick;
+}
+
+
+// move every node that expires by `now` to the ready list
+void _wheelAdvance(TimingWheel* wheel, long long now)
+{
+    while (wheel->base <= now)
+    {
+        if (wheel->count == 0)
+        {
+            // nothing is parked, so there is nothing to cascade on the way
+            wheel->base = now + 1;
+            return;
+        }
+
+        int index = _wheelSlotIndex(wheel->base, 0);
+        if (wheel->occupied[0] & (1ULL << index))
+        {
+            ElementList* slot = &wheel->slots[0][index];
+            ElementListNode* node;
+            for (node = slot->head; node != NULL; node = node->next)
+            {
+                node->slot = WHEEL_READY_SLOT;
+            }
+            wheel->count = wheel->count - slot->len;
+            wheel->occupied[0] &= ~(1ULL << index);
+            wheel->earliest[0][index] = LLONG_MAX;
+            _listAppendList(&wheel->ready, slot);
+        }
+
+        // skip the idle ticks, every round boundary on the way has nothing to cascade
+        long long next_tick = _wheelNextTick(wheel);
+        wheel->base = (next_tick <= now) ? next_tick : now + 1;
+        if (_wheelSlotIndex(wheel->base, 0) == 0)
+        {
+            _wheelCascade(wheel);
+        }
+    }
+}
+
+
+// the earliest expiration of a node still in the wheel, returns 0 if the wheel is empty.
+// if that node was taken out early the slot's next one may expire later - then this is
+// a lower bound, which firms up as the wheel gets to the slot and cascades it
+int _wheelNextExpiration(TimingWheel* wheel, long long* expiration)
+{
+    if (wheel->ready.head != NULL)
+    {
+        *expiration = wheel->ready.head->expiration;
+        return 1;
+    }
+
+    int found = 0;
+    int level;
+    for (level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        int current = _wheelSlotIndex(wheel->base, level);
+        int distance;
+        if ((level == 0) && (wheel->occupied[0] & (1ULL << current)))
+        {
+            distance = 0; // the base tick itself was not processed yet
+        }
+        else
+        {
+            distance = _wheelSlotDistance(wheel->occupied[level], current);
+        }
+        if (distance < 0) { continue; }
+
+        // slots of a level are ordered, so the earliest node of the level is
+        // in its first occupied slot
+        long long earliest = wheel->earliest[level][(current + distance) & WHEEL_SLOT_MASK];
+        if ((!found) || (earliest < *expiration))
+        {
+            *expiration = earliest;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+
+//##########################################################
+//#
+//#               Dehydrator Utilities
+//#
+//#########################################################
+
+Dehydrator* _createDehydrator(RedisModuleString* dehydrator_name, int engine)
+{
+
+    Dehydrator* dehy
+        = (Dehydrator*)RedisModule_Alloc(sizeof(Dehydrator));
+
+    dehy->engine = engine;
+    _slabInit(&dehy->slabs);
+    dehy->timeout_queues = kh_init(16);
+    dehy->lease_queue = NULL;
+    _queueHeapInit(&dehy->queue_heap);
+    dehy->wheel = (engine == DEHYDRATOR_ENGINE_WHEEL) ? _createTimingWheel(current_time_ms()) : NULL;
+    dehy->element_nodes = kh_init(32);
+    dehy->integer_nodes = kh_init(64);
+    dehy->name = dehydrator_name;
+    dehy->dispatch = DISPATCH_NONE;
+    dehy->dispatch_target = NULL;
+    dehy->dispatch_db = -1;
+    dehy->dispatch_next = NULL;
+    dehy->dispatch_prev = NULL;
+    dehy->element_bytes = 0;
+    memset(&dehy->stats, 0, sizeof(DehydratorStats));
+    dehy->lateness = NULL;
+    _lockDehydrators();
+    dehydrator_count = dehydrator_count + 1;
+    _unlockDehydrators();
+
+    return dehy;
+}
+
+
+// parse a dispatch target type, returns -1 if it is not a known one
+int _parseDispatch(RedisModuleString* dispatch_name)
+{
+    const char* dispatch = RedisModule_StringPtrLen(dispatch_name, NULL);
+    if (strcasecmp(dispatch, "NONE") == 0) { return DISPATCH_NONE; }
+    if (strcasecmp(dispatch, "CHANNEL") == 0) { return DISPATCH_CHANNEL; }
+    if (strcasecmp(dispatch, "LIST") == 0) { return DISPATCH_LIST; }
+    if (strcasecmp(dispatch, "STREAM") == 0) { return DISPATCH_STREAM; }
+    return -1;
+}
+
+
+// set (or clear, with DISPATCH_NONE) where the dehydrator's expired elements are sent.
+// the dehydrator takes ownership of the target.
+void _setDispatch(Dehydrator* dehydrator, int dispatch, RedisModuleString* target)
+{
+    if (dehydrator->dispatch_target != NULL)
+    {
+        RedisModule_FreeString(NULL, dehydrator->dispatch_target);
+        dehydrator->dispatch_target = NULL;
+    }
+
+    _lockDehydrators();
+    if ((dispatch == DISPATCH_NONE) && (dehydrator->dispatch != DISPATCH_NONE))
+    {
+        // unlink from dispatchers, a walk that was about to visit it moves on
+        if (dispatch_cursor == dehydrator) { dispatch_cursor = dehydrator->dispatch_next; }
+        if (dehydrator->dispatch_prev != NULL) { dehydrator->dispatch_prev->dispatch_next = dehydrator->dispatch_next; }
+        else { dispatchers = dehydrator->dispatch_next; }
+        if (dehydrator->dispatch_next != NULL) { dehydrator->dispatch_next->dispatch_prev = dehydrator->dispatch_prev; }
+        dehydrator->dispatch_next = NULL;
+        dehydrator->dispatch_prev = NULL;
+    }
+    else if ((dispatch != DISPATCH_NONE) && (dehydrator->dispatch == DISPATCH_NONE))
+    {
+        // link to dispatchers
+        dehydrator->dispatch_prev = NULL;
+        dehydrator->dispatch_next = dispatchers;
+        if (dispatchers != NULL) { dispatchers->dispatch_prev = dehydrator; }
+        dispatchers = dehydrator;
+    }
+
+    dehydrator->dispatch = dispatch;
+    dehydrator->dispatch_target = target;
+    _unlockDehydrators();
+}
+
+
+// parse an engine name, returns -1 if it is not a known engine
+int _parseEngine(RedisModuleString* engine_name)
+{
+    const char* engine = RedisModule_StringPtrLen(engine_name, NULL);
+    if (strcasecmp(engine, "QUEUEMAP") == 0) { return DEHYDRATOR_ENGINE_QUEUEMAP; }
+    if (strcasecmp(engine, "WHEEL") == 0) { return DEHYDRATOR_ENGINE_WHEEL; }
+    return -1;
+}
+
+
+char* printDehydrator(Dehydrator* dehydrator)
+{
+    char* dehy_str = RedisModule_Alloc(sizeof(char));
+    dehy_str[0] = '\0';
+    khiter_t k;
+
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        TimingWheel* wheel = dehydrator->wheel;
+        char base[80];
+        sprintf(base, "\n======== timing wheel (base=%lld) =========", wheel->base);
+        dehy_str = string_append(dehy_str, base);
+        if (wheel->ready.len > 0)
+        {
+            dehy_str = string_append(dehy_str, "\n>>Ready: ");
+            char* list_str = printList(&wheel->ready);
+            dehy_str = string_append(dehy_str, list_str);
+            RedisModule_Free(list_str);
+        }
+        int level, index;
+        for (level = 0; level < WHEEL_LEVELS; ++level)
+        {
+            for (index = 0; index < WHEEL_SLOTS; ++index)
+            {
+                ElementList* slot = &wheel->slots[level][index];
+                if (slot->len == 0) { continue; }
+                char snum[50];
+                sprintf(snum, "\n>>Slot: %d/%d ", level, index);
+                dehy_str = string_append(dehy_str, snum);
+                char* list_str = printList(slot);
+                dehy_str = string_append(dehy_str, list_str);
+                RedisModule_Free(list_str);
+            }
+        }
+    }
+    else
+    {
+        dehy_str = string_append(dehy_str, "\n======== timeout_queues =========");
+        for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+        {
+            if (kh_exist(dehydrator->timeout_queues, k))
+            {
+                ElementList* list = kh_value(dehydrator->timeout_queues, k);
+                dehy_str = string_append(dehy_str, "\n>>List: ");
+                char qnum[50];
+                sprintf(qnum,"%d ", kh_key(dehydrator->timeout_queues, k));
+                dehy_str = string_append(dehy_str, qnum);
+
+                char* list_str = printList(list);
+                dehy_str = string_append(dehy_str, list_str);
+                RedisModule_Free(list_str);
+            }
+        }
+        if (dehydrator->lease_queue != NULL)
+        {
+            dehy_str = string_append(dehy_str, "\n>>Leased: ");
+            char* list_str = printList(dehydrator->lease_queue);
+            dehy_str = string_append(dehy_str, list_str);
+            RedisModule_Free(list_str);
+        }
+    }
+    dehy_str = string_append(dehy_str, "\n");
+
+    dehy_str = string_append(dehy_str, "\n======== element_nodes issues =========\n");
+    int found_problems = 0;
+    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->element_nodes, k);
+            if (strcmp(_nodeId(node), kh_key(dehydrator->element_nodes, k)) != 0)
+            {
+                dehy_str = string_append(dehy_str, _nodeId(node));
+                dehy_str = string_append(dehy_str, "is stored under id: ");
+                dehy_str = string_append(dehy_str, kh_key(dehydrator->element_nodes, k));
+                dehy_str = string_append(dehy_str, "\n");
+                found_problems = 1;
+            }
+        }
+    }
+    for (k = kh_begin(dehydrator->integer_nodes); k != kh_end(dehydrator->integer_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->integer_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->integer_nodes, k);
+            long long id;
+            if (!parse_integer_id(_nodeId(node), node->id_len, &id) || (id != kh_key(dehydrator->integer_nodes, k)))
+            {
+                char key_str[32];
+                sprintf(key_str, "%lld", (long long)kh_key(dehydrator->integer_nodes, k));
+                dehy_str = string_append(dehy_str, _nodeId(node));
+                dehy_str = string_append(dehy_str, "is stored under id: ");
+                dehy_str = string_append(dehy_str, key_str);
+                dehy_str = string_append(dehy_str, "\n");
+                found_problems = 1;
+            }
+        }
+    }
+    if (!found_problems)
+    {
+        dehy_str = string_append(dehy_str, "no issues were found.\n");
+    }
+    dehy_str = string_append(dehy_str, "================================\n");
+
+    return dehy_str;
+}
+
+
+static void _initDehydratorsLock(void)
+{
+    // recursive, a key freed while the dispatchers are walked (say, a lazy expire) is
+    // detached on the walking thread
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&dehydrators_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+
+void _lockDehydrators(void)
+{
+    pthread_once(&dehydrators_lock_once, _initDehydratorsLock);
+    pthread_mutex_lock(&dehydrators_lock);
+}
+
+
+void _unlockDehydrators(void)
+{
+    pthread_mutex_unlock(&dehydrators_lock);
+}
+
+
+long long _dehydratorCount(void)
+{
+    _lockDehydrators();
+    long long count = dehydrator_count;
+    _unlockDehydrators();
+    return count;
+}
+
+
+// unlink a dehydrator from the module's shared state, this can run on any thread
+void _detachDehydrator(Dehydrator* dehydrator)
+{
+    _lockDehydrators();
+    // stop dispatching, a walk that is visiting it learns it is gone
+    _setDispatch(dehydrator, DISPATCH_NONE, NULL);
+    if (dispatch_current == dehydrator) { dispatch_current = NULL; }
+    RedisModule_FreeString(NULL, dehydrator->name);
+    dehydrator->name = NULL;
+    dehydrator_count = dehydrator_count - 1;
+    _unlockDehydrators();
+}
+
+
+// free everything a dehydrator owns. it only touches the dehydrator's own memory, so once it
+// is detached (see _detachDehydrator) this can run on any thread.
+void _freeDehydrator(Dehydrator* dehydrator)
+{
+    khiter_t k;
+
+    // delete the timeout_queues dictionary, the lists are freed with the slabs
+    kh_destroy(16, dehydrator->timeout_queues);
+    _queueHeapDestroy(&dehydrator->queue_heap);
+
+    if (dehydrator->wheel != NULL)
+    {
+        deleteTimingWheel(dehydrator->wheel);
+    }
+
+    // clear and delete the element_nodes dictionary, nodes that live outside the
+    // slabs (or hold a large element) are freed one by one
+    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->element_nodes, k);
+            kh_del(32, dehydrator->element_nodes, k);
+            if ((node->element != NULL) || (_nodeSize(node) > SLAB_MAX_OBJECT_SIZE))
+            {
+                deleteNode(dehydrator, node);
+            }
+        }
+    }
+    kh_destroy(32, dehydrator->element_nodes);
+    for (k = kh_begin(dehydrator->integer_nodes); k != kh_end(dehydrator->integer_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->integer_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->integer_nodes, k);
+            if ((node->element != NULL) || (_nodeSize(node) > SLAB_MAX_OBJECT_SIZE))
+            {
+                deleteNode(dehydrator, node);
+            }
+        }
+    }
+    kh_destroy(64, dehydrator->integer_nodes);
+
+    // all the nodes and lists at once
+    _slabDestroy(&dehydrator->slabs);
+
+    // delete the dehydrator
+    if (dehydrator->lateness != NULL)
+    {
+        RedisModule_Free(dehydrator->lateness);
+    }
+    RedisModule_Free(dehydrator);
+}
+
+
+void deleteDehydrator(Dehydrator* dehydrator)
+{
+    _detachDehydrator(dehydrator);
+    _freeDehydrator(dehydrator);
+}
+
+
+// the memory of a khash table - keys, values and the 2 flag bits of every bucket
+#define _khashBytes(h, key_size, value_size) \
+    ((long long)kh_n_buckets(h) * ((key_size) + (value_size)) + ((kh_n_buckets(h) < 16) ? 1 : kh_n_buckets(h) >> 4) * 4)
+
+
+// an estimate of all the memory held by a dehydrator
+long long _dehydratorBytes(Dehydrator* dehydrator)
+{
+    long long bytes = sizeof(Dehydrator) + _slabBytes(&dehydrator->slabs) + dehydrator->slabs.large_bytes +
+        dehydrator->element_bytes + dehydrator->queue_heap.capacity * sizeof(ElementList*);
+    bytes += _khashBytes(dehydrator->timeout_queues, sizeof(khint32_t), sizeof(ElementList*));
+    bytes += _khashBytes(dehydrator->element_nodes, sizeof(const char*), sizeof(ElementListNode*));
+    bytes += _khashBytes(dehydrator->integer_nodes, sizeof(khint64_t), sizeof(ElementListNode*));
+    if (dehydrator->wheel != NULL)
+    {
+        bytes += sizeof(TimingWheel);
+    }
+    return bytes;
+}
+
+
+// the number of non-empty queues - timeout queues, or wheel slots (and the ready list)
+long long _dehydratorQueues(Dehydrator* dehydrator)
+{
+    if (dehydrator->wheel == NULL)
+    {
+        return dehydrator->queue_heap.len;
+    }
+    long long queues = (dehydrator->wheel->ready.len > 0) ? 1 : 0;
+    int level;
+    for (level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        uint64_t occupied = dehydrator->wheel->occupied[level];
+        for (; occupied != 0; occupied &= occupied - 1)
+        {
+            ++queues;
+        }
+    }
+    return queues;
+}
+
+
+ElementListNode* _findNode(Dehydrator* dehydrator, const char* id, size_t id_len)
+{
+    khiter_t k;
+    long long integer_id;
+    if (parse_integer_id(id, id_len, &integer_id))
+    {
+        k = kh_get(64, dehydrator->integer_nodes, integer_id);
+        return (k != kh_end(dehydrator->integer_nodes)) ? kh_value(dehydrator->integer_nodes, k) : NULL;
+    }
+
+    k = kh_get(32, dehydrator->element_nodes, id);  // first have to get iterator
+    return (k != kh_end(dehydrator->element_nodes)) ? kh_value(dehydrator->element_nodes, k) : NULL;
+}
+
+
+ElementListNode* _getNodeForID(Dehydrator* dehydrator, RedisModuleString* element_id)
+{
+		if (element_id == NULL)
+		{
+			return NULL;
+		}
+
+        size_t id_len;
+        const char* id = RedisModule_StringPtrLen(element_id, &id_len);
+        return _findNode(dehydrator, id, id_len);
+}
+
+// map a node by its id, replacing whatever node had the same id
+void _mapNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    int retval;
+    khiter_t k;
+    long long integer_id;
+    if (parse_integer_id(_nodeId(node), node->id_len, &integer_id))
+    {
+        k = kh_put(64, dehydrator->integer_nodes, integer_id, &retval);
+        kh_value(dehydrator->integer_nodes, k) = node;
+    }
+    else
+    {
+        k = kh_put(32, dehydrator->element_nodes, _nodeId(node), &retval);
+        // the key may belong to a node that is being replaced
+        kh_key(dehydrator->element_nodes, k) = _nodeId(node);
+        kh_value(dehydrator->element_nodes, k) = node;
+    }
+}
+
+void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node)
+{
+    khiter_t k;
+    long long integer_id;
+    if (parse_integer_id(_nodeId(node), node->id_len, &integer_id))
+    {
+        k = kh_get(64, dehydrator->integer_nodes, integer_id);
+        if ((k != kh_end(dehydrator->integer_nodes)) && (kh_value(dehydrator->integer_nodes, k) == node))
+        {
+            kh_del(64, dehydrator->integer_nodes, k);
+        }
+        return;
+    }
+
+    k = kh_get(32, dehydrator->element_nodes, _nodeId(node));  // first have to get iterator
+    if ((k != kh_end(dehydrator->element_nodes)) && (kh_value(dehydrator->element_nodes, k) == node)) // k will be equal to kh_end if key not present
+    {
+        kh_del(32, dehydrator->element_nodes, k);
+    }
+}
+
+// get timeout_queues[ttl], creating an empty queue if there is none (Queue-Map engine)
+ElementList* _getTimeoutQueue(Dehydrator* dehydrator, int ttl)
+{
+    ElementList* timeout_queue = NULL;
+    khiter_t k = kh_get(16, dehydrator->timeout_queues, ttl);  // first have to get iterator
+    if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+    {
+        timeout_queue = kh_val(dehydrator->timeout_queues, k);
+    }
+    if (timeout_queue == NULL) //does not exist
+    {
+        // create an empty ElementList and add it to timeout_queues
+        timeout_queue = _createNewList(dehydrator);
+        int retval;
+        k = kh_put(16, dehydrator->timeout_queues, ttl, &retval);
+        kh_value(dehydrator->timeout_queues, k) = timeout_queue;
+    }
+    return timeout_queue;
+}
+
+
+// the queue claimed nodes wait in, creating it if there is none (Queue-Map engine). claims
+// are mostly made with the same lease, so nodes are mostly appended to it
+ElementList* _getLeaseQueue(Dehydrator* dehydrator)
+{
+    if (dehydrator->lease_queue == NULL)
+    {
+        dehydrator->lease_queue = _createNewList(dehydrator);
+    }
+    return dehydrator->lease_queue;
+}
+
+
+// the queue a node belongs in, creating it if there is none (Queue-Map engine)
+ElementList* _getNodeQueue(Dehydrator* dehydrator, ElementListNode* node)
+{
+    return (node->flags & NODE_LEASED) ? _getLeaseQueue(dehydrator) : _getTimeoutQueue(dehydrator, node->ttl);
+}
+
+
+// push a node to the tail of the timeout queue of its ttl (Queue-Map engine).
+// a node that expires before the tail (an absolute expiration, or the clock going back)
+// is walked back to its place, so the queue stays sorted
+void _queueInsertNode(Dehydrator* dehydrator, ElementList* timeout_queue, ElementListNode* node)
+{
+    if ((timeout_queue->tail == NULL) || (timeout_queue->tail->expiration <= node->expiration))
+    {
+        _listPush(timeout_queue, node);
+        if (timeout_queue->len == 1)
+        {
+            // a new queue, index it by its (only) element
+            _queueHeapInsert(&dehydrator->queue_heap, timeout_queue);
+        }
+        return;
+    }
+
+    ElementListNode* after = timeout_queue->tail;
+    while ((after != NULL) && (after->expiration > node->expiration))
+    {
+        after = after->prev;
+    }
+    _listInsertAfter(timeout_queue, after, node);
+    if (after == NULL)
+    {
+        // the queue has a new head, so its place in the heap may change
+        _queueHeapUpdate(&dehydrator->queue_heap, timeout_queue);
+    }
+}
+
+
+// store a node according to its ttl and expiration, in whatever engine the dehydrator uses
+void _insertNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelPlace(dehydrator->wheel, node);
+        return;
+    }
+
+    _queueInsertNode(dehydrator, _getNodeQueue(dehydrator, node), node);
+}
+
+
+// unlink a node from the engine, the node is still in element_nodes
+void _unlinkNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelRemove(dehydrator->wheel, node);
+    }
+    else
+    {
+        _listPull(dehydrator, node);
+    }
+}
+
+
+// put `replacement` where `node` is in the engine, `node` is left unlinked
+void _replaceNode(Dehydrator* dehydrator, ElementListNode* node, ElementListNode* replacement)
+{
+    ElementList* list;
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        list = (node->slot == WHEEL_READY_SLOT) ? &dehydrator->wheel->ready :
+            &dehydrator->wheel->slots[node->slot / WHEEL_SLOTS][node->slot % WHEEL_SLOTS];
+    }
+    else
+    {
+        list = _getNodeQueue(dehydrator, node);
+    }
+    _listReplace(list, node, replacement);
+    replacement->slot = node->slot;
+}
+
+
+// the first expired node, without taking it out. NULL if nothing expired by `now`.
+ElementListNode* _peekExpiredNode(Dehydrator* dehydrator, long long now)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelAdvance(dehydrator->wheel, now);
+        return dehydrator->wheel->ready.head;
+    }
+
+    ElementList* list = _queueHeapTop(&dehydrator->queue_heap);
+    if ((list == NULL) || (list->head->expiration > now)) { return NULL; }
+    return list->head;
+}
+
+
+// pop the earliest expiring node if it expired by `now`, NULL otherwise.
+// the node is unlinked from its queue but is still in element_nodes.
+ElementListNode* _popExpiredNode(Dehydrator* dehydrator, long long now)
+{
+    ElementListNode* node = _peekExpiredNode(dehydrator, now);
+    if (node != NULL)
+    {
+        _unlinkNode(dehydrator, node);
+    }
+    return node;
+}
+
+
+// the earliest expiration in the dehydrator, returns 0 if it is empty
+int _nextExpiration(Dehydrator* dehydrator, long long* expiration)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        return _wheelNextExpiration(dehydrator->wheel, expiration);
+    }
+
+    ElementList* list = _queueHeapTop(&dehydrator->queue_heap);
+    if (list == NULL) { return 0; }
+    *expiration = list->head->expiration;
+    return 1;
+}
+
+
+// store a created node in the dehydrator's engine and map its id.
+// `queue` (may be NULL) caches the timeout queue of the previous store in a batch.
+void _storeNode(Dehydrator* dehydrator, ElementListNode* node, ElementList** queue)
+{
+    if ((queue != NULL) && (dehydrator->engine == DEHYDRATOR_ENGINE_QUEUEMAP) && !(node->flags & NODE_LEASED))
+    {
+        if ((*queue == NULL) || ((*queue)->tail->ttl != node->ttl))
+        {
+            *queue = _getTimeoutQueue(dehydrator, node->ttl);
+        }
+        _queueInsertNode(dehydrator, *queue, node);
+    }
+    else
+    {
+        _insertNode(dehydrator, node);
+    }
+
+    // mark element dehytion location in element_nodes
+    _mapNode(dehydrator, node);
+}
+
+
+// queues are listed by XPOLL in ttl order, the lease queue last
+static inline long long _queueOrder(ElementListNode* node)
+{
+    return (node->flags & NODE_LEASED) ? (long long)INT_MAX + 1 : node->ttl;
+}
+
+
+// a min-heap of queues by ttl, so that queues are taken in ttl order only as they are needed
+static void _ttlHeapSiftDown(ElementList** queues, int len, int index)
+{
+    ElementList* list = queues[index];
+    long long order = _queueOrder(list->head);
+    while (1)
+    {
+        int child = 2 * index + 1;
+        if (child >= len) { break; }
+        if ((child + 1 < len) && (_queueOrder(queues[child + 1]->head) < _queueOrder(queues[child]->head))) { ++child; }
+        if (order <= _queueOrder(queues[child]->head)) { break; }
+        queues[index] = queues[child];
+        index = child;
+    }
+    queues[index] = list;
+}
+
+
+// visit the expired nodes without removing them, queue by queue (ordered by ttl), starting
+// right after `resume` when it is given. stops early when `visit` returns 0.
+// returns the number of visited nodes.
+int _visitExpiredNodes(Dehydrator* dehydrator, long long now, ElementListNode* resume,
+    ExpiredNodeVisitor visit, void* data)
+{
+    int visited = 0;
+    ElementListNode* node;
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        // everything expired by now is gathered in the ready list
+        _wheelAdvance(dehydrator->wheel, now);
+        node = (resume != NULL) ? resume->next : dehydrator->wheel->ready.head;
+        for (; (node != NULL) && (node->expiration <= now); node = node->next)
+        {
+            if (!visit(node, data)) { break; }
+            ++visited;
+        }
+        return visited;
+    }
+
+    // the queues that have expired elements, taken from the queue heap and then in ttl
+    // order so that a walk can be resumed. a walk that stops early does not order the rest
+    QueueHeap* heap = &dehydrator->queue_heap;
+    if ((heap->len == 0) || (_queueHeapTop(heap)->head->expiration > now)) { return 0; }
+    ElementList** queues = RedisModule_Alloc(heap->len * sizeof(ElementList*));
+    int expired = _queueHeapExpired(heap, now, queues);
+    int queue_count = 0, i;
+    for (i = 0; i < expired; ++i)
+    {
+        if ((resume != NULL) && (_queueOrder(queues[i]->head) < _queueOrder(resume))) { continue; }
+        queues[queue_count++] = queues[i];
+    }
+    for (i = queue_count / 2 - 1; i >= 0; --i)
+    {
+        _ttlHeapSiftDown(queues, queue_count, i);
+    }
+
+    while (queue_count > 0)
+    {
+        ElementList* queue = queues[0];
+        queues[0] = queues[--queue_count];
+        if (queue_count > 0) { _ttlHeapSiftDown(queues, queue_count, 0); }
+
+        node = queue->head;
+        if ((resume != NULL) && (_queueOrder(node) == _queueOrder(resume))) { node = resume->next; }
+        for (; (node != NULL) && (node->expiration <= now); node = node->next)
+        {
+            if (!visit(node, data)) { queue_count = 0; break; }
+            ++visited;
+        }
+    }
+    RedisModule_Free(queues);
+    return visited;
+}
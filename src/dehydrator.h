@@ -0,0 +1,319 @@
+#ifndef __DEHYDRATOR_H__
+#define __DEHYDRATOR_H__
+
+/*
+* The dehydrator core - element lists, the queue heap, the timing wheel, the slab allocator and
+* the id maps. It only needs Redis for memory and for the strings of large elements, so it can
+* be driven without a server as well (see dehydrator_bench.c).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include "redismodule.h"
+
+// the hash maps allocate through redis too, so their memory is accounted for
+#define kcalloc(N,Z) RedisModule_Calloc(N,Z)
+#define kmalloc(Z) RedisModule_Alloc(Z)
+#define krealloc(P,Z) RedisModule_Realloc(P,Z)
+#define kfree(P) RedisModule_Free(P)
+#include "khash.h"
+
+
+//##########################################################
+//#
+//#               Linked List Definitions
+//#
+//#########################################################
+
+#define NODE_LEASED 1 // claimed by XPOLL LEASE, may be acked before it expires again. the
+                      // expiration is the end of the lease, the ttl is the one it was pushed with
+
+// a node is a single allocation - the id (NUL terminated, element_nodes keys point at
+// it) is stored right after the struct, followed by the element itself when it is
+// small enough. larger elements are kept in a RedisModuleString of their own.
+typedef struct element_list_node{
+    struct element_list_node* next;
+    struct element_list_node* prev;
+    long long expiration;
+    int ttl;
+    int16_t slot; // timing wheel engine only - the wheel slot the node is parked in
+    uint16_t flags; // NODE_*
+    uint32_t id_len;
+    uint32_t element_len; // of an inline element
+    RedisModuleString* element; // NULL when the element is inline
+    char data[];
+} ElementListNode;
+
+typedef struct element_list{
+    ElementListNode* head;
+    ElementListNode* tail;
+    int len;
+    int heap_index; // position of this list in the dehydrator's queue heap
+} ElementList;
+
+
+// min-heap of the TTL queues, ordered by the expiration of each queue's head
+typedef struct queue_heap{
+    ElementList** lists;
+    int len;
+    int capacity;
+} QueueHeap;
+
+
+// hierarchical timing wheel, each level has WHEEL_SLOTS slots, and each slot
+// of level L spans WHEEL_SLOTS^L milliseconds. level 0 slots are single ticks.
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_READY_SLOT -1
+
+typedef struct timing_wheel{
+    ElementList slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS]; // bitmap of the non-empty slots in each level
+    // the earliest expiration placed in each slot since it was last empty. nodes taken out
+    // early are not accounted for, so it is a lower bound until the slot empties or cascades
+    long long earliest[WHEEL_LEVELS][WHEEL_SLOTS];
+    ElementList ready; // expired nodes, waiting to be polled
+    long long base; // the next tick (ms) the wheel has to process
+    long long count; // number of nodes parked in slots (not counting ready)
+} TimingWheel;
+
+
+// size-class slab allocator, a dehydrator carves its nodes and lists out of
+// slabs instead of asking the redis allocator for each one of them
+#define SLAB_CLASS_GRANULARITY 16
+#define SLAB_CLASS_COUNT 16 // classes of 16, 32, ..., 256 bytes
+#define SLAB_MAX_OBJECT_SIZE (SLAB_CLASS_GRANULARITY * SLAB_CLASS_COUNT)
+#define SLAB_MIN_OBJECTS 8 // objects in the first slab of a class, each new slab doubles it
+#define SLAB_MAX_OBJECTS 256
+
+typedef struct slab{
+    struct slab* prev; // in the list of slabs with free objects
+    struct slab* next;
+    void* free_list; // free objects of this slab, each one points to the next
+    long long objects;
+    long long used; // objects handed out, the slab is released when it drops to 0
+    long long padding; // keeps the objects that follow the header 16 byte aligned
+} Slab;
+
+typedef struct slab_class{
+    Slab** slabs; // by address, so the slab of an object is found by a binary search
+    long long slab_count;
+    long long slab_capacity;
+    Slab* partial; // the slabs with free objects, allocations are taken from the first one
+    long long objects; // capacity of all the slabs
+    long long used; // objects handed out
+} SlabClass;
+
+typedef struct slab_allocator{
+    SlabClass classes[SLAB_CLASS_COUNT];
+    long long large_used; // objects too big for any class, served by the redis allocator
+    long long large_bytes; // the size of those objects
+} SlabAllocator;
+
+
+//##########################################################
+//#
+//#                     Hash Maps
+//#
+//#########################################################
+
+KHASH_MAP_INIT_INT(16, ElementList*);
+
+KHASH_MAP_INIT_STR(32, ElementListNode*);
+
+KHASH_MAP_INIT_INT64(64, ElementListNode*);
+
+
+//##########################################################
+//#
+//#                     Dehydrator
+//#
+//#########################################################
+
+#define DEHYDRATOR_ENGINE_QUEUEMAP 0
+#define DEHYDRATOR_ENGINE_WHEEL 1
+
+// counters kept for each dehydrator, and summed up for the whole module (see REDE.STATS)
+typedef struct dehydrator_stats{
+    long long pushed; // elements pushed
+    long long pulled; // elements pulled by id (PULL, MPULL)
+    long long expired; // expired elements taken out by POLL, BPOLL or the dispatcher
+    long long leased; // expired elements claimed by XPOLL LEASE
+    long long acked; // elements removed by XACK
+    long long updated; // elements replaced by UPDATE
+} DehydratorStats;
+
+typedef struct dehydrator{
+    int engine; // one of DEHYDRATOR_ENGINE_*
+    SlabAllocator slabs; // nodes and lists of this dehydrator
+    khash_t(16) *timeout_queues; //<ttl,ElementList> (Queue-Map engine)
+    ElementList* lease_queue; // claimed nodes, whatever their ttl, by expiration - NULL when empty (Queue-Map engine)
+    QueueHeap queue_heap; // non-empty timeout_queues and lease_queue, earliest head on top (Queue-Map engine)
+    TimingWheel* wheel; // (Timing-Wheel engine)
+    khash_t(32) * element_nodes; //<element_id,node*> ids that are not integers
+    khash_t(64) * integer_nodes; //<element_id,node*> integer ids
+    RedisModuleString* name;
+    int dispatch; // one of DISPATCH_*, where expired elements are sent by the server
+    RedisModuleString* dispatch_target; // channel or key name
+    int dispatch_db; // -1 until the dispatcher finds the key
+    struct dehydrator* dispatch_next;
+    struct dehydrator* dispatch_prev;
+    long long element_bytes; // size of the elements too large to be kept inline
+    DehydratorStats stats;
+    struct latency_histogram* lateness; // ms between expiration and release, NULL until the first release
+} Dehydrator;
+
+#define DISPATCH_NONE 0
+#define DISPATCH_CHANNEL 1
+#define DISPATCH_LIST 2
+#define DISPATCH_STREAM 3
+
+// called for each expired node by _visitExpiredNodes, returns 0 to stop the walk
+typedef int (*ExpiredNodeVisitor)(ElementListNode* node, void* data);
+
+// all the dehydrators with a dispatch target
+extern Dehydrator* dispatchers;
+// the dispatcher a walk over `dispatchers` visits next, kept valid when it is detached
+extern Dehydrator* dispatch_cursor;
+// the dispatcher a walk is visiting, set to NULL when it is detached (opening its key can
+// expire it) so the walk does not touch it again
+extern Dehydrator* dispatch_current;
+// the dehydrators that were created, and not deleted yet
+extern long long dehydrator_count;
+
+
+//##########################################################
+//#
+//#                     Inline Helpers
+//#
+//#########################################################
+
+static inline int _slabClassIndex(size_t size)
+{
+    return (int)((size + SLAB_CLASS_GRANULARITY - 1) / SLAB_CLASS_GRANULARITY) - 1;
+}
+
+
+static inline size_t _slabClassSize(int index)
+{
+    return (size_t)(index + 1) * SLAB_CLASS_GRANULARITY;
+}
+
+
+// whether an element of this size is copied into the node, or kept as a string
+static inline int _nodeFitsInline(size_t id_len, size_t element_len)
+{
+    return sizeof(ElementListNode) + id_len + 1 + element_len <= SLAB_MAX_OBJECT_SIZE;
+}
+
+
+static inline size_t _nodeSize(ElementListNode* node)
+{
+    return sizeof(ElementListNode) + node->id_len + 1 + ((node->element == NULL) ? node->element_len : 0);
+}
+
+
+static inline const char* _nodeId(ElementListNode* node)
+{
+    return node->data;
+}
+
+
+static inline const char* _nodeElement(ElementListNode* node, size_t* len)
+{
+    if (node->element != NULL)
+    {
+        return RedisModule_StringPtrLen(node->element, len);
+    }
+    *len = node->element_len;
+    return node->data + node->id_len + 1;
+}
+
+
+//##########################################################
+//#
+//#                     Functions
+//#
+//#########################################################
+
+// C utilities
+char* string_append(char* a, const char* b);
+void init_clock(void);
+long long current_time_us(void);
+long long current_time_ms(void);
+int parse_integer_id(const char* id, size_t len, long long* value);
+
+// queue heap
+void _queueHeapInit(QueueHeap* heap);
+void _queueHeapDestroy(QueueHeap* heap);
+void _queueHeapInsert(QueueHeap* heap, ElementList* list);
+void _queueHeapUpdate(QueueHeap* heap, ElementList* list);
+void _queueHeapRemove(QueueHeap* heap, ElementList* list);
+ElementList* _queueHeapTop(QueueHeap* heap);
+int _queueHeapExpired(QueueHeap* heap, long long now, ElementList** lists);
+
+// slab allocator
+void _slabInit(SlabAllocator* allocator);
+void _slabDestroy(SlabAllocator* allocator);
+long long _slabBytes(SlabAllocator* allocator);
+void* _slabAlloc(SlabAllocator* allocator, size_t size);
+void _slabFree(SlabAllocator* allocator, void* object, size_t size);
+
+// linked lists and nodes
+ElementListNode* _createNewNode(Dehydrator* dehydrator, const char* element_id, size_t id_len, const char* element, size_t element_len, RedisModuleString* large_element, long long ttl, long long expiration);
+void deleteNode(Dehydrator* dehydrator, ElementListNode* node);
+void _listInit(ElementList* list);
+ElementList* _createNewList(Dehydrator* dehydrator);
+void deleteList(Dehydrator* dehydrator, ElementList* list);
+void _listPush(ElementList* list, ElementListNode* node);
+void _listInsertAfter(ElementList* list, ElementListNode* after, ElementListNode* node);
+ElementListNode* _listPop(ElementList* list);
+void _listRemove(ElementList* list, ElementListNode* node);
+void _listReplace(ElementList* list, ElementListNode* node, ElementListNode* replacement);
+void _listAppendList(ElementList* dst, ElementList* src);
+void _listPull(Dehydrator* dehydrator, ElementListNode* node);
+char* printNode(ElementListNode* node);
+char* printList(ElementList* list);
+
+// timing wheel
+TimingWheel* _createTimingWheel(long long now);
+void deleteTimingWheel(TimingWheel* wheel);
+void _wheelPlace(TimingWheel* wheel, ElementListNode* node);
+void _wheelRemove(TimingWheel* wheel, ElementListNode* node);
+void _wheelAdvance(TimingWheel* wheel, long long now);
+int _wheelNextExpiration(TimingWheel* wheel, long long* expiration);
+
+// dehydrators
+Dehydrator* _createDehydrator(RedisModuleString* dehydrator_name, int engine);
+int _parseDispatch(RedisModuleString* dispatch_name);
+void _setDispatch(Dehydrator* dehydrator, int dispatch, RedisModuleString* target);
+int _parseEngine(RedisModuleString* engine_name);
+char* printDehydrator(Dehydrator* dehydrator);
+void _lockDehydrators(void);
+void _unlockDehydrators(void);
+long long _dehydratorCount(void);
+void _detachDehydrator(Dehydrator* dehydrator);
+void _freeDehydrator(Dehydrator* dehydrator);
+void deleteDehydrator(Dehydrator* dehydrator);
+long long _dehydratorBytes(Dehydrator* dehydrator);
+long long _dehydratorQueues(Dehydrator* dehydrator);
+ElementListNode* _findNode(Dehydrator* dehydrator, const char* id, size_t id_len);
+ElementListNode* _getNodeForID(Dehydrator* dehydrator, RedisModuleString* element_id);
+void _mapNode(Dehydrator* dehydrator, ElementListNode* node);
+void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node);
+ElementList* _getTimeoutQueue(Dehydrator* dehydrator, int ttl);
+ElementList* _getLeaseQueue(Dehydrator* dehydrator);
+ElementList* _getNodeQueue(Dehydrator* dehydrator, ElementListNode* node);
+void _queueInsertNode(Dehydrator* dehydrator, ElementList* timeout_queue, ElementListNode* node);
+void _insertNode(Dehydrator* dehydrator, ElementListNode* node);
+void _unlinkNode(Dehydrator* dehydrator, ElementListNode* node);
+void _replaceNode(Dehydrator* dehydrator, ElementListNode* node, ElementListNode* replacement);
+ElementListNode* _peekExpiredNode(Dehydrator* dehydrator, long long now);
+ElementListNode* _popExpiredNode(Dehydrator* dehydrator, long long now);
+int _nextExpiration(Dehydrator* dehydrator, long long* expiration);
+void _storeNode(Dehydrator* dehydrator, ElementListNode* node, ElementList** queue);
+int _visitExpiredNodes(Dehydrator* dehydrator, long long now, ElementListNode* resume, ExpiredNodeVisitor visit, void* data);
+
+#endif
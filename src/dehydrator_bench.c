@@ -0,0 +1,363 @@
+/*
+* dehydrator_bench - microbenchmarks for the dehydrator core (dehydrator.c), without Redis.
+*
+* the core only needs a handful of module API calls - allocation and plain strings - so
+* they are provided here, and the allocation ones count every call and the live bytes.
+*
+* usage: dehydrator_bench [-e queuemap|wheel] [-n elements] [-t ttls] [-i int|string|ulid]
+*                         [-p payload_bytes] [-r rounds]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "dehydrator.h"
+
+
+//##########################################################
+//#
+//#                     Module API Shim
+//#
+//#########################################################
+
+struct RedisModuleString
+{
+    size_t len;
+    char* ptr;
+};
+
+// every block carries its size in front, so that frees can be counted in bytes
+#define ALLOC_HEADER sizeof(long long)
+
+static long long alloc_calls = 0;
+static long long live_bytes = 0;
+
+static void* _benchAlloc(size_t bytes)
+{
+    long long* block = malloc(bytes + ALLOC_HEADER);
+    if (block == NULL) { abort(); }
+    block[0] = bytes;
+    ++alloc_calls;
+    live_bytes += bytes;
+    return block + 1;
+}
+
+static void* _benchCalloc(size_t nmemb, size_t size)
+{
+    void* ptr = _benchAlloc(nmemb * size);
+    memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+static void _benchFree(void* ptr)
+{
+    if (ptr == NULL) { return; }
+    long long* block = (long long*)ptr - 1;
+    live_bytes -= block[0];
+    free(block);
+}
+
+static void* _benchRealloc(void* ptr, size_t bytes)
+{
+    if (ptr == NULL) { return _benchAlloc(bytes); }
+    long long* block = (long long*)ptr - 1;
+    live_bytes -= block[0];
+    block = realloc(block, bytes + ALLOC_HEADER);
+    if (block == NULL) { abort(); }
+    block[0] = bytes;
+    ++alloc_calls;
+    live_bytes += bytes;
+    return block + 1;
+}
+
+static RedisModuleString* _benchCreateString(RedisModuleCtx* ctx, const char* ptr, size_t len)
+{
+    RedisModuleString* str = _benchAlloc(sizeof(RedisModuleString));
+    str->ptr = _benchAlloc(len + 1);
+    memcpy(str->ptr, ptr, len);
+    str->ptr[len] = '\0';
+    str->len = len;
+    return str;
+}
+
+static void _benchFreeString(RedisModuleCtx* ctx, RedisModuleString* str)
+{
+    if (str == NULL) { return; }
+    _benchFree(str->ptr);
+    _benchFree(str);
+}
+
+static const char* _benchStringPtrLen(const RedisModuleString* str, size_t* len)
+{
+    if (len != NULL) { *len = str->len; }
+    return str->ptr;
+}
+
+static void _initModuleShim(void)
+{
+    RedisModule_Alloc = _benchAlloc;
+    RedisModule_Calloc = _benchCalloc;
+    RedisModule_Realloc = _benchRealloc;
+    RedisModule_Free = _benchFree;
+    RedisModule_CreateString = _benchCreateString;
+    RedisModule_FreeString = _benchFreeString;
+    RedisModule_StringPtrLen = _benchStringPtrLen;
+}
+
+
+//##########################################################
+//#
+//#                     Workload
+//#
+//#########################################################
+
+#define ID_SHAPE_INT 0
+#define ID_SHAPE_STRING 1
+#define ID_SHAPE_ULID 2
+#define MAX_BENCH_ID 32
+
+typedef struct bench_config
+{
+    int engine;
+    int elements;
+    int ttls; // number of distinct ttls the elements are spread over
+    int id_shape;
+    int payload;
+    int rounds;
+    int stride; // coprime with elements, to shuffle the pull order
+} BenchConfig;
+
+typedef struct bench_result
+{
+    long long ns;
+    long long allocs;
+    long long ops;
+} BenchResult;
+
+static const char* ULID_CHARS = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+
+// the id of the i-th element, returns its length
+static size_t _benchId(BenchConfig* config, int i, char* id)
+{
+    switch (config->id_shape)
+    {
+        case ID_SHAPE_INT:
+            return sprintf(id, "%d", i + 1);
+        case ID_SHAPE_STRING:
+            return sprintf(id, "element_%08d", i);
+        default:
+        {
+            // 10 chars of millisecond timestamp and 16 of "randomness", like a ULID
+            unsigned long long stamp = 1500000000000ULL + i;
+            unsigned long long bits = (unsigned long long)(i + 1) * 0x9E3779B97F4A7C15ULL;
+            int j;
+            for (j = 0; j < 10; ++j) { id[j] = ULID_CHARS[(stamp >> (5 * (9 - j))) & 31]; }
+            for (j = 10; j < 26; ++j) { id[j] = ULID_CHARS[(bits >> (4 * (j - 10))) & 31]; }
+            id[26] = '\0';
+            return 26;
+        }
+    }
+}
+
+static long long _benchTTL(BenchConfig* config, int i)
+{
+    return 100 * (i % config->ttls + 1);
+}
+
+// the time by which every pushed element has expired
+static long long _benchAllExpired(BenchConfig* config, long long base)
+{
+    return base + 100 * config->ttls;
+}
+
+// element i at position i of a fixed shuffle, so pulls do not follow the push order
+static int _benchShuffle(BenchConfig* config, int i)
+{
+    return (int)(((long long)i * config->stride) % config->elements);
+}
+
+static int _gcd(int a, int b)
+{
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void _benchStart(BenchResult* result)
+{
+    result->allocs = alloc_calls;
+    result->ns = current_time_us() * 1000;
+}
+
+static void _benchStop(BenchResult* result, long long ops)
+{
+    result->ns = current_time_us() * 1000 - result->ns;
+    result->allocs = alloc_calls - result->allocs;
+    result->ops = ops;
+}
+
+static void _pushAll(BenchConfig* config, Dehydrator* dehydrator, const char* payload, long long base)
+{
+    char id[MAX_BENCH_ID];
+    int i;
+    for (i = 0; i < config->elements; ++i)
+    {
+        size_t id_len = _benchId(config, i, id);
+        RedisModuleString* large_element = NULL;
+        if (!_nodeFitsInline(id_len, config->payload))
+        {
+            large_element = _benchCreateString(NULL, payload, config->payload);
+        }
+        long long ttl = _benchTTL(config, i);
+        ElementListNode* node = _createNewNode(dehydrator, id, id_len, payload, config->payload,
+            large_element, ttl, base + ttl);
+        _storeNode(dehydrator, node, NULL);
+    }
+}
+
+static int _countVisit(ElementListNode* node, void* data)
+{
+    ++(*(long long*)data);
+    return 1;
+}
+
+
+//##########################################################
+//#
+//#                     Benchmarks
+//#
+//#########################################################
+
+static void _report(const char* name, BenchResult* result)
+{
+    double ops = result->ops > 0 ? (double)result->ops : 1;
+    printf("%-8s %12lld ops %10.1f ns/op %8.2f allocs/op\n", name, result->ops,
+        result->ns / ops, result->allocs / ops);
+}
+
+static void _runRound(BenchConfig* config, const char* payload)
+{
+    BenchResult result;
+    char id[MAX_BENCH_ID];
+    int i;
+    long long base = current_time_ms();
+    Dehydrator* dehydrator = _createDehydrator(NULL, config->engine);
+    long long empty_bytes = live_bytes;
+
+    // push
+    _benchStart(&result);
+    _pushAll(config, dehydrator, payload, base);
+    _benchStop(&result, config->elements);
+    _report("push", &result);
+    printf("%-8s %12.1f bytes/element (allocated) %8.1f bytes/element (accounted)\n", "memory",
+        (double)(live_bytes - empty_bytes) / config->elements,
+        (double)_dehydratorBytes(dehydrator) / config->elements);
+
+    // pull, in shuffled order
+    _benchStart(&result);
+    long long pulled = 0;
+    for (i = 0; i < config->elements; ++i)
+    {
+        size_t id_len = _benchId(config, _benchShuffle(config, i), id);
+        ElementListNode* node = _findNode(dehydrator, id, id_len);
+        if (node == NULL) { continue; }
+        _unlinkNode(dehydrator, node);
+        _removeNodeFromMapping(dehydrator, node);
+        deleteNode(dehydrator, node);
+        ++pulled;
+    }
+    _benchStop(&result, pulled);
+    _report("pull", &result);
+
+    // xpoll - list every expired element, without removing them
+    _pushAll(config, dehydrator, payload, base);
+    long long now = _benchAllExpired(config, base);
+    long long visited = 0;
+    _benchStart(&result);
+    _visitExpiredNodes(dehydrator, now, NULL, _countVisit, &visited);
+    _benchStop(&result, visited);
+    _report("xpoll", &result);
+
+    // poll - pop every expired element
+    _benchStart(&result);
+    long long polled = 0;
+    ElementListNode* node;
+    while ((node = _popExpiredNode(dehydrator, now)) != NULL)
+    {
+        _removeNodeFromMapping(dehydrator, node);
+        deleteNode(dehydrator, node);
+        ++polled;
+    }
+    _benchStop(&result, polled);
+    _report("poll", &result);
+
+    deleteDehydrator(dehydrator);
+}
+
+static void _usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-e queuemap|wheel] [-n elements] [-t ttls] [-i int|string|ulid] "
+        "[-p payload_bytes] [-r rounds]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config = { DEHYDRATOR_ENGINE_QUEUEMAP, 1000000, 8, ID_SHAPE_STRING, 16, 3, 1 };
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:t:i:p:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e':
+                if (strcasecmp(optarg, "queuemap") == 0) { config.engine = DEHYDRATOR_ENGINE_QUEUEMAP; }
+                else if (strcasecmp(optarg, "wheel") == 0) { config.engine = DEHYDRATOR_ENGINE_WHEEL; }
+                else { _usage(argv[0]); }
+                break;
+            case 'n': config.elements = atoi(optarg); break;
+            case 't': config.ttls = atoi(optarg); break;
+            case 'i':
+                if (strcasecmp(optarg, "int") == 0) { config.id_shape = ID_SHAPE_INT; }
+                else if (strcasecmp(optarg, "string") == 0) { config.id_shape = ID_SHAPE_STRING; }
+                else if (strcasecmp(optarg, "ulid") == 0) { config.id_shape = ID_SHAPE_ULID; }
+                else { _usage(argv[0]); }
+                break;
+            case 'p': config.payload = atoi(optarg); break;
+            case 'r': config.rounds = atoi(optarg); break;
+            default: _usage(argv[0]);
+        }
+    }
+    if ((config.elements <= 0) || (config.ttls <= 0) || (config.payload < 0) || (config.rounds <= 0))
+    {
+        _usage(argv[0]);
+    }
+
+    // any stride coprime with the element count makes a permutation
+    config.stride = 7919;
+    while (_gcd(config.stride, config.elements) != 1) { config.stride += 2; }
+
+    _initModuleShim();
+    init_clock();
+
+    char* payload = malloc(config.payload + 1);
+    memset(payload, 'x', config.payload);
+    payload[config.payload] = '\0';
+
+    static const char* id_shapes[] = { "int", "string", "ulid" };
+    printf("engine=%s elements=%d ttls=%d ids=%s payload=%d\n",
+        config.engine == DEHYDRATOR_ENGINE_WHEEL ? "wheel" : "queuemap",
+        config.elements, config.ttls, id_shapes[config.id_shape], config.payload);
+
+    int round;
+    for (round = 1; round <= config.rounds; ++round)
+    {
+        printf("-- round %d\n", round);
+        _runRound(&config, payload);
+    }
+    free(payload);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+/*
+* latency histograms, shared by the module's statistics and the rede_load tool
+*/
+
+// HDR-style latency histogram - log-linear buckets, each power of two is split into
+// LATENCY_SUB_BUCKETS, so a recorded latency is off by at most 1/8. latencies up to
+// 2^LATENCY_MAX_BITS units are kept, longer ones are clamped. command latencies are
+// kept in microseconds (up to about 12 days), expiry lateness in milliseconds.
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct latency_histogram
+{
+    long long count;
+    long long max;
+    long long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+
+static inline int _latencyBucket(long long us)
+{
+    if (us < 2 * LATENCY_SUB_BUCKETS) { return (us < 0) ? 0 : (int)us; }
+    if (us >= (1LL << LATENCY_MAX_BITS)) { us = (1LL << LATENCY_MAX_BITS) - 1; }
+    int shift = 63 - __builtin_clzll((unsigned long long)us) - LATENCY_SUB_BUCKET_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + (int)((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+
+// the highest latency that falls in a bucket
+static inline long long _latencyBucketTop(int bucket)
+{
+    if (bucket < 2 * LATENCY_SUB_BUCKETS) { return bucket; }
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    long long bottom = (long long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    return bottom + (1LL << shift) - 1;
+}
+
+
+static inline void _recordLatency(LatencyHistogram* histogram, long long us)
+{
+    histogram->buckets[_latencyBucket(us)]++;
+    histogram->count = histogram->count + 1;
+    if (us > histogram->max) { histogram->max = us; }
+}
+
+
+// the latency that `permille` of the recorded ones are at or below (0 if there are none)
+static inline long long _latencyPercentile(LatencyHistogram* histogram, int permille)
+{
+    if (histogram->count == 0) { return 0; }
+    long long rank = (histogram->count * permille + 999) / 1000;
+    long long seen = 0;
+    int i;
+    for (i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank) { break; }
+    }
+    long long top = _latencyBucketTop(i);
+    return (top < histogram->max) ? top : histogram->max;
+}
+
+
+// add the latencies recorded in `src` to `dst`
+static inline void _mergeLatency(LatencyHistogram* dst, LatencyHistogram* src)
+{
+    int i;
+    for (i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    if (src->max > dst->max) { dst->max = src->max; }
+}
+
+#endif
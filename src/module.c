@@ -7,8 +7,9 @@
 #include <stdio.h>
 #include <time.h>
 #include <inttypes.h>
-#include <math.h>
-#include "khash.h"
+#include <limits.h>
+#include "dehydrator.h"
+#include "latency.h"
 #include "rmutil/util.h"
 #include "rmutil/strings.h"
 #include "rmutil/test_util.h"
@@ -21,1090 +22,2665 @@
 //#
 //#########################################################
 
-#define ID_LENGTH 31
-#define ALLOWED_ID_CHARS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+// generated ids are ULIDs - a 48 bit millisecond timestamp followed by 80 random
+// bits, written as 26 Crockford base32 characters so they sort by creation time
+#define ID_LENGTH 26
+#define ALLOWED_ID_CHARS "0123456789ABCDEFGHJKMNPQRSTVWXYZ"
 
-char* string_append(char* a, const char* b)
+// LEB128 varints - append `value` to `buf` (room for 10 bytes), returns the bytes written
+size_t varint_encode(uint64_t value, unsigned char* buf)
 {
-    char* retstr = RedisModule_Alloc(strlen(a)+strlen(b));
-    strcpy(retstr, a);
-    strcat(retstr, b);
-    // printf("printing: %s", retstr);
-    RedisModule_Free(a);
-    return retstr;
+    size_t len = 0;
+    while (value >= 0x80)
+    {
+        buf[len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (unsigned char)value;
+    return len;
 }
 
-
-long long current_time_ms (void)
+// read a varint from *pos (not past `end`) and advance *pos, returns 0 if it is malformed
+int varint_decode(const unsigned char** pos, const unsigned char* end, uint64_t* value)
 {
-    long            ms; // Milliseconds
-    time_t          s;  // Seconds
-    struct timespec spec;
-
-    clock_gettime(CLOCK_REALTIME, &spec);
+    uint64_t result = 0;
+    int shift;
+    for (shift = 0; (shift < 64) && (*pos < end); shift += 7)
+    {
+        unsigned char byte = *((*pos)++);
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    s  = spec.tv_sec*1000;
-    ms = round(spec.tv_nsec / 1.0e6); // Convert nanoseconds to milliseconds
+static inline uint64_t zigzag_encode(long long value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
 
-    return s+ms;
+static inline long long zigzag_decode(uint64_t value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
 }
 
-// Assumes 0 <= max <= RAND_MAX
-// Assumes srandom was already initialzed at some point
-// Returns in the closed interval [0, max]
-long random_at_most(long max) {
-    unsigned long
-      // max <= RAND_MAX < ULONG_MAX, so this is okay.
-      num_bins = (unsigned long) max + 1,
-      num_rand = (unsigned long) RAND_MAX + 1,
-      bin_size = num_rand / num_bins,
-      defect   = num_rand % num_bins;
+static uint64_t id_random_state; // xorshift64* state, seeded once on load
+static long long id_last_ms = -1;
+static uint16_t id_random_high; // the 80 random bits of the last id
+static uint64_t id_random_low;
 
-    long x;
-    do {
-     x = random();
+void seed_id_generator(void)
+{
+    uint64_t seed = 0;
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (urandom != NULL)
+    {
+        if (fread(&seed, sizeof(seed), 1, urandom) != 1) { seed = 0; }
+        fclose(urandom);
     }
-    // This is carefully written not to overflow
-    while (num_rand - defect <= (unsigned long)x);
+    seed ^= ((uint64_t)current_time_us() << 16) ^ (uint64_t)getpid();
+    id_random_state = (seed != 0) ? seed : 0x9E3779B97F4A7C15ULL;
+}
 
-    // Truncated division is intentional
-    return x/bin_size;
+static inline uint64_t id_random_next(void)
+{
+    id_random_state ^= id_random_state >> 12;
+    id_random_state ^= id_random_state << 25;
+    id_random_state ^= id_random_state >> 27;
+    return id_random_state * 0x2545F4914F6CDD1DULL;
 }
 
-// Returnes a Redis Alloced charset that needs to be Freed
-char* generate_id(void)
+// write a new id for time `now` into `id` (ID_LENGTH chars, not NUL terminated).
+// ids never repeat - within the same millisecond (or if `now` goes back) the
+// random part of the last id is incremented instead of drawn again
+void generate_id(char* id, long long now)
 {
-    char* uuid = RedisModule_Alloc((ID_LENGTH+1)*sizeof(char));
-    long allowed_char_range = strlen(ALLOWED_ID_CHARS)-1;
+    if (now > id_last_ms)
+    {
+        id_last_ms = now;
+        id_random_high = (uint16_t)id_random_next();
+        id_random_low = id_random_next();
+    }
+    else if ((++id_random_low == 0) && (++id_random_high == 0))
+    {
+        // 2^80 ids in one millisecond - borrow the next one
+        ++id_last_ms;
+    }
 
+    uint64_t time_bits = (uint64_t)id_last_ms;
     int i;
-    for (i=0;i<ID_LENGTH;++i)
+    for (i = 9; i >= 0; --i)
     {
-        uuid[i] = ALLOWED_ID_CHARS[random_at_most(allowed_char_range)];
+        id[i] = ALLOWED_ID_CHARS[time_bits & 31];
+        time_bits >>= 5;
+    }
+    // the 80 random bits, 5 at a time from the bottom
+    uint64_t low = id_random_low;
+    uint64_t high = id_random_high;
+    for (i = ID_LENGTH - 1; i >= 10; --i)
+    {
+        id[i] = ALLOWED_ID_CHARS[low & 31];
+        low = (low >> 5) | ((high & 31) << 59);
+        high >>= 5;
     }
-    uuid[ID_LENGTH] = 0;
-    return uuid;
 }
 
 
 //##########################################################
 //#
-//#               Linked List Definitions
+//#                     Type
 //#
 //#########################################################
 
-typedef struct element_list_node{
-    RedisModuleString* element;
-    RedisModuleString* element_id;
-    int ttl;
-    long long expiration;
-    struct element_list_node* next;
-    struct element_list_node* prev;
-} ElementListNode;
+static RedisModuleType *DehydratorType;
 
-typedef struct element_list{
-    ElementListNode* head;
-    ElementListNode* tail;
-    int len;
-} ElementList;
 
 
 //##########################################################
 //#
-//#                     Hash Maps
+//#                     Statistics
 //#
 //#########################################################
 
-KHASH_MAP_INIT_INT(16, ElementList*);
-
-KHASH_MAP_INIT_STR(32, ElementListNode*);
-
+static DehydratorStats module_stats; // the stats of all the dehydrators, deleted ones included
+
+// add `n` to a counter of the dehydrator and of the module
+#define _countStat(dehydrator, field, n) \
+    do { (dehydrator)->stats.field += (n); module_stats.field += (n); } while (0)
+
+// the commands that have their latency recorded
+#define STAT_PUSH 0
+#define STAT_GIDPUSH 1
+#define STAT_MPUSH 2
+#define STAT_GIDMPUSH 3
+#define STAT_MPUSHAT 4
+#define STAT_PULL 5
+#define STAT_MPULL 6
+#define STAT_POLL 7
+#define STAT_BPOLL 8
+#define STAT_XPOLL 9
+#define STAT_XACK 10
+#define STAT_LOOK 11
+#define STAT_MLOOK 12
+#define STAT_UPDATE 13
+#define STAT_TTN 14
+#define STAT_COMMANDS 15
+
+static const char* command_stat_names[STAT_COMMANDS] = {"push", "gidpush", "mpush", "gidmpush", "mpushat",
+    "pull", "mpull", "poll", "bpoll", "xpoll", "xack", "look", "mlook", "update", "ttn"};
+static LatencyHistogram command_latency[STAT_COMMANDS];
+static LatencyHistogram no_lateness; // reported for dehydrators that did not release anything yet
+
+
+// record how late an element is released, `lateness` ms after its expiration
+void _recordLateness(Dehydrator* dehydrator, long long lateness)
+{
+    if (dehydrator->lateness == NULL)
+    {
+        dehydrator->lateness = RedisModule_Calloc(1, sizeof(LatencyHistogram));
+    }
+    _recordLatency(dehydrator->lateness, lateness);
+}
 
-//##########################################################
-//#
-//#                     Type
-//#
-//#########################################################
 
-static RedisModuleType *DehydratorType;
+// define <command>Timed - the command, with its latency recorded under `stat`
+#define TIMED_COMMAND(command, stat) \
+    int command##Timed(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) \
+    { \
+        long long start = current_time_us(); \
+        int retval = command(ctx, argv, argc); \
+        _recordLatency(&command_latency[stat], current_time_us() - start); \
+        return retval; \
+    }
 
-typedef struct dehydrator{
-    khash_t(16) *timeout_queues; //<ttl,ElementList>
-    khash_t(32) * element_nodes; //<element_id,node*>
-    RedisModuleString* name;
-} Dehydrator;
 
 
 //##########################################################
 //#
-//#              Linked List Functions
+//#               Dehydrator Utilities
 //#
 //#########################################################
 
-
-//Creates a new Node and returns pointer to it.
-ElementListNode* _createNewNode(RedisModuleString* element, RedisModuleString* element_id, long long ttl, long long expiration)
-{
-    ElementListNode* newNode
-        = (ElementListNode*)RedisModule_Alloc(sizeof(ElementListNode));
-
-    newNode->element_id = element_id;
-    newNode->element = element;
-    newNode->expiration = expiration;
-    newNode->ttl = ttl;
-    newNode->next = NULL;
-    newNode->prev = NULL;
-    return newNode;
-}
-
-
-void deleteNode(ElementListNode* node)
-{
-    // free everything else related to the node
-    RedisModule_Free(node);
-}
-
-
-//Creates a new Node and returns pointer to it.
-ElementList* _createNewList()
+static inline void _replyWithNodeElement(RedisModuleCtx* ctx, ElementListNode* node)
 {
-    ElementList* list
-        = (ElementList*)RedisModule_Alloc(sizeof(ElementList));
-    list->head = NULL;
-    list->tail = NULL;
-    list->len = 0;
-    return list;
+    size_t len;
+    const char* element = _nodeElement(node, &len);
+    RedisModule_ReplyWithStringBuffer(ctx, element, len);
 }
 
 
-void deleteList(ElementList* list)
+Dehydrator* validateDehydratorKey(RedisModuleCtx* ctx, RedisModuleKey* key, RedisModuleString* dehydrator_name)
 {
-    ElementListNode* current = list->head;
-
-    // iterate over queue and find the element that has id = element_id
-    while(current != NULL)
+    int type = RedisModule_KeyType(key);
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != DehydratorType)
     {
-        ElementListNode* next = current->next; // save next
-        deleteNode(current);
-        current = next;  //move to next node
+        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+        RedisModule_CloseKey(key);
+        return NULL;
+    }
+    if (type == REDISMODULE_KEYTYPE_EMPTY)
+    {
+        if (dehydrator_name != NULL)
+        {
+            RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
+            Dehydrator* dehydrator = _createDehydrator(saved_dehydrator_name, DEHYDRATOR_ENGINE_QUEUEMAP);
+            RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
+            return dehydrator;
+        }
+        else
+        {
+            RedisModule_CloseKey(key);
+            return NULL;
+        }
+    }
+    else
+    {
+        return RedisModule_ModuleTypeGetValue(key);
     }
-
-    RedisModule_Free(list);
 }
 
 
-// insert a Node at tail of linked list
-void _listPush(ElementList* list, ElementListNode* node)
+#define MISSING_NIL -1 // a single nil rather than an array of them
+
+// reply with `count` nils (or just one, for MISSING_NIL) and close the key if it is empty,
+// returns 1 if it was
+int _replyToMissingDehydrator(RedisModuleCtx* ctx, RedisModuleKey* key, int count)
 {
-    if (list->tail == NULL)
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) { return 0; }
+
+    if (count == MISSING_NIL)
     {
-        list->head = node;
+        RedisModule_ReplyWithNull(ctx);
+        RedisModule_CloseKey(key);
+        return 1;
     }
-    else
+    RedisModule_ReplyWithArray(ctx, count);
+    int i;
+    for (i = 0; i < count; ++i)
     {
-        node->prev = list->tail;
-        list->tail->next = node;
+        RedisModule_ReplyWithNull(ctx);
     }
-    list->tail = node;
-    list->len = (list->len) + 1;
+    RedisModule_CloseKey(key);
+    return 1;
 }
 
+// dehydrators holding more elements than this are freed on a background thread
+#define LAZYFREE_THRESHOLD 1024
 
-// pull and return the element at the first location
-ElementListNode* _listPop(ElementList* list) {
-   if ((list == NULL) || (list->head == NULL)) { return NULL; } // if list empty
+typedef struct lazyfree_job{
+    Dehydrator* dehydrator;
+    struct lazyfree_job* next;
+} LazyFreeJob;
 
-   //save current head
-   ElementListNode* node = list->head;
+static pthread_mutex_t lazyfree_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lazyfree_cond = PTHREAD_COND_INITIALIZER;
+static LazyFreeJob* lazyfree_jobs = NULL; // guarded by lazyfree_lock
+static long long lazyfree_pending = 0; // dehydrators waiting to be freed, guarded by lazyfree_lock
+static int lazyfree_thread_state = 0; // 0 - not started, 1 - running, -1 - could not be started, guarded by lazyfree_lock
 
-   if (list->len == 1)
-   {
-       list->tail = NULL;
-       list->head = NULL;
-   }
-   else
-   {
-       // swap to new head
-       list->head = list->head->next;
-       list->head->prev = NULL;
-   }
 
-   list->len = list->len - 1;
-   return node;
+void* _lazyfreeThreadMain(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&lazyfree_lock);
+        while (lazyfree_jobs == NULL)
+        {
+            pthread_cond_wait(&lazyfree_cond, &lazyfree_lock);
+        }
+        LazyFreeJob* jobs = lazyfree_jobs;
+        lazyfree_jobs = NULL;
+        pthread_mutex_unlock(&lazyfree_lock);
 
+        while (jobs != NULL)
+        {
+            LazyFreeJob* next = jobs->next;
+            _freeDehydrator(jobs->dehydrator);
+            RedisModule_Free(jobs);
+            jobs = next;
+            pthread_mutex_lock(&lazyfree_lock);
+            lazyfree_pending = lazyfree_pending - 1;
+            pthread_mutex_unlock(&lazyfree_lock);
+        }
+    }
+    return NULL;
 }
 
 
-void _listPull(Dehydrator* dehydrator, ElementListNode* node)
+// the number of deleted dehydrators that the background thread did not free yet
+long long lazyfreePending()
 {
-    ElementList* list = NULL;
-    khiter_t k = kh_get(16, dehydrator->timeout_queues, node->ttl);  // first have to get iterator
-    if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
-    {
-        list = kh_val(dehydrator->timeout_queues, k);
-    }
-    if (list == NULL) { return; }
+    pthread_mutex_lock(&lazyfree_lock);
+    long long pending = lazyfree_pending;
+    pthread_mutex_unlock(&lazyfree_lock);
+    return pending;
+}
 
-    if (list->len == 1)
+
+// like deleteDehydrator, but large dehydrators are only detached right away and their memory
+// is handed to a background thread (the way UNLINK treats large keys), so a delete is O(1).
+// Redis calls this from its own background threads too, so it can run on any thread.
+void deleteDehydratorLazy(Dehydrator* dehydrator)
+{
+    _detachDehydrator(dehydrator);
+
+    size_t effort = kh_size(dehydrator->element_nodes) + kh_size(dehydrator->integer_nodes);
+    if (effort <= LAZYFREE_THRESHOLD)
     {
-        list->head = NULL;
-        list->tail = NULL;
-        kh_del(16, dehydrator->timeout_queues, k);
-        deleteList(list);
+        _freeDehydrator(dehydrator);
         return;
     }
 
-    //hort circuit the node (carefull! pulling from tail or head)
-    if (node == list->head)
+    LazyFreeJob* job = RedisModule_Alloc(sizeof(LazyFreeJob));
+    job->dehydrator = dehydrator;
+    pthread_mutex_lock(&lazyfree_lock);
+    if (lazyfree_thread_state == 0)
     {
-        list->head = list->head->next;
-        list->head->prev = NULL;
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        lazyfree_thread_state = (pthread_create(&thread, &attr, _lazyfreeThreadMain, NULL) == 0) ? 1 : -1;
+        pthread_attr_destroy(&attr);
     }
-    else
+    int queued = (lazyfree_thread_state > 0);
+    if (queued)
     {
-        node->prev->next = node->next;
+        job->next = lazyfree_jobs;
+        lazyfree_jobs = job;
+        lazyfree_pending = lazyfree_pending + 1;
+        pthread_cond_signal(&lazyfree_cond);
     }
+    pthread_mutex_unlock(&lazyfree_lock);
 
-    if (node == list->tail) {
-        list->tail = node->prev;
-        list->tail->next = NULL;
-    }
-    else
+    if (!queued)
     {
-        node->next->prev = node->prev;
+        RedisModule_Free(job);
+        _freeDehydrator(dehydrator);
     }
-    list->len = list->len - 1;
 }
 
-// pull from list and return an element with the following id
-ElementListNode* _listFind(ElementList* list, RedisModuleString* element_id)
-{
-    //start from head
-    ElementListNode* current = list->head;
-
-    if (current == NULL) { return NULL; } //list is empty
 
-    // iterate over queue and find the element that has id = element_id
-    while (current->element_id != element_id)
-    {
-        if (current->next == NULL) { return NULL; } // got to tail
-        current = current->next; //move to next node
-    }
+// reading the clock costs more than popping a node, so a time budget is only
+// checked once every this many elements
+#define POLL_CLOCK_CHECK_INTERVAL 64
 
-    if (current->element_id == element_id) // match found
-    {
-        return current;
-    }
+// limits for draining expired elements in one go, 0 means no limit
+typedef struct poll_limits{
+    long long count;
+    long long maxtime; // microseconds
+    long long deadline; // set by _startPollLimits
+} PollLimits;
 
-    return NULL;
-}
 
-// return the list element at the given index, NULL if OOB
-ElementListNode* _listAt(ElementList* list, int index)
+// parse [COUNT count] [MAXTIME microseconds] from argv[offset] on, replies with an error on failure.
+// if `cursor` is not NULL [CURSOR element_id] and [LEASE milliseconds] are accepted as well,
+// they are NULL and 0 if not given.
+int _parsePollLimits(RedisModuleCtx* ctx, RedisModuleString** argv, int argc, int offset, PollLimits* limits,
+    RedisModuleString** cursor, long long* lease)
 {
-    //start from head
-    ElementListNode* current = list->head;
-
-    // iterate over queue and find the element at index
+    limits->count = 0;
+    limits->maxtime = 0;
+    limits->deadline = 0;
+    if (cursor != NULL)
+    {
+        *cursor = NULL;
+        *lease = 0;
+    }
     int i;
-    for (i=0; i<index;++i)
+    for (i = offset; i < argc; i += 2)
     {
-        if (current->next == NULL) { return NULL; } // got to tail (Out Of Bounds)
-        current = current->next; //move to next node
+        const char* option = RedisModule_StringPtrLen(argv[i], NULL);
+        const char* missing;
+        long long* value = NULL;
+        if (strcasecmp(option, "COUNT") == 0)
+        {
+            missing = "ERROR: Missing value for COUNT.";
+            value = &limits->count;
+        }
+        else if (strcasecmp(option, "MAXTIME") == 0)
+        {
+            missing = "ERROR: Missing value for MAXTIME.";
+            value = &limits->maxtime;
+        }
+        else if ((cursor != NULL) && (strcasecmp(option, "CURSOR") == 0))
+        {
+            missing = "ERROR: Missing value for CURSOR.";
+        }
+        else if ((cursor != NULL) && (strcasecmp(option, "LEASE") == 0))
+        {
+            missing = "ERROR: Missing value for LEASE.";
+            value = lease;
+        }
+        else
+        {
+            RedisModule_ReplyWithError(ctx, (cursor != NULL) ?
+                "ERROR: Unknown option, expected COUNT, MAXTIME, CURSOR or LEASE." :
+                "ERROR: Unknown option, expected COUNT or MAXTIME.");
+            return REDISMODULE_ERR;
+        }
+
+        if (i + 1 >= argc)
+        {
+            RedisModule_ReplyWithError(ctx, missing);
+            return REDISMODULE_ERR;
+        }
+        if (value == NULL)
+        {
+            *cursor = argv[i + 1];
+            continue;
+        }
+        if (value == lease)
+        {
+            if ((RedisModule_StringToLongLong(argv[i + 1], lease) == REDISMODULE_ERR) ||
+                (*lease <= 0) || (*lease > INT_MAX))
+            {
+                RedisModule_ReplyWithError(ctx, "ERROR: LEASE must be a positive number of milliseconds.");
+                return REDISMODULE_ERR;
+            }
+            continue;
+        }
+
+        if ((RedisModule_StringToLongLong(argv[i + 1], value) == REDISMODULE_ERR) || (*value <= 0))
+        {
+            RedisModule_ReplyWithError(ctx, "ERROR: COUNT and MAXTIME must be positive integers.");
+            return REDISMODULE_ERR;
+        }
     }
-    return current;
+    return REDISMODULE_OK;
 }
 
-char* printNode(ElementListNode* node)
-{
-    size_t element_id_len;
-    size_t element_len;
-    const char* element_id = RedisModule_StringPtrLen(node->element_id, &element_id_len);
-    const char* element = RedisModule_StringPtrLen(node->element, &element_len);
-    char* node_str = (char*)RedisModule_Alloc((element_id_len+element_len+50)*sizeof(char));
-    sprintf(node_str, "[id=%s,elem=%s,ttl=%d,exp=%lld]", element_id, element, node->ttl, node->expiration);
-    return node_str;
 
+static inline void _startPollLimits(PollLimits* limits)
+{
+    limits->deadline = (limits->maxtime > 0) ? current_time_us() + limits->maxtime : 0;
 }
 
 
-char* printList(ElementList* list)
+// true once `done` elements exhausted the count, or (checked every few elements) the time budget
+static inline int _pollLimitReached(PollLimits* limits, long long done)
 {
-    char* list_str = RedisModule_Alloc(32*sizeof(char));
-    ElementListNode* current = list->head;
-    sprintf(list_str, "(elements=%d)\n   head", list->len);
-    // iterate over queue and find the element that has id = element_id
-    while(current != NULL)
-    {
-        list_str = string_append(list_str, "->");
-        char* node_str = printNode(current);
-        list_str = string_append(list_str, node_str);
-        RedisModule_Free(node_str);
-
-        current = current->next;  //move to next node
-    }
-    list_str = string_append(list_str, "\n   tail points to: ");
-    list_str = string_append(list_str, RedisModule_StringPtrLen(list->tail->element_id, NULL));
-    list_str = string_append(list_str,"\n");
-    return list_str;
+    if ((limits->count > 0) && (done >= limits->count)) { return 1; }
+    return (limits->deadline != 0) && (done % POLL_CLOCK_CHECK_INTERVAL == 0) &&
+        (current_time_us() >= limits->deadline);
 }
 
 
 //##########################################################
 //#
-//#               Dehydrator Utilities
+//#                     REDIS Type
 //#
 //#########################################################
 
-Dehydrator* _createDehydrator(RedisModuleString* dehydrator_name)
+// nodes are saved in chunks of about this many bytes, every chunk is a single string so
+// it is compressed by the server (rdbcompression) as a whole
+#define RDB_CHUNK_BYTES (64 * 1024)
+
+// a chunk of nodes being saved - a varint header per node, followed by its id and element:
+// [ttl] expiration delta (zigzag, from the previous node of the chunk), flags, id length,
+// element length. the ttl is only there for wheel nodes, queue nodes share their queue's.
+typedef struct rdb_chunk{
+    RedisModuleIO* rdb;
+    int with_ttl;
+    uint64_t nodes;
+    long long last_expiration;
+    unsigned char* buf;
+    size_t len;
+    size_t cap;
+} RdbChunk;
+
+
+void _rdbChunkFlush(RdbChunk* chunk)
 {
-
-    Dehydrator* dehy
-        = (Dehydrator*)RedisModule_Alloc(sizeof(Dehydrator));
-
-    dehy->timeout_queues = kh_init(16);
-    dehy->element_nodes = kh_init(32);
-    dehy->name = dehydrator_name;
-
-    return dehy;
+    if (chunk->nodes == 0) { return; }
+    RedisModule_SaveUnsigned(chunk->rdb, chunk->nodes);
+    RedisModule_SaveStringBuffer(chunk->rdb, (const char*)chunk->buf, chunk->len);
+    chunk->nodes = 0;
+    chunk->last_expiration = 0;
+    chunk->len = 0;
 }
 
 
-Dehydrator* validateDehydratorKey(RedisModuleCtx* ctx, RedisModuleKey* key, RedisModuleString* dehydrator_name)
+void _rdbChunkAdd(RdbChunk* chunk, ElementListNode* node)
 {
-    int type = RedisModule_KeyType(key);
-    if (type != REDISMODULE_KEYTYPE_EMPTY &&
-        RedisModule_ModuleTypeGetType(key) != DehydratorType)
+    size_t element_len;
+    const char* element = _nodeElement(node, &element_len);
+    size_t needed = chunk->len + 5 * 10 + node->id_len + element_len;
+    if (needed > chunk->cap)
     {
-        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
-        RedisModule_CloseKey(key);
-        return NULL;
+        chunk->cap = (needed > 2 * chunk->cap) ? needed : 2 * chunk->cap;
+        chunk->buf = RedisModule_Realloc(chunk->buf, chunk->cap);
     }
-    if (type == REDISMODULE_KEYTYPE_EMPTY)
+
+    unsigned char* pos = chunk->buf + chunk->len;
+    if (chunk->with_ttl)
     {
-        if (dehydrator_name != NULL)
-        {
-            RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
-            Dehydrator* dehydrator = _createDehydrator(saved_dehydrator_name);
-            RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
-            return dehydrator;
-        }
-        else
-        {
-            RedisModule_CloseKey(key);
-            return NULL;
-        }
+        pos += varint_encode(zigzag_encode(node->ttl), pos);
     }
-    else
+    pos += varint_encode(zigzag_encode(node->expiration - chunk->last_expiration), pos);
+    pos += varint_encode(node->flags, pos);
+    pos += varint_encode(node->id_len, pos);
+    pos += varint_encode(element_len, pos);
+    memcpy(pos, _nodeId(node), node->id_len);
+    pos += node->id_len;
+    memcpy(pos, element, element_len);
+    pos += element_len;
+    chunk->len = pos - chunk->buf;
+    chunk->last_expiration = node->expiration;
+    chunk->nodes = chunk->nodes + 1;
+
+    if (chunk->len >= RDB_CHUNK_BYTES)
     {
-        return RedisModule_ModuleTypeGetValue(key);
+        _rdbChunkFlush(chunk);
     }
 }
 
-char* printDehydrator(Dehydrator* dehydrator)
-{
-    char* dehy_str = RedisModule_Alloc(sizeof(char));
-    khiter_t k;
 
-    dehy_str = string_append(dehy_str, "\n======== timeout_queues =========");
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+void _rdbChunkAddList(RdbChunk* chunk, ElementList* list)
+{
+    ElementListNode* node;
+    for (node = list->head; node != NULL; node = node->next)
     {
-        if (kh_exist(dehydrator->timeout_queues, k))
-        {
-            ElementList* list = kh_value(dehydrator->timeout_queues, k);
-            dehy_str = string_append(dehy_str, "\n>>List: ");
-            char qnum[50];
-            sprintf(qnum,"%d ", kh_key(dehydrator->timeout_queues, k));
-            dehy_str = string_append(dehy_str, qnum);
-
-            char* list_str = printList(list);
-            dehy_str = string_append(dehy_str, list_str);
-            RedisModule_Free(list_str);
-        }
+        _rdbChunkAdd(chunk, node);
     }
-    dehy_str = string_append(dehy_str, "\n");
+}
 
-    dehy_str = string_append(dehy_str, "\n======== element_nodes issues =========\n");
-    int found_problems = 0;
-    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+
+void DehydratorTypeRdbSave(RedisModuleIO *rdb, void *value)
+{
+    Dehydrator *dehy = value;
+    RedisModule_SaveString(rdb, dehy->name);
+    RedisModule_SaveUnsigned(rdb, dehy->engine);
+    RedisModule_SaveUnsigned(rdb, dehy->dispatch);
+    if (dehy->dispatch != DISPATCH_NONE)
+    {
+        RedisModule_SaveString(rdb, dehy->dispatch_target);
+    }
+    // so that the maps can be sized up front when loading
+    RedisModule_SaveUnsigned(rdb, kh_size(dehy->element_nodes));
+    RedisModule_SaveUnsigned(rdb, kh_size(dehy->integer_nodes));
+
+    RdbChunk chunk;
+    chunk.rdb = rdb;
+    chunk.with_ttl = (dehy->engine == DEHYDRATOR_ENGINE_WHEEL);
+    chunk.nodes = 0;
+    chunk.last_expiration = 0;
+    chunk.len = 0;
+    chunk.cap = 0;
+    chunk.buf = NULL;
+
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-        if (kh_exist(dehydrator->element_nodes, k))
+        TimingWheel* wheel = dehy->wheel;
+        RedisModule_SaveUnsigned(rdb, wheel->count + wheel->ready.len);
+        _rdbChunkAddList(&chunk, &wheel->ready);
+        int level, index;
+        for (level = 0; level < WHEEL_LEVELS; ++level)
         {
-            ElementListNode* node = kh_value(dehydrator->element_nodes, k);
-            if (!RMUtil_StringEqualsC(node->element_id, kh_key(dehydrator->element_nodes, k)))
+            for (index = 0; index < WHEEL_SLOTS; ++index)
             {
-                dehy_str = string_append(dehy_str, RedisModule_StringPtrLen(node->element_id, NULL));
-                dehy_str = string_append(dehy_str, "is stored under id: ");
-                dehy_str = string_append(dehy_str, kh_key(dehydrator->element_nodes, k));
-                dehy_str = string_append(dehy_str, "\n");
-                found_problems = 1;
+                _rdbChunkAddList(&chunk, &wheel->slots[level][index]);
             }
         }
+        _rdbChunkFlush(&chunk);
+        RedisModule_Free(chunk.buf);
+        return;
+    }
+
+    RedisModule_SaveUnsigned(rdb, kh_size(dehy->timeout_queues));
+    // for each timeout_queue in timeout_queues, its chunks never mix with the next queue's
+    khiter_t k;
+    for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+    {
+        if (!kh_exist(dehy->timeout_queues, k)) continue;
+        ElementList* list = kh_value(dehy->timeout_queues, k);
+        RedisModule_SaveUnsigned(rdb, kh_key(dehy->timeout_queues, k));
+        RedisModule_SaveUnsigned(rdb, list->len);
+        _rdbChunkAddList(&chunk, list);
+        _rdbChunkFlush(&chunk);
     }
-    if (!found_problems)
+    // claimed nodes keep the ttl they were pushed with, so they are saved with it
+    ElementList* leased = dehy->lease_queue;
+    RedisModule_SaveUnsigned(rdb, (leased != NULL) ? leased->len : 0);
+    if (leased != NULL)
     {
-        dehy_str = string_append(dehy_str, "no issues were found.\n");
+        chunk.with_ttl = 1;
+        _rdbChunkAddList(&chunk, leased);
+        _rdbChunkFlush(&chunk);
     }
-    dehy_str = string_append(dehy_str, "================================\n");
-
-    return dehy_str;
+    RedisModule_Free(chunk.buf);
 }
 
 
-void deleteDehydrator(Dehydrator* dehydrator)
+// load `count` nodes saved by _rdbChunkAdd, appended to `list`, or (if it is NULL, and for claimed
+// nodes) inserted where the engine keeps them. returns REDISMODULE_ERR if the chunks are malformed.
+int _loadNodeChunks(RedisModuleIO *rdb, Dehydrator *dehy, uint64_t count, int with_ttl, long long ttl, ElementList* list)
 {
-    khiter_t k;
-
-    // clear and delete the timeout_queues dictionary
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+    RedisModuleCtx* ctx = RedisModule_GetContextFromIO(rdb);
+    while (count > 0)
     {
-        if (kh_exist(dehydrator->timeout_queues, k))
+        uint64_t nodes = RedisModule_LoadUnsigned(rdb);
+        size_t len;
+        char* buf = RedisModule_LoadStringBuffer(rdb, &len);
+        if ((nodes == 0) || (nodes > count) || (buf == NULL))
         {
-            ElementList* list = kh_value(dehydrator->timeout_queues, k);
-            kh_del(16, dehydrator->timeout_queues, k);
-            deleteList(list);
+            if (buf != NULL) { RedisModule_Free(buf); }
+            return REDISMODULE_ERR;
         }
-    }
-    kh_destroy(16, dehydrator->timeout_queues);
+        count -= nodes;
 
-    // clear and delete the element_nodes dictionary
-    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
-    {
-        if (kh_exist(dehydrator->element_nodes, k))
+        const unsigned char* pos = (const unsigned char*)buf;
+        const unsigned char* end = pos + len;
+        long long expiration = 0;
+        while (nodes--)
         {
-            kh_del(32, dehydrator->element_nodes, k);
+            uint64_t node_ttl = 0, delta, flags, id_len, element_len;
+            if ((with_ttl && !varint_decode(&pos, end, &node_ttl)) ||
+                !varint_decode(&pos, end, &delta) || !varint_decode(&pos, end, &flags) ||
+                !varint_decode(&pos, end, &id_len) || !varint_decode(&pos, end, &element_len) ||
+                (id_len > (uint64_t)(end - pos)) || (element_len > (uint64_t)(end - pos) - id_len))
+            {
+                RedisModule_Free(buf);
+                return REDISMODULE_ERR;
+            }
+            expiration += zigzag_decode(delta);
+            const char* element_id = (const char*)pos;
+            const char* element = element_id + id_len;
+            pos += id_len + element_len;
+
+            RedisModuleString* large_element = NULL;
+            if (!_nodeFitsInline(id_len, element_len))
+            {
+                large_element = RedisModule_CreateString(ctx, element, element_len);
+            }
+            ElementListNode* node = _createNewNode(dehy, element_id, id_len, element, element_len, large_element,
+                with_ttl ? zigzag_decode(node_ttl) : ttl, expiration);
+            node->flags = flags;
+            _mapNode(dehy, node);
+            if ((list != NULL) && !(node->flags & NODE_LEASED))
+            {
+                _listPush(list, node);
+            }
+            else
+            {
+                _insertNode(dehy, node);
+            }
         }
+        RedisModule_Free(buf);
     }
-    kh_destroy(32, dehydrator->element_nodes);
-
-    // delete the dehydrator
-    RedisModule_Free(dehydrator->name); //TODO: is this ok?
-    // RedisModule_FreeString(ctx, dehydrator->name);
-    RedisModule_Free(dehydrator);
+    return REDISMODULE_OK;
 }
 
 
-ElementListNode* _getNodeForID(Dehydrator* dehydrator, RedisModuleString* element_id)
-{
-		if (element_id == NULL)
-		{
-			return NULL;
-		}
-
-        ElementListNode* node = NULL;
+// room for `count` more keys without rehashing
+#define _khashReserve(name, h, count) kh_resize(name, h, (khint_t)((count) / 0.77 + 1))
 
-        khiter_t k = kh_get(32, dehydrator->element_nodes, RedisModule_StringPtrLen(element_id, NULL));  // first have to get iterator
-        if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
-        {
-            node = kh_val(dehydrator->element_nodes, k);
-        }
-        return node;
-}
 
-void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node)
+// the body of an encver 4 or 5 dehydrator, following its dispatch. frees the dehydrator if it is malformed.
+int _loadCompactDehydrator(RedisModuleIO *rdb, Dehydrator *dehy, int encver)
 {
-    khiter_t k = kh_get(32, dehydrator->element_nodes, RedisModule_StringPtrLen(node->element_id, NULL));  // first have to get iterator
-    if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
-    {
-        kh_del(32, dehydrator->element_nodes, k);
-    }
-}
-
-//##########################################################
-//#
-//#                     REDIS Type
-//#
-//#########################################################
+    _khashReserve(32, dehy->element_nodes, RedisModule_LoadUnsigned(rdb));
+    _khashReserve(64, dehy->integer_nodes, RedisModule_LoadUnsigned(rdb));
 
-void DehydratorTypeRdbSave(RedisModuleIO *rdb, void *value)
-{
-    Dehydrator *dehy = value;
-    RedisModule_SaveString(rdb, dehy->name);
-    RedisModule_SaveUnsigned(rdb, kh_size(dehy->timeout_queues));
-    // for each timeout_queue in timeout_queues
-    khiter_t k;
-    for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-        if (!kh_exist(dehy->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehy->timeout_queues, k);
-        int ttl = kh_key(dehy->timeout_queues, k);
-        RedisModule_SaveUnsigned(rdb, ttl);
-        RedisModule_SaveUnsigned(rdb, list->len);
-        ElementListNode* node = list->head;
-        int done_with_queue = 0;
-        while (!done_with_queue)
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        if (_loadNodeChunks(rdb, dehy, node_num, 1, 0, NULL) != REDISMODULE_OK)
         {
-            if ((node != NULL))
-            {
-                RedisModule_SaveUnsigned(rdb, node->expiration);
-                RedisModule_SaveString(rdb, node->element_id);
-                RedisModule_SaveString(rdb, node->element);
-                node = node->next;
-            }
-            else
-            {
-                done_with_queue = 1;
-            }
+            deleteDehydrator(dehy);
+            return REDISMODULE_ERR;
         }
+        return REDISMODULE_OK;
     }
-}
 
-void *DehydratorTypeRdbLoad(RedisModuleIO *rdb, int encver)
-{
-    if (encver != 0) { return NULL; }
-    khiter_t k;
-    RedisModuleString* name = RedisModule_LoadString(rdb);
-    Dehydrator *dehy = _createDehydrator(name);
-    //create an ElementListNode
     uint64_t queue_num = RedisModule_LoadUnsigned(rdb);
     while(queue_num--)
     {
-        ElementList* timeout_queue = _createNewList();
+        ElementList* timeout_queue = _createNewList(dehy);
         uint64_t ttl = RedisModule_LoadUnsigned(rdb);
-
         uint64_t node_num = RedisModule_LoadUnsigned(rdb);
-        while(node_num--)
+        if (_loadNodeChunks(rdb, dehy, node_num, 0, ttl, timeout_queue) != REDISMODULE_OK)
         {
-            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
-            RedisModuleString* element_id = RedisModule_LoadString(rdb);
-            RedisModuleString* element = RedisModule_LoadString(rdb);
-
-            ElementListNode* node  = _createNewNode(element, element_id, ttl, expiration);
-            _listPush(timeout_queue, node);
-
-            // mark element dehytion location in element_nodes
-            int retval;
-            k = kh_put(32, dehy->element_nodes, RedisModule_StringPtrLen(element_id, NULL), &retval);
-            kh_value(dehy->element_nodes, k) = node;
+            // the nodes loaded so far are mapped, and the list lives in the slabs
+            deleteDehydrator(dehy);
+            return REDISMODULE_ERR;
+        }
+        if (timeout_queue->len == 0)
+        {
+            deleteList(dehy, timeout_queue);
+            continue;
         }
 
         int retval;
-        k = kh_put(16, dehy->timeout_queues, ttl, &retval);
+        khiter_t k = kh_put(16, dehy->timeout_queues, ttl, &retval);
         kh_value(dehy->timeout_queues, k) = timeout_queue;
+        _queueHeapInsert(&dehy->queue_heap, timeout_queue);
     }
 
-    return dehy;
+    uint64_t leased_num = (encver >= 5) ? RedisModule_LoadUnsigned(rdb) : 0;
+    if ((leased_num > 0) && (_loadNodeChunks(rdb, dehy, leased_num, 1, 0, NULL) != REDISMODULE_OK))
+    {
+        deleteDehydrator(dehy);
+        return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
 }
 
-void DehydratorTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value)
+// read the id and element of a node and create it
+ElementListNode* _loadNode(RedisModuleIO *rdb, Dehydrator *dehy, long long ttl, long long expiration)
 {
-    // REDISMODULE_NOT_USED(aof);
-    // REDISMODULE_NOT_USED(key);
-    // REDISMODULE_NOT_USED(value);
-    // TODO: stub
-    // struct DehydratorTypeObject *hto = value;
-    // struct DehydratorTypeNode *node = hto->head;
-    // while(node) {
-    //     RedisModule_EmitAOF(aof,"HELLOTYPE.INSERT","sl",key,node->value);
-    //     node = node->next;
-    // }
-}
+    size_t id_len, element_len;
+    char* element_id = RedisModule_LoadStringBuffer(rdb, &id_len);
+    char* element = RedisModule_LoadStringBuffer(rdb, &element_len);
 
+    RedisModuleString* large_element = NULL;
+    if (!_nodeFitsInline(id_len, element_len))
+    {
+        large_element = RedisModule_CreateString(RedisModule_GetContextFromIO(rdb), element, element_len);
+    }
+    ElementListNode* node = _createNewNode(dehy, element_id, id_len, element, element_len, large_element, ttl, expiration);
+    RedisModule_Free(element_id);
+    RedisModule_Free(element);
 
-void DehydratorTypeFree(void *value)
-{
-    deleteDehydrator(value);
+    // mark element dehytion location in element_nodes
+    _mapNode(dehy, node);
+    return node;
 }
 
+void _scheduleDispatch(RedisModuleCtx* ctx, long long when);
 
-//##########################################################
-//#
-//#                     REDIS Commands
-//#
-//#########################################################
-
-int UpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+void *DehydratorTypeRdbLoad(RedisModuleIO *rdb, int encver)
 {
-    if (argc != 4)
+    // encver 0 predates engines and is always a queue map, encver 1 predates dispatching,
+    // encver 2 predates node flags, encver 3 saved every node on its own, encver 4 gave
+    // claimed nodes the ttl of their lease
+    if (encver > 5) { return NULL; }
+    khiter_t k;
+    RedisModuleString* name = RedisModule_LoadString(rdb);
+    int engine = (encver == 0) ? DEHYDRATOR_ENGINE_QUEUEMAP : (int)RedisModule_LoadUnsigned(rdb);
+    Dehydrator *dehy = _createDehydrator(name, engine);
+    int dispatch = (encver < 2) ? DISPATCH_NONE : (int)RedisModule_LoadUnsigned(rdb);
+    if (dispatch != DISPATCH_NONE)
     {
-      return RedisModule_WrongArity(ctx);
+        // the dispatcher will find which db the key was loaded into
+        _setDispatch(dehy, dispatch, RedisModule_LoadString(rdb));
+        if (RedisModule_CreateTimer != NULL)
+        {
+            // runs once loading is done
+            _scheduleDispatch(RedisModule_GetContextFromIO(rdb), current_time_ms());
+        }
+    }
+    if (encver >= 4)
+    {
+        return _loadCompactDehydrator(rdb, dehy, encver) == REDISMODULE_OK ? dehy : NULL;
     }
 
-    RedisModuleString* dehydrator_name = argv[1];
-    RedisModuleString* element_id = argv[2];
-    RedisModuleString* updated_element = argv[3];
-
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    if (engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: No Such dehydrator.");
-        return REDISMODULE_ERR;
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        while(node_num--)
+        {
+            uint64_t ttl = RedisModule_LoadUnsigned(rdb);
+            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
+            int flags = (encver < 3) ? 0 : (int)RedisModule_LoadUnsigned(rdb);
+            ElementListNode* node  = _loadNode(rdb, dehy, ttl, expiration);
+            node->flags = flags;
+            _wheelPlace(dehy->wheel, node);
+        }
+        return dehy;
     }
 
-    ElementListNode* node = _getNodeForID(dehydrator, element_id);
-    if (node == NULL)
+    //create an ElementListNode
+    uint64_t queue_num = RedisModule_LoadUnsigned(rdb);
+    while(queue_num--)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: No Such Element.");
-        return REDISMODULE_ERR;
-    } // no element with such element_id
+        ElementList* timeout_queue = _createNewList(dehy);
+        uint64_t ttl = RedisModule_LoadUnsigned(rdb);
 
-    //send reply to user
-    RedisModule_ReplyWithString(ctx, node->element);
-    RedisModule_Free(node->element);
-    node->element = RedisModule_CreateStringFromString(ctx, updated_element);
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        while(node_num--)
+        {
+            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
+            int flags = (encver < 3) ? 0 : (int)RedisModule_LoadUnsigned(rdb);
+            ElementListNode* node  = _loadNode(rdb, dehy, ttl, expiration);
+            node->flags = flags;
+            if (flags & NODE_LEASED) { _insertNode(dehy, node); }
+            else { _listPush(timeout_queue, node); }
+        }
 
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
+        if (timeout_queue->len == 0)
+        {
+            deleteList(dehy, timeout_queue);
+            continue;
+        }
+
+        int retval;
+        k = kh_put(16, dehy->timeout_queues, ttl, &retval);
+        kh_value(dehy->timeout_queues, k) = timeout_queue;
+        _queueHeapInsert(&dehy->queue_heap, timeout_queue);
+    }
+
+    return dehy;
 }
 
-int TimeToNextCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
-{
+// elements per REDE.MPUSHAT command in an AOF rewrite
+#define AOF_REWRITE_BATCH_SIZE 64
 
-    if (argc != 2)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
-    RedisModuleString* dehydrator_name = argv[1];
+typedef struct aof_batch{
+    RedisModuleIO* aof;
+    RedisModuleCtx* ctx;
+    RedisModuleString* key;
+    int flags; // of all the elements in the batch
+    int argc;
+    RedisModuleString* argv[1 + 4 * AOF_REWRITE_BATCH_SIZE]; // [LEASED] ttl expiration element id ...
+} AofBatch;
 
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+
+void _flushAofBatch(AofBatch* batch)
+{
+    if (batch->argc == 0) { return; }
+    RedisModule_EmitAOF(batch->aof, "REDE.MPUSHAT", "sv", batch->key, batch->argv, (size_t)batch->argc);
+    int i;
+    for (i = 0; i < batch->argc; ++i)
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        RedisModule_FreeString(batch->ctx, batch->argv[i]);
     }
+    batch->argc = 0;
+}
 
-    time_t now = current_time_ms();
-    int time_to_next = -1;
 
-    khiter_t k;
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+void _addToAofBatch(AofBatch* batch, ElementListNode* node)
+{
+    if ((batch->argc > 0) && (node->flags != batch->flags))
     {
-        if (!kh_exist(dehydrator->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehydrator->timeout_queues, k);
-        ElementListNode* head = list->head;
-        if (head != NULL)
+        _flushAofBatch(batch);
+    }
+    if (batch->argc == 0)
+    {
+        batch->flags = node->flags;
+        if (node->flags & NODE_LEASED)
         {
-            int tmp = head->expiration - now;
-            if (tmp <= 0)
-            {
-                time_to_next = 0;
-                break;
-            }
-            else if ((tmp < time_to_next) || (time_to_next < 0))
-            {
-                time_to_next = tmp;
-            }
+            batch->argv[batch->argc++] = RedisModule_CreateString(batch->ctx, "LEASED", 6);
         }
     }
 
-    RedisModule_CloseKey(key);
-    RedisModule_ReplyWithLongLong(ctx, time_to_next);
-    return REDISMODULE_OK;
+    size_t element_len;
+    const char* element = _nodeElement(node, &element_len);
+    batch->argv[batch->argc++] = RedisModule_CreateStringFromLongLong(batch->ctx, node->ttl);
+    batch->argv[batch->argc++] = RedisModule_CreateStringFromLongLong(batch->ctx, node->expiration);
+    batch->argv[batch->argc++] = RedisModule_CreateString(batch->ctx, element, element_len);
+    batch->argv[batch->argc++] = RedisModule_CreateString(batch->ctx, _nodeId(node), node->id_len);
+    if (batch->argc >= 4 * AOF_REWRITE_BATCH_SIZE)
+    {
+        _flushAofBatch(batch);
+    }
 }
 
-int PrintCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+
+void _addListToAofBatch(AofBatch* batch, ElementList* list)
 {
-    if (argc != 2)
+    ElementListNode* node;
+    for (node = list->head; node != NULL; node = node->next)
     {
-      return RedisModule_WrongArity(ctx);
+        _addToAofBatch(batch, node);
     }
+}
 
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+
+// the dehydrator is rewritten as its REDE.CREATE and REDE.DISPATCH, followed by batches of
+// its elements with their absolute expirations - replaying them keeps the original deadlines.
+// every queue (or wheel slot) is written in order, so replayed elements are tail pushes.
+void DehydratorTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value)
+{
+    Dehydrator *dehy = value;
+    RedisModule_EmitAOF(aof, "REDE.CREATE", "sc", key,
+        (dehy->engine == DEHYDRATOR_ENGINE_WHEEL) ? "WHEEL" : "QUEUEMAP");
+    if (dehy->dispatch != DISPATCH_NONE)
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        const char* dispatch = (dehy->dispatch == DISPATCH_CHANNEL) ? "CHANNEL" :
+            ((dehy->dispatch == DISPATCH_LIST) ? "LIST" : "STREAM");
+        RedisModule_EmitAOF(aof, "REDE.DISPATCH", "scs", key, dispatch, dehy->dispatch_target);
     }
 
-    char* dehy_str = printDehydrator(dehydrator);
-    RedisModule_CloseKey(key);
-    RedisModule_ReplyWithSimpleString(ctx, dehy_str);
-    RedisModule_Free(dehy_str);
-    return REDISMODULE_OK;
-}
-
+    AofBatch* batch = RedisModule_Alloc(sizeof(AofBatch));
+    batch->aof = aof;
+    batch->ctx = RedisModule_GetContextFromIO(aof);
+    batch->key = key;
+    batch->flags = 0;
+    batch->argc = 0;
 
-int LookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
-{
-    if (argc != 3)
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-      return RedisModule_WrongArity(ctx);
+        TimingWheel* wheel = dehy->wheel;
+        _addListToAofBatch(batch, &wheel->ready);
+        int level, index;
+        for (level = 0; level < WHEEL_LEVELS; ++level)
+        {
+            for (index = 0; index < WHEEL_SLOTS; ++index)
+            {
+                _addListToAofBatch(batch, &wheel->slots[level][index]);
+            }
+        }
     }
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    else
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        khiter_t k;
+        for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+        {
+            if (!kh_exist(dehy->timeout_queues, k)) continue;
+            _addListToAofBatch(batch, kh_value(dehy->timeout_queues, k));
+        }
+        if (dehy->lease_queue != NULL)
+        {
+            _addListToAofBatch(batch, dehy->lease_queue);
+        }
     }
+    _flushAofBatch(batch);
+    RedisModule_Free(batch);
+}
 
-    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
 
-    if ((node != NULL) && (node->element != NULL))
+void DehydratorTypeFree(void *value)
+{
+    deleteDehydratorLazy(value);
+}
+
+
+//##########################################################
+//#
+//#                     Replication
+//#
+//#########################################################
+
+// what POLL, XACK or a push do depends on the clock of the server running them, so rather
+// than the commands their effects are replicated (and appended to the AOF): stored elements
+// as REDE.MPUSHAT records with absolute expirations, and removed elements as a REDE.MPULL of
+// their exact ids. replicas apply them as they are, whatever their clocks or lag.
+typedef struct effects{
+    RedisModuleCtx* ctx;
+    int argc;
+    int capacity;
+    RedisModuleString** argv; // owned, retained or created
+} Effects;
+
+
+void _initEffects(Effects* effects, RedisModuleCtx* ctx)
+{
+    effects->ctx = ctx;
+    effects->argc = 0;
+    effects->capacity = 0;
+    effects->argv = NULL;
+}
+
+
+// the effects take over `arg`
+void _addEffect(Effects* effects, RedisModuleString* arg)
+{
+    if (effects->argc == effects->capacity)
     {
-        RedisModule_ReplyWithString(ctx, node->element);
-        RedisModule_CloseKey(key);
-        return REDISMODULE_OK;
+        effects->capacity = (effects->capacity > 0) ? effects->capacity * 2 : 16;
+        effects->argv = RedisModule_Realloc(effects->argv, effects->capacity * sizeof(RedisModuleString*));
     }
+    effects->argv[effects->argc++] = arg;
+}
 
-    RedisModule_ReplyWithNull(ctx);
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
+
+// add a string the caller keeps owning, without copying it
+static inline void _addRetainedEffect(Effects* effects, RedisModuleString* arg)
+{
+    RedisModule_RetainString(effects->ctx, arg);
+    _addEffect(effects, arg);
+}
+
+
+// a removed node, for REDE.MPULL - added before the node is deleted
+void _addRemovedNode(Effects* effects, ElementListNode* node)
+{
+    _addEffect(effects, RedisModule_CreateString(effects->ctx, _nodeId(node), node->id_len));
 }
 
-int push_impl(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* timeout,
-									RedisModuleString* element, RedisModuleString* element_id)
+
+// a stored node, as a REDE.MPUSHAT record
+void _addStoredNode(Effects* effects, ElementListNode* node)
 {
-    // timeout str to int ttl
-    long long ttl;
-    int rep = RedisModule_StringToLongLong(timeout, &ttl);
-    if (rep == REDISMODULE_ERR) { return REDISMODULE_ERR; }
+    size_t element_len;
+    const char* element = _nodeElement(node, &element_len);
+    _addEffect(effects, RedisModule_CreateStringFromLongLong(effects->ctx, node->ttl));
+    _addEffect(effects, RedisModule_CreateStringFromLongLong(effects->ctx, node->expiration));
+    _addEffect(effects, RedisModule_CreateString(effects->ctx, element, element_len));
+    _addEffect(effects, RedisModule_CreateString(effects->ctx, _nodeId(node), node->id_len));
+}
 
-    // get timeout_queues[ttl]
-    ElementList* timeout_queue = NULL;
-    khiter_t k = kh_get(16, dehydrator->timeout_queues, ttl);  // first have to get iterator
-    if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+
+void _clearEffects(Effects* effects)
+{
+    int i;
+    for (i = 0; i < effects->argc; ++i)
     {
-        timeout_queue = kh_val(dehydrator->timeout_queues, k);
+        RedisModule_FreeString(effects->ctx, effects->argv[i]);
     }
-    if (timeout_queue == NULL) //does not exist
+    effects->argc = 0;
+}
+
+
+// replicate `command` on `key` with the added arguments (if there are any) and start over
+void _replicateEffects(Effects* effects, const char* command, RedisModuleString* key)
+{
+    if (effects->argc > 0)
     {
-        // create an empty ElementList and add it to timeout_queues
-        timeout_queue = _createNewList();
-        int retval;
-        k = kh_put(16, dehydrator->timeout_queues, ttl, &retval);
-        kh_value(dehydrator->timeout_queues, k) = timeout_queue;
+        RedisModule_Replicate(effects->ctx, command, "sv", key, effects->argv, (size_t)effects->argc);
     }
+    _clearEffects(effects);
+}
 
-    //let's make our own copy of these
-    RedisModuleString* saved_element_id = RedisModule_CreateStringFromString(ctx, element_id);
 
-    RedisModuleString* saved_element = RedisModule_CreateStringFromString(ctx, element);
+void _freeEffects(Effects* effects)
+{
+    _clearEffects(effects);
+    RedisModule_Free(effects->argv);
+    effects->argv = NULL;
+    effects->capacity = 0;
+}
 
-    //create an ElementListNode
-    ElementListNode* node  = _createNewNode(saved_element, saved_element_id, ttl, current_time_ms() + ttl);
 
-    // push to tail of the list
-    _listPush(timeout_queue, node);
+//##########################################################
+//#
+//#                     Blocking Poll
+//#
+//#########################################################
 
-    // mark element dehytion location in element_nodes
-    int retval;
-    k = kh_put(32, dehydrator->element_nodes, RedisModule_StringPtrLen(saved_element_id, NULL), &retval);
-    kh_value(dehydrator->element_nodes, k) = node;
+// a client parked by REDE.BPOLL, waiting for an element to expire
+typedef struct blocked_poll{
+    RedisModuleBlockedClient* bc;
+    RedisModuleString* dehydrator_name;
+    int db;
+    long long deadline; // 0 - wait forever
+    struct blocked_poll* next;
+    struct blocked_poll* prev;
+} BlockedPoll;
+
+// the elements handed over to a blocked client once it is served
+typedef struct poll_result{
+    RedisModuleString** elements;
+    int len;
+} PollResult;
 
-    return REDISMODULE_OK;
-}
+// all the blocked clients in arrival order, they share a single timer that is
+// set to the earliest moment one of them might be served (or time out)
+static BlockedPoll* blocked_polls_head = NULL;
+static BlockedPoll* blocked_polls_tail = NULL;
+static RedisModuleTimerID blocked_polls_timer;
+static long long blocked_polls_wakeup = 0; // 0 when the timer is not set
 
 
-/*
-* dehydrator.gidpush <timeout> <element>
-* dehydrate <element> for <timeout> seconds
-*/
-int GIDPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+void _freePollResult(void* privdata)
 {
-    if (argc != 4)
+    PollResult* result = privdata;
+    if (result == NULL) { return; }
+    int i;
+    for (i = 0; i < result->len; ++i)
     {
-      return RedisModule_WrongArity(ctx);
+        RedisModule_FreeString(NULL, result->elements[i]);
     }
+    RedisModule_Free(result->elements);
+    RedisModule_Free(result);
+}
 
-    RedisModuleString * dehydrator_name = argv[1];
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
-    if (dehydrator == NULL)
-    {
-        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
-        RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
-    }
 
-    // Intializes random number generator for ID generation
-    srandom((unsigned) time(NULL));
-    RedisModuleString * element_id = NULL;
-    while ((element_id == NULL) || (_getNodeForID(dehydrator, element_id) != NULL))
+// pop the elements that expired by `now` (at most `limit` of them, 0 for all) from the
+// dehydrator at `key`, NULL if there are none. the popped ids are replicated.
+PollResult* _pollExpired(RedisModuleCtx* ctx, RedisModuleString* key, Dehydrator* dehydrator, long long now, int limit)
+{
+    ElementListNode* node = _popExpiredNode(dehydrator, now);
+    if (node == NULL) { return NULL; }
+
+    Effects effects;
+    _initEffects(&effects, ctx);
+    PollResult* result = RedisModule_Alloc(sizeof(PollResult));
+    int capacity = 16;
+    result->elements = RedisModule_Alloc(capacity * sizeof(RedisModuleString*));
+    result->len = 0;
+    for (; node != NULL; node = ((limit > 0) && (result->len == limit)) ? NULL : _popExpiredNode(dehydrator, now))
     {
-        // make sure that if this is NOT our first round we are cleaning after ourselves
-        if (element_id != NULL)
+        if (result->len == capacity)
         {
-            RedisModule_FreeString(ctx, element_id);
+            capacity *= 2;
+            result->elements = RedisModule_Realloc(result->elements, capacity * sizeof(RedisModuleString*));
         }
-
-        // generate id and transfer it to a REDIS string
-        char* tmp = generate_id();
-        element_id = RedisModule_CreateString(ctx, tmp, ID_LENGTH);
-        RedisModule_Free(tmp);
+        _recordLateness(dehydrator, now - node->expiration);
+        _removeNodeFromMapping(dehydrator, node);
+        _addRemovedNode(&effects, node);
+        if (node->element != NULL)
+        {
+            // the result owns the element now
+            size_t large_len;
+            RedisModule_StringPtrLen(node->element, &large_len);
+            dehydrator->element_bytes = dehydrator->element_bytes - large_len;
+            result->elements[result->len++] = node->element;
+            node->element = NULL;
+            node->element_len = 0;
+        }
+        else
+        {
+            size_t len;
+            const char* element = _nodeElement(node, &len);
+            result->elements[result->len++] = RedisModule_CreateString(ctx, element, len);
+        }
+        deleteNode(dehydrator, node);
     }
+    _countStat(dehydrator, expired, result->len);
+    _replicateEffects(&effects, "REDE.MPULL", key);
+    _freeEffects(&effects);
+    return result;
+}
 
 
-    int retval = push_impl(ctx, dehydrator, argv[2], argv[3], element_id);
-
-    if (retval == REDISMODULE_OK)
+void _replyWithPollResult(RedisModuleCtx* ctx, PollResult* result)
+{
+    RedisModule_ReplyWithArray(ctx, result->len);
+    int i;
+    for (i = 0; i < result->len; ++i)
     {
-        RedisModule_ReplyWithString(ctx, element_id);
+        RedisModule_ReplyWithString(ctx, result->elements[i]);
     }
-    RedisModule_FreeString(ctx, element_id);
-
-    RedisModule_CloseKey(key);
-    return retval;
 }
 
-/*
-* dehydrator.push <timeout> <element> <element_id>
-* dehydrate <element> for <timeout> seconds
-*/
-int PushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+
+void _unlinkBlockedPoll(BlockedPoll* waiter)
 {
-    if(argc != 5)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
+    if (waiter->prev != NULL) { waiter->prev->next = waiter->next; }
+    else { blocked_polls_head = waiter->next; }
+    if (waiter->next != NULL) { waiter->next->prev = waiter->prev; }
+    else { blocked_polls_tail = waiter->prev; }
+}
 
-	RedisModuleString * dehydrator_name = argv[1];
-	RedisModuleString * element_id = argv[4];
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
-    if (dehydrator == NULL)
+
+void _linkBlockedPoll(BlockedPoll* waiter)
+{
+    waiter->next = NULL;
+    waiter->prev = blocked_polls_tail;
+    if (blocked_polls_tail != NULL) { blocked_polls_tail->next = waiter; }
+    else { blocked_polls_head = waiter; }
+    blocked_polls_tail = waiter;
+}
+
+
+void _freeBlockedPoll(BlockedPoll* waiter)
+{
+    RedisModule_FreeString(NULL, waiter->dehydrator_name);
+    RedisModule_Free(waiter);
+}
+
+
+// unlink the waiter of a blocked client, NULL if it is not waiting
+BlockedPoll* _takeBlockedPoll(RedisModuleBlockedClient* bc)
+{
+    BlockedPoll* waiter;
+    for (waiter = blocked_polls_head; waiter != NULL; waiter = waiter->next)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
-        RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
+        if (waiter->bc == bc)
+        {
+            _unlinkBlockedPoll(waiter);
+            return waiter;
+        }
     }
+    return NULL;
+}
 
-    // now we know we have a dehydrator check if there is anything in id = element_id
-    ElementListNode* node = _getNodeForID(dehydrator, element_id);
-    if (node != NULL) // somthing is already there
+
+// a blocked client went away. it must be forgotten before anything is polled for it - the
+// elements would be replicated as pulled, and then freed with a reply nobody reads
+void _blockedPollDisconnected(RedisModuleCtx* ctx, RedisModuleBlockedClient* bc)
+{
+    REDISMODULE_NOT_USED(ctx);
+    BlockedPoll* waiter = _takeBlockedPoll(bc);
+    if (waiter == NULL) { return; }
+    RedisModule_UnblockClient(bc, NULL);
+    _freeBlockedPoll(waiter);
+}
+
+
+void _serveBlockedPolls(RedisModuleCtx *ctx, void *data);
+
+// make sure the blocked clients are checked again no later than `when`
+void _scheduleBlockedPolls(RedisModuleCtx* ctx, long long when)
+{
+    if (blocked_polls_head == NULL) { return; }
+    if ((blocked_polls_wakeup != 0) && (blocked_polls_wakeup <= when)) { return; }
+
+    if (blocked_polls_wakeup != 0)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
+        RedisModule_StopTimer(ctx, blocked_polls_timer, NULL);
+    }
+    long long period = when - current_time_ms();
+    blocked_polls_wakeup = when;
+    blocked_polls_timer = RedisModule_CreateTimer(ctx, (period > 0) ? period : 0, _serveBlockedPolls, NULL);
+}
+
+
+// timer callback - serve the blocked clients in order, the first client waiting
+// on a dehydrator gets everything that expired in it, like a regular POLL
+void _serveBlockedPolls(RedisModuleCtx *ctx, void *data)
+{
+    REDISMODULE_NOT_USED(data);
+    blocked_polls_wakeup = 0;
+    long long now = current_time_ms();
+    long long next_wakeup = LLONG_MAX;
+
+    BlockedPoll* waiter = blocked_polls_head;
+    while (waiter != NULL)
+    {
+        BlockedPoll* next = waiter->next;
+        PollResult* result = NULL;
+        long long expiration = LLONG_MAX;
+
+        RedisModule_SelectDb(ctx, waiter->db);
+        RedisModuleKey* key = RedisModule_OpenKey(ctx, waiter->dehydrator_name,
+            REDISMODULE_READ|REDISMODULE_WRITE);
+        if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) &&
+            (RedisModule_ModuleTypeGetType(key) == DehydratorType))
+        {
+            Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+            result = _pollExpired(ctx, waiter->dehydrator_name, dehydrator, now, 0);
+            if (result == NULL)
+            {
+                _nextExpiration(dehydrator, &expiration);
+            }
+        }
         RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
+
+        if ((result != NULL) || ((waiter->deadline != 0) && (waiter->deadline <= now)))
+        {
+            // served, or timed out (a NULL result)
+            _unlinkBlockedPoll(waiter);
+            RedisModule_UnblockClient(waiter->bc, result);
+            _freeBlockedPoll(waiter);
+        }
+        else
+        {
+            if (expiration < next_wakeup) { next_wakeup = expiration; }
+            if ((waiter->deadline != 0) && (waiter->deadline < next_wakeup)) { next_wakeup = waiter->deadline; }
+        }
+        waiter = next;
+    }
+
+    if (next_wakeup != LLONG_MAX)
+    {
+        _scheduleBlockedPolls(ctx, next_wakeup);
     }
+}
 
-    int retval = push_impl(ctx, dehydrator, argv[2], argv[3], element_id);
 
-    if (retval == REDISMODULE_OK)
+int BlockedPollReply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+    PollResult* result = RedisModule_GetBlockedClientPrivateData(ctx);
+    if (result == NULL)
     {
-        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        return RedisModule_ReplyWithNull(ctx);
     }
-    RedisModule_CloseKey(key);
-    return retval;
+    _replyWithPollResult(ctx, result);
+    return REDISMODULE_OK;
 }
 
 
-/*
-* dehydrator.pull <element_id>
-* Pull an element off the bench by id.
-*/
-int PullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+// park the calling client until something expires in `dehydrator_name`, or until the deadline
+void _blockPoll(RedisModuleCtx* ctx, RedisModuleString* dehydrator_name, long long deadline, long long expiration)
 {
-    if (argc != 3)
+    BlockedPoll* waiter = RedisModule_Alloc(sizeof(BlockedPoll));
+    // no server side timeout, deadlines are handled by our own timer
+    waiter->bc = RedisModule_BlockClient(ctx, BlockedPollReply, NULL, _freePollResult, 0);
+    if (RedisModule_SetDisconnectCallback != NULL)
     {
-      return RedisModule_WrongArity(ctx);
+        RedisModule_SetDisconnectCallback(waiter->bc, _blockedPollDisconnected);
+    }
+    waiter->dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
+    waiter->db = RedisModule_GetSelectedDb(ctx);
+    waiter->deadline = deadline;
+    _linkBlockedPoll(waiter);
+
+    long long wakeup = expiration;
+    if ((deadline != 0) && (deadline < wakeup)) { wakeup = deadline; }
+    if (wakeup != LLONG_MAX)
+    {
+        _scheduleBlockedPolls(ctx, wakeup);
     }
+}
 
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+
+// a new element may expire before the blocked clients are due to be checked
+static inline void _notifyBlockedPolls(RedisModuleCtx* ctx, long long expiration)
+{
+    if (blocked_polls_head != NULL)
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        _scheduleBlockedPolls(ctx, expiration);
     }
+}
 
-    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
-    if (node != NULL)
+
+//##########################################################
+//#
+//#                     Expiry Dispatcher
+//#
+//#########################################################
+
+// while there are dispatchers the timer wakes up at least this often, so a replica
+// that was promoted starts dispatching without waiting for a push
+#define DISPATCH_HEARTBEAT_MS 1000
+// most elements sent from one dehydrator per run
+#define DISPATCH_BATCH_SIZE 1000
+
+static RedisModuleTimerID dispatch_timer;
+static long long dispatch_wakeup = 0; // 0 when the timer is not set, armed by the first dispatcher
+
+
+void _runDispatchers(RedisModuleCtx *ctx, void *data);
+
+// make sure the dispatchers run no later than `when`
+void _scheduleDispatch(RedisModuleCtx* ctx, long long when)
+{
+    if ((dispatch_wakeup != 0) && (dispatch_wakeup <= when)) { return; }
+
+    if (dispatch_wakeup != 0)
     {
+        RedisModule_StopTimer(ctx, dispatch_timer, NULL);
+    }
+    long long period = when - current_time_ms();
+    dispatch_wakeup = when;
+    dispatch_timer = RedisModule_CreateTimer(ctx, (period > 0) ? period : 0, _runDispatchers, NULL);
+}
 
-        _listPull(dehydrator, node);
-        _removeNodeFromMapping(dehydrator, node);
 
-        if (node->element == NULL)
+static inline int _keyHoldsDehydrator(RedisModuleKey* key, Dehydrator* dehydrator)
+{
+    return (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) &&
+        (RedisModule_ModuleTypeGetType(key) == DehydratorType) &&
+        (RedisModule_ModuleTypeGetValue(key) == dehydrator);
+}
+
+
+// open the key of a dispatching dehydrator and select its db. the dbs are only looked
+// through when the db is not known yet, after the dehydrator was loaded from disk.
+// the module API tells nothing of RENAME, MOVE or SWAPDB, so a dehydrator that is no
+// longer under its name in its db can't be followed - NULL then, and for a missing key.
+// opening the key may expire it and free the dehydrator, NULL with `freed` set then, and
+// the dehydrator must not be touched again.
+RedisModuleKey* _openDispatcherKey(RedisModuleCtx* ctx, Dehydrator* dehydrator, int* freed)
+{
+    RedisModuleKey* key;
+    *freed = 0;
+    dispatch_current = dehydrator;
+    if (dehydrator->dispatch_db >= 0)
+    {
+        RedisModule_SelectDb(ctx, dehydrator->dispatch_db);
+        key = RedisModule_OpenKey(ctx, dehydrator->name, REDISMODULE_READ|REDISMODULE_WRITE);
+        *freed = (dispatch_current == NULL);
+        if (!*freed && _keyHoldsDehydrator(key, dehydrator)) { return key; }
+        RedisModule_CloseKey(key);
+        return NULL;
+    }
+
+    int db;
+    for (db = 0; RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; ++db)
+    {
+        key = RedisModule_OpenKey(ctx, dehydrator->name, REDISMODULE_READ|REDISMODULE_WRITE);
+        *freed = (dispatch_current == NULL);
+        if (*freed)
         {
-            RedisModule_ReplyWithNull(ctx);
+            RedisModule_CloseKey(key);
+            return NULL;
         }
-        else
+        if (_keyHoldsDehydrator(key, dehydrator))
         {
-            RedisModule_ReplyWithString(ctx, node->element);
+            dehydrator->dispatch_db = db;
+            return key;
         }
-        deleteNode(node);
-    }
-    else
-    {
-        // no element with such element_id
-        RedisModule_ReplyWithNull(ctx);
+        RedisModule_CloseKey(key);
     }
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
+    return NULL;
 }
 
-/*
-* dehydrator.poll
-* get all elements which were dried for long enogh
-*/
-int PollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+
+// send polled elements to the dehydrator's dispatch target. the sends are replicated ('!'),
+// so replicas get the same list or stream the polled elements were replicated out of
+void _dispatch(RedisModuleCtx* ctx, Dehydrator* dehydrator, PollResult* result)
 {
-    if (argc != 2)
+    RedisModuleCallReply* reply = NULL;
+    int i;
+    switch (dehydrator->dispatch)
     {
-      return RedisModule_WrongArity(ctx);
+        case DISPATCH_CHANNEL:
+            for (i = 0; i < result->len; ++i)
+            {
+                RedisModule_Call(ctx, "PUBLISH", "!ss", dehydrator->dispatch_target, result->elements[i]);
+            }
+            break;
+        case DISPATCH_LIST:
+            // a single push for the whole batch
+            reply = RedisModule_Call(ctx, "RPUSH", "!sv", dehydrator->dispatch_target,
+                result->elements, (size_t)result->len);
+            break;
+        case DISPATCH_STREAM:
+            for (i = 0; (i < result->len) && ((reply == NULL) ||
+                (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ERROR)); ++i)
+            {
+                reply = RedisModule_Call(ctx, "XADD", "!sccs", dehydrator->dispatch_target,
+                    "*", "element", result->elements[i]);
+            }
+            break;
     }
 
-    // get key for dehydrator
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    if ((reply != NULL) && (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR))
     {
-        RedisModule_ReplyWithArray(ctx, 0);
-        return REDISMODULE_OK;
+        RedisModule_Log(ctx, "warning", "REDE: could not dispatch %d expired elements of %s to %s",
+            result->len, RedisModule_StringPtrLen(dehydrator->name, NULL),
+            RedisModule_StringPtrLen(dehydrator->dispatch_target, NULL));
     }
+}
 
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    int expired_element_num = 0;
-    time_t now = current_time_ms();
-    // for each timeout_queue in timeout_queues
-    khiter_t k;
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+
+// timer callback - poll every dispatching dehydrator and send out what expired
+void _runDispatchers(RedisModuleCtx *ctx, void *data)
+{
+    REDISMODULE_NOT_USED(data);
+    dispatch_wakeup = 0;
+    long long now = current_time_ms();
+    long long next_wakeup = now + DISPATCH_HEARTBEAT_MS;
+
+    // the master dispatches, a replica only keeps the data
+    int flags = (RedisModule_GetContextFlags != NULL) ? RedisModule_GetContextFlags(ctx) : 0;
+    // held for the whole walk, a dehydrator freed on another thread is only freed after it
+    _lockDehydrators();
+    if (!(flags & REDISMODULE_CTX_FLAGS_SLAVE))
     {
-        if (!kh_exist(dehydrator->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehydrator->timeout_queues, k);
-        int done_with_queue = 0;
-        while ((list != NULL) && (!done_with_queue))
+        Dehydrator* dehydrator;
+        for (dehydrator = dispatchers; dehydrator != NULL; dehydrator = dispatch_cursor)
         {
-            ElementListNode* head = list->head;
-            if ((head != NULL) && (head->expiration <= now))
+            dispatch_cursor = dehydrator->dispatch_next;
+            int freed;
+            RedisModuleKey* key = _openDispatcherKey(ctx, dehydrator, &freed);
+            if (freed) { continue; } // its key expired as it was opened
+            if (key == NULL)
             {
-                ElementListNode* node = _listPop(list);
-                _removeNodeFromMapping(dehydrator, node);
-                RedisModule_ReplyWithString(ctx, node->element); // append node->element to output
-                deleteNode(node);
-                ++expired_element_num;
+                // renamed or moved, it is dropped rather than looked for on every heartbeat
+                RedisModule_Log(ctx, "warning", "REDE: %s was renamed or moved and stopped dispatching, "
+                    "run REDE.DISPATCH on its new name", RedisModule_StringPtrLen(dehydrator->name, NULL));
+                _setDispatch(dehydrator, DISPATCH_NONE, NULL);
+                continue;
             }
-            else
+
+            // large cohorts are sent out in batches, so other clients get served in between
+            PollResult* result = _pollExpired(ctx, dehydrator->name, dehydrator, now, DISPATCH_BATCH_SIZE);
+            if (result != NULL)
             {
-                // clean empty lists
-                if (list->len == 0)
-                {
-                    deleteList(list);
-                    kh_del(16, dehydrator->timeout_queues, k);
-                }
+                _dispatch(ctx, dehydrator, result);
+                _freePollResult(result);
+            }
 
-                // in any case notify we are done with this one
-                done_with_queue = 1;
+            long long expiration;
+            if (_nextExpiration(dehydrator, &expiration) && (expiration < next_wakeup))
+            {
+                // an already expired element makes this 'now' - the next event loop iteration
+                next_wakeup = expiration;
             }
+            RedisModule_CloseKey(key);
         }
+        dispatch_cursor = NULL;
+        dispatch_current = NULL;
+    }
+    int dispatching = (dispatchers != NULL);
+    _unlockDehydrators();
+
+    // the heartbeat stops with the last dispatcher, the next REDE.DISPATCH (or load) arms it again
+    if (dispatching)
+    {
+        _scheduleDispatch(ctx, next_wakeup);
+    }
+}
+
+
+// a new element may expire before the dispatcher is due to run
+static inline void _notifyDispatcher(RedisModuleCtx* ctx, Dehydrator* dehydrator, long long expiration)
+{
+    if ((dehydrator->dispatch != DISPATCH_NONE) && (RedisModule_CreateTimer != NULL))
+    {
+        _scheduleDispatch(ctx, expiration);
     }
-    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
 }
 
+
+//##########################################################
+//#
+//#                     REDIS Commands
+//#
+//#########################################################
+
 /*
-* dehydrator.xpoll
-* get all elements which were dried for long enogh, but dont remove them from the dehydrator
+* rede.create <dehydrator_name> [QUEUEMAP|WHEEL]
+* create an empty dehydrator backed by the chosen expiry engine (QUEUEMAP by default)
 */
-int XPollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+int CreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
-    if (argc != 2)
+    if ((argc != 2) && (argc != 3))
     {
       return RedisModule_WrongArity(ctx);
     }
 
-    // get key for dehydrator
+    int engine = DEHYDRATOR_ENGINE_QUEUEMAP;
+    if (argc == 3)
+    {
+        engine = _parseEngine(argv[2]);
+        if (engine == -1)
+        {
+            RedisModule_ReplyWithError(ctx, "ERROR: Unknown engine, expected QUEUEMAP or WHEEL.");
+            return REDISMODULE_ERR;
+        }
+    }
+
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
         REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)
     {
-        RedisModule_ReplyWithArray(ctx, 0);
-        return REDISMODULE_OK;
+        RedisModule_CloseKey(key);
+        RedisModule_ReplyWithError(ctx, "ERROR: Key already exists.");
+        return REDISMODULE_ERR;
     }
 
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    int expired_element_num = 0;
-    time_t now = current_time_ms();
-    // for each timeout_queue in timeout_queues
-    khiter_t k;
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
-    {
-        if (!kh_exist(dehydrator->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehydrator->timeout_queues, k);
-        if (list == NULL)
-        {
-            continue;
-        }
+    RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, argv[1]);
+    Dehydrator* dehydrator = _createDehydrator(saved_dehydrator_name, engine);
+    RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
+    RedisModule_ReplicateVerbatim(ctx);
 
-        int index = 0; //set to head
-        ElementListNode* node = _listAt(list, index);
-        while ((node != NULL) && (node->expiration <= now))
-        {
-            RedisModule_ReplyWithString(ctx, node->element_id); // append node->element_id to output
-            ++expired_element_num;
-            node = _listAt(list, ++index);
-        }
-    }
-    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
     RedisModule_CloseKey(key);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
     return REDISMODULE_OK;
 }
 
-/*
-* dehydrator.xack <element_id> <element_id> <element_id> ...
-* remove element off the bench by ids, but only if they are expired.
-* returns a list of the expired payloads, with Nulls for not-found, or not expired elements
-*/
-int XAckCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+int UpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
-    if (argc < 3)
+    if (argc != 4)
     {
       return RedisModule_WrongArity(ctx);
     }
 
+    RedisModuleString* dehydrator_name = argv[1];
+    RedisModuleString* element_id = argv[2];
+    RedisModuleString* updated_element = argv[3];
+
     // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
         REDISMODULE_READ|REDISMODULE_WRITE);
     Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
     if (dehydrator == NULL)
     {
-        RedisModule_ReplyWithArray(ctx, 0);
-        return REDISMODULE_OK;
+        RedisModule_ReplyWithError(ctx, "ERROR: No Such dehydrator.");
+        return REDISMODULE_ERR;
     }
 
-    time_t now = current_time_ms();
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    int expired_element_num = 0;
-
-    int i;
-    for (i=2;i<argc;++i)
+    ElementListNode* node = _getNodeForID(dehydrator, element_id);
+    if (node == NULL)
     {
-        ++expired_element_num;
+        RedisModule_ReplyWithError(ctx, "ERROR: No Such Element.");
+        return REDISMODULE_ERR;
+    } // no element with such element_id
 
-        ElementListNode* node = _getNodeForID(dehydrator, argv[i]);
-        if ((node != NULL) && (node->expiration <= now))
-        {
-            _listPull(dehydrator, node);
-            _removeNodeFromMapping(dehydrator, node);
+    //send reply to user
+    _replyWithNodeElement(ctx, node);
 
-            if (node->element == NULL)
-            {
-                RedisModule_ReplyWithNull(ctx);
-            }
-            else
-            {
-                RedisModule_ReplyWithString(ctx, node->element); // append node->element to output
-            }
-            deleteNode(node);
-        }
-        else
-        {
-            // no element with such element_id, or element had not expired yet
-            RedisModule_ReplyWithNull(ctx);
-        }
+    // the element may be stored inline, so the node is rebuilt around the new one
+    size_t element_len;
+    const char* element = RedisModule_StringPtrLen(updated_element, &element_len);
+    RedisModuleString* large_element = NULL;
+    if (!_nodeFitsInline(node->id_len, element_len))
+    {
+        large_element = RedisModule_CreateStringFromString(ctx, updated_element);
     }
-    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
+    ElementListNode* updated = _createNewNode(dehydrator, _nodeId(node), node->id_len,
+        element, element_len, large_element, node->ttl, node->expiration);
+    updated->flags = node->flags;
+    _replaceNode(dehydrator, node, updated);
+
+    _mapNode(dehydrator, updated);
+    deleteNode(dehydrator, node);
+    _countStat(dehydrator, updated, 1);
+    RedisModule_ReplicateVerbatim(ctx);
+
     RedisModule_CloseKey(key);
     return REDISMODULE_OK;
 }
 
+int TimeToNextCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    RedisModuleString* dehydrator_name = argv[1];
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    time_t now = current_time_ms();
+    int time_to_next = -1;
+
+    // both engines keep the earliest expiration at hand
+    long long expiration;
+    if (_nextExpiration(dehydrator, &expiration))
+    {
+        int tmp = expiration - now;
+        time_to_next = (tmp > 0) ? tmp : 0;
+    }
+
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithLongLong(ctx, time_to_next);
+    return REDISMODULE_OK;
+}
+
+int PrintCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    char* dehy_str = printDehydrator(dehydrator);
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithSimpleString(ctx, dehy_str);
+    RedisModule_Free(dehy_str);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* dehydrator.slabs <dehydrator_name>
+* report how the dehydrator's slabs are used
+*/
+int SlabsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    if (_replyToMissingDehydrator(ctx, key, MISSING_NIL)) { return REDISMODULE_OK; }
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL) { return REDISMODULE_ERR; }
+
+    SlabAllocator* allocator = &dehydrator->slabs;
+    int class_num = 0;
+    int i;
+    for (i = 0; i < SLAB_CLASS_COUNT; ++i)
+    {
+        if (allocator->classes[i].slab_count == 0) { continue; }
+        ++class_num;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 6);
+    RedisModule_ReplyWithSimpleString(ctx, "slab_bytes");
+    RedisModule_ReplyWithLongLong(ctx, _slabBytes(allocator));
+    RedisModule_ReplyWithSimpleString(ctx, "large_objects");
+    RedisModule_ReplyWithLongLong(ctx, allocator->large_used);
+    RedisModule_ReplyWithSimpleString(ctx, "classes");
+    RedisModule_ReplyWithArray(ctx, class_num);
+    for (i = 0; i < SLAB_CLASS_COUNT; ++i)
+    {
+        SlabClass* slab_class = &allocator->classes[i];
+        if (slab_class->slab_count == 0) { continue; }
+        RedisModule_ReplyWithArray(ctx, 8);
+        RedisModule_ReplyWithSimpleString(ctx, "object_size");
+        RedisModule_ReplyWithLongLong(ctx, _slabClassSize(i));
+        RedisModule_ReplyWithSimpleString(ctx, "slabs");
+        RedisModule_ReplyWithLongLong(ctx, slab_class->slab_count);
+        RedisModule_ReplyWithSimpleString(ctx, "objects");
+        RedisModule_ReplyWithLongLong(ctx, slab_class->objects);
+        RedisModule_ReplyWithSimpleString(ctx, "used");
+        RedisModule_ReplyWithLongLong(ctx, slab_class->used);
+    }
+
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+void _replyWithStats(RedisModuleCtx *ctx, DehydratorStats* stats)
+{
+    RedisModule_ReplyWithSimpleString(ctx, "pushed");
+    RedisModule_ReplyWithLongLong(ctx, stats->pushed);
+    RedisModule_ReplyWithSimpleString(ctx, "pulled");
+    RedisModule_ReplyWithLongLong(ctx, stats->pulled);
+    RedisModule_ReplyWithSimpleString(ctx, "expired");
+    RedisModule_ReplyWithLongLong(ctx, stats->expired);
+    RedisModule_ReplyWithSimpleString(ctx, "leased");
+    RedisModule_ReplyWithLongLong(ctx, stats->leased);
+    RedisModule_ReplyWithSimpleString(ctx, "acked");
+    RedisModule_ReplyWithLongLong(ctx, stats->acked);
+    RedisModule_ReplyWithSimpleString(ctx, "updated");
+    RedisModule_ReplyWithLongLong(ctx, stats->updated);
+}
+
+
+/*
+* dehydrator.stats [<dehydrator_name>]
+* the counters and sizes of a dehydrator, or without one the module wide counters and
+* the latency percentiles of every command that was called
+*/
+int StatsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc > 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    if (argc == 2)
+    {
+        // get key dehydrator_name
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+        if (_replyToMissingDehydrator(ctx, key, MISSING_NIL)) { return REDISMODULE_OK; }
+        Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+        if (dehydrator == NULL) { return REDISMODULE_ERR; }
+
+        RedisModule_ReplyWithArray(ctx, 30);
+        RedisModule_ReplyWithSimpleString(ctx, "engine");
+        RedisModule_ReplyWithSimpleString(ctx, (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL) ? "wheel" : "queuemap");
+        RedisModule_ReplyWithSimpleString(ctx, "elements");
+        RedisModule_ReplyWithLongLong(ctx, kh_size(dehydrator->element_nodes) + kh_size(dehydrator->integer_nodes));
+        RedisModule_ReplyWithSimpleString(ctx, "queues");
+        RedisModule_ReplyWithLongLong(ctx, _dehydratorQueues(dehydrator));
+        RedisModule_ReplyWithSimpleString(ctx, "bytes");
+        RedisModule_ReplyWithLongLong(ctx, _dehydratorBytes(dehydrator));
+        _replyWithStats(ctx, &dehydrator->stats);
+        // how late expired elements were released, in milliseconds
+        LatencyHistogram* lateness = (dehydrator->lateness != NULL) ? dehydrator->lateness : &no_lateness;
+        RedisModule_ReplyWithSimpleString(ctx, "lateness_p50_ms");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(lateness, 500));
+        RedisModule_ReplyWithSimpleString(ctx, "lateness_p99_ms");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(lateness, 990));
+        RedisModule_ReplyWithSimpleString(ctx, "lateness_p999_ms");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(lateness, 999));
+        RedisModule_ReplyWithSimpleString(ctx, "lateness_max_ms");
+        RedisModule_ReplyWithLongLong(ctx, lateness->max);
+        RedisModule_ReplyWithSimpleString(ctx, "dispatch");
+        RedisModule_ReplyWithSimpleString(ctx, (dehydrator->dispatch == DISPATCH_NONE) ? "none" :
+            (dehydrator->dispatch == DISPATCH_CHANNEL) ? "channel" : (dehydrator->dispatch == DISPATCH_LIST) ? "list" : "stream");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_OK;
+    }
+
+    int command_num = 0;
+    int i;
+    for (i = 0; i < STAT_COMMANDS; ++i)
+    {
+        if (command_latency[i].count > 0) { ++command_num; }
+    }
+
+    RedisModule_ReplyWithArray(ctx, 18);
+    RedisModule_ReplyWithSimpleString(ctx, "dehydrators");
+    RedisModule_ReplyWithLongLong(ctx, _dehydratorCount());
+    _replyWithStats(ctx, &module_stats);
+    RedisModule_ReplyWithSimpleString(ctx, "lazyfree_pending");
+    RedisModule_ReplyWithLongLong(ctx, lazyfreePending());
+    RedisModule_ReplyWithSimpleString(ctx, "commands");
+    RedisModule_ReplyWithArray(ctx, command_num);
+    for (i = 0; i < STAT_COMMANDS; ++i)
+    {
+        LatencyHistogram* latency = &command_latency[i];
+        if (latency->count == 0) { continue; }
+        RedisModule_ReplyWithArray(ctx, 12);
+        RedisModule_ReplyWithSimpleString(ctx, "command");
+        RedisModule_ReplyWithSimpleString(ctx, command_stat_names[i]);
+        RedisModule_ReplyWithSimpleString(ctx, "calls");
+        RedisModule_ReplyWithLongLong(ctx, latency->count);
+        RedisModule_ReplyWithSimpleString(ctx, "p50_us");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(latency, 500));
+        RedisModule_ReplyWithSimpleString(ctx, "p99_us");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(latency, 990));
+        RedisModule_ReplyWithSimpleString(ctx, "p999_us");
+        RedisModule_ReplyWithLongLong(ctx, _latencyPercentile(latency, 999));
+        RedisModule_ReplyWithSimpleString(ctx, "max_us");
+        RedisModule_ReplyWithLongLong(ctx, latency->max);
+    }
+    return REDISMODULE_OK;
+}
+
+
+// the module's section of INFO (redis 6.0 and up)
+void StatsInfo(RedisModuleInfoCtx *ctx, int for_crash_report)
+{
+    REDISMODULE_NOT_USED(for_crash_report);
+    RedisModule_InfoAddSection(ctx, "stats");
+    RedisModule_InfoAddFieldLongLong(ctx, "dehydrators", _dehydratorCount());
+    RedisModule_InfoAddFieldLongLong(ctx, "pushed", module_stats.pushed);
+    RedisModule_InfoAddFieldLongLong(ctx, "pulled", module_stats.pulled);
+    RedisModule_InfoAddFieldLongLong(ctx, "expired", module_stats.expired);
+    RedisModule_InfoAddFieldLongLong(ctx, "leased", module_stats.leased);
+    RedisModule_InfoAddFieldLongLong(ctx, "acked", module_stats.acked);
+    RedisModule_InfoAddFieldLongLong(ctx, "updated", module_stats.updated);
+    RedisModule_InfoAddFieldLongLong(ctx, "lazyfree_pending", lazyfreePending());
+
+    // one line per command, like the commandstats section
+    RedisModule_InfoAddSection(ctx, "latency");
+    int i;
+    for (i = 0; i < STAT_COMMANDS; ++i)
+    {
+        LatencyHistogram* latency = &command_latency[i];
+        if (latency->count == 0) { continue; }
+        char field[32], value[160];
+        snprintf(field, sizeof(field), "cmd_%s", command_stat_names[i]);
+        snprintf(value, sizeof(value), "calls=%lld,p50_us=%lld,p99_us=%lld,p999_us=%lld,max_us=%lld",
+            latency->count, _latencyPercentile(latency, 500), _latencyPercentile(latency, 990),
+            _latencyPercentile(latency, 999), latency->max);
+        RedisModule_InfoAddFieldCString(ctx, field, value);
+    }
+}
+
+
+int LookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
+
+    if (node != NULL)
+    {
+        _replyWithNodeElement(ctx, node);
+        RedisModule_CloseKey(key);
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithNull(ctx);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.mlook <dehydrator_name> <element_id> [<element_id> ...]
+* look up several elements at once, without pulling them
+*/
+int MLookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    if (_replyToMissingDehydrator(ctx, key, argc - 2)) { return REDISMODULE_OK; }
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL) { return REDISMODULE_ERR; }
+
+    // one reply per id, in the order of the ids
+    RedisModule_ReplyWithArray(ctx, argc - 2);
+    int i;
+    for (i = 2; i < argc; ++i)
+    {
+        ElementListNode* node = _getNodeForID(dehydrator, argv[i]);
+        if (node != NULL)
+        {
+            _replyWithNodeElement(ctx, node);
+        }
+        else
+        {
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+// create a node for an element and store it, pollers and dispatchers are not notified.
+// `queue` (may be NULL) caches the timeout queue of the previous push in a batch.
+ElementListNode* _pushElement(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* element,
+                                    RedisModuleString* element_id, long long ttl, long long expiration,
+                                    int flags, ElementList** queue)
+{
+    // the node keeps its own copy of these
+    size_t id_len, element_len;
+    const char* id_ptr = RedisModule_StringPtrLen(element_id, &id_len);
+    const char* element_ptr = RedisModule_StringPtrLen(element, &element_len);
+    RedisModuleString* large_element = NULL;
+    if (!_nodeFitsInline(id_len, element_len))
+    {
+        large_element = RedisModule_CreateStringFromString(ctx, element);
+    }
+
+    //create an ElementListNode
+    ElementListNode* node  = _createNewNode(dehydrator, id_ptr, id_len, element_ptr, element_len,
+        large_element, ttl, expiration);
+    node->flags = flags; // before it is stored, claimed nodes are kept apart
+
+    // store it in the dehydrator's engine
+    _storeNode(dehydrator, node, queue);
+    return node;
+}
+
+
+int push_impl(RedisModuleCtx *ctx, RedisModuleString* dehydrator_name, Dehydrator* dehydrator,
+                RedisModuleString* timeout, RedisModuleString* element, RedisModuleString* element_id,
+                long long now)
+{
+    // timeout str to int ttl
+    long long ttl;
+    int rep = RedisModule_StringToLongLong(timeout, &ttl);
+    if (rep == REDISMODULE_ERR) { return REDISMODULE_ERR; }
+
+    ElementListNode* node = _pushElement(ctx, dehydrator, element, element_id, ttl, now + ttl, 0, NULL);
+    _countStat(dehydrator, pushed, 1);
+    RedisModule_Replicate(ctx, "REDE.MPUSHAT", "sslss", dehydrator_name, timeout, node->expiration,
+        element, element_id);
+
+    _notifyBlockedPolls(ctx, node->expiration);
+    _notifyDispatcher(ctx, dehydrator, node->expiration);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* dehydrator.gidpush <timeout> <element>
+* dehydrate <element> for <timeout> seconds
+*/
+int GIDPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 4)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleString * dehydrator_name = argv[1];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    // generated ids are unique, no need to look for a colliding element
+    long long now = current_time_ms();
+    char id[ID_LENGTH];
+    generate_id(id, now);
+    RedisModuleString * element_id = RedisModule_CreateString(ctx, id, ID_LENGTH);
+
+    int retval = push_impl(ctx, dehydrator_name, dehydrator, argv[2], argv[3], element_id, now);
+
+    if (retval == REDISMODULE_OK)
+    {
+        RedisModule_ReplyWithString(ctx, element_id);
+    }
+    RedisModule_FreeString(ctx, element_id);
+
+    RedisModule_CloseKey(key);
+    return retval;
+}
+
+/*
+* dehydrator.push <timeout> <element> <element_id>
+* dehydrate <element> for <timeout> seconds
+*/
+int PushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if(argc != 5)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+	RedisModuleString * dehydrator_name = argv[1];
+	RedisModuleString * element_id = argv[4];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    // now we know we have a dehydrator check if there is anything in id = element_id
+    ElementListNode* node = _getNodeForID(dehydrator, element_id);
+    if (node != NULL) // somthing is already there
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    int retval = push_impl(ctx, dehydrator_name, dehydrator, argv[2], argv[3], element_id, current_time_ms());
+
+    if (retval == REDISMODULE_OK)
+    {
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    RedisModule_CloseKey(key);
+    return retval;
+}
+
+
+#define MPUSH_IDS 0 // (ttl, element, element_id) records
+#define MPUSH_GENERATED_IDS 1 // (ttl, element) records
+#define MPUSH_AT 2 // (ttl, expiration, element, element_id) records, optionally LEASED
+
+// push a batch of records laid out according to `mode`, from argv[2] on. the key, the clock
+// and the waiting pollers are only visited once per batch.
+// replies with an error and pushes nothing if any of the records is invalid.
+int mpush_impl(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int mode)
+{
+    int first = 2;
+    int flags = 0;
+    if ((mode == MPUSH_AT) && (argc > first) &&
+        (strcasecmp(RedisModule_StringPtrLen(argv[first], NULL), "LEASED") == 0))
+    {
+        flags = NODE_LEASED;
+        ++first;
+    }
+    int has_expiration = (mode == MPUSH_AT);
+    int has_id = (mode != MPUSH_GENERATED_IDS);
+    int stride = 2 + has_expiration + has_id;
+    if ((argc < first + stride) || ((argc - first) % stride != 0))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    int count = (argc - first) / stride;
+
+    // validate the whole batch before touching the dehydrator
+    int i;
+    long long ttl, expiration;
+    for (i = 0; i < count; ++i)
+    {
+        RedisModuleString** record = argv + first + i * stride;
+        if ((RedisModule_StringToLongLong(record[0], &ttl) == REDISMODULE_ERR) ||
+            (has_expiration && (RedisModule_StringToLongLong(record[1], &expiration) == REDISMODULE_ERR)))
+        {
+            RedisModule_ReplyWithError(ctx, has_expiration ?
+                "ERROR: ttl and expiration must be numbers of milliseconds." :
+                "ERROR: ttl must be a number of milliseconds.");
+            return REDISMODULE_ERR;
+        }
+    }
+
+    RedisModuleString * dehydrator_name = argv[1];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    if (!has_id)
+    {
+        RedisModule_ReplyWithArray(ctx, count);
+    }
+
+    long long now = current_time_ms();
+    long long earliest = LLONG_MAX;
+    ElementList* queue = NULL;
+    // the batch is replicated with absolute expirations (and the generated ids)
+    Effects effects;
+    _initEffects(&effects, ctx);
+    for (i = 0; i < count; ++i)
+    {
+        RedisModuleString** record = argv + first + i * stride;
+        RedisModule_StringToLongLong(record[0], &ttl);
+        expiration = now + ttl;
+        if (has_expiration)
+        {
+            RedisModule_StringToLongLong(record[1], &expiration);
+        }
+
+        RedisModuleString* element_id;
+        if (!has_id)
+        {
+            char id[ID_LENGTH];
+            generate_id(id, now);
+            element_id = RedisModule_CreateString(ctx, id, ID_LENGTH);
+        }
+        else
+        {
+            element_id = record[stride - 1];
+            if (_getNodeForID(dehydrator, element_id) != NULL)
+            {
+                // the id is taken (or repeats within the batch), take back what was pushed so far
+                int j;
+                for (j = 0; j < i; ++j)
+                {
+                    ElementListNode* node = _getNodeForID(dehydrator, argv[first + j * stride + stride - 1]);
+                    _unlinkNode(dehydrator, node);
+                    _removeNodeFromMapping(dehydrator, node);
+                    deleteNode(dehydrator, node);
+                }
+                _freeEffects(&effects);
+                RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
+                RedisModule_CloseKey(key);
+                return REDISMODULE_ERR;
+            }
+        }
+
+        ElementListNode* node = _pushElement(ctx, dehydrator, record[1 + has_expiration], element_id,
+            ttl, expiration, flags, &queue);
+        if (node->expiration < earliest) { earliest = node->expiration; }
+        if (!has_expiration)
+        {
+            _addRetainedEffect(&effects, record[0]);
+            _addEffect(&effects, RedisModule_CreateStringFromLongLong(ctx, expiration));
+            _addRetainedEffect(&effects, record[1]);
+            _addRetainedEffect(&effects, element_id);
+        }
+
+        if (!has_id)
+        {
+            RedisModule_ReplyWithString(ctx, element_id);
+            RedisModule_FreeString(ctx, element_id);
+        }
+    }
+
+    _countStat(dehydrator, pushed, count);
+    if (has_expiration)
+    {
+        // already absolute
+        RedisModule_ReplicateVerbatim(ctx);
+    }
+    _replicateEffects(&effects, "REDE.MPUSHAT", dehydrator_name);
+    _freeEffects(&effects);
+    _notifyBlockedPolls(ctx, earliest);
+    _notifyDispatcher(ctx, dehydrator, earliest);
+
+    if (has_id)
+    {
+        RedisModule_ReplyWithLongLong(ctx, count);
+    }
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* dehydrator.mpush <dehydrator_name> <timeout> <element> <element_id> [<timeout> <element> <element_id> ...]
+* dehydrate a batch of elements, each for its own timeout
+*/
+int MPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mpush_impl(ctx, argv, argc, MPUSH_IDS);
+}
+
+
+/*
+* dehydrator.gidmpush <dehydrator_name> <timeout> <element> [<timeout> <element> ...]
+* dehydrate a batch of elements, marking each with a generated id
+*/
+int GIDMPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mpush_impl(ctx, argv, argc, MPUSH_GENERATED_IDS);
+}
+
+
+/*
+* dehydrator.mpushat <dehydrator_name> [LEASED] <timeout> <expiration> <element> <element_id> [...]
+* dehydrate a batch of elements until the given (unix time, in milliseconds) expirations.
+* this is what AOF rewrites are made of, so that replaying them keeps the original deadlines.
+*/
+int MPushAtCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mpush_impl(ctx, argv, argc, MPUSH_AT);
+}
+
+
+/*
+* dehydrator.pull <element_id>
+* Pull an element off the bench by id.
+*/
+int PullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
+    if (node != NULL)
+    {
+
+        _unlinkNode(dehydrator, node);
+        _removeNodeFromMapping(dehydrator, node);
+        _replyWithNodeElement(ctx, node);
+        deleteNode(dehydrator, node);
+        _countStat(dehydrator, pulled, 1);
+        RedisModule_ReplicateVerbatim(ctx);
+    }
+    else
+    {
+        // no element with such element_id
+        RedisModule_ReplyWithNull(ctx);
+    }
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.mpull <dehydrator_name> <element_id> [<element_id> ...]
+* Pull several elements off the bench by id.
+*/
+int MPullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    if (_replyToMissingDehydrator(ctx, key, argc - 2)) { return REDISMODULE_OK; }
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL) { return REDISMODULE_ERR; }
+
+    // one reply per id, in the order of the ids
+    RedisModule_ReplyWithArray(ctx, argc - 2);
+    Effects effects;
+    _initEffects(&effects, ctx);
+    int i;
+    for (i = 2; i < argc; ++i)
+    {
+        ElementListNode* node = _getNodeForID(dehydrator, argv[i]);
+        if (node != NULL)
+        {
+            _unlinkNode(dehydrator, node);
+            _removeNodeFromMapping(dehydrator, node);
+            _replyWithNodeElement(ctx, node);
+            deleteNode(dehydrator, node);
+            _countStat(dehydrator, pulled, 1);
+            _addRetainedEffect(&effects, argv[i]);
+        }
+        else
+        {
+            // no element with such element_id
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }
+    // only the ids that were there
+    _replicateEffects(&effects, "REDE.MPULL", argv[1]);
+    _freeEffects(&effects);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.poll <dehydrator_name> [COUNT <count>] [MAXTIME <microseconds>]
+* get all elements which were dried for long enogh, or as many as the limits allow.
+* elements left out are returned by the next poll.
+*/
+int PollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    PollLimits limits;
+    if (_parsePollLimits(ctx, argv, argc, 2, &limits, NULL, NULL) == REDISMODULE_ERR)
+    {
+        return REDISMODULE_ERR;
+    }
+
+    // get key for dehydrator
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    int expired_element_num = 0;
+    time_t now = current_time_ms();
+    _startPollLimits(&limits);
+    // replicas drop the same ids, whatever their own clocks say has expired
+    Effects effects;
+    _initEffects(&effects, ctx);
+    // keep popping the earliest head until it is no longer expired, since the
+    // earliest expiration goes first no TTL queue is starved by the limits
+    ElementListNode* node;
+    while ((!_pollLimitReached(&limits, expired_element_num)) &&
+        ((node = _popExpiredNode(dehydrator, now)) != NULL))
+    {
+        _recordLateness(dehydrator, now - node->expiration);
+        _removeNodeFromMapping(dehydrator, node);
+        _replyWithNodeElement(ctx, node); // append node element to output
+        _addRemovedNode(&effects, node);
+        deleteNode(dehydrator, node);
+        ++expired_element_num;
+    }
+    _countStat(dehydrator, expired, expired_element_num);
+    _replicateEffects(&effects, "REDE.MPULL", argv[1]);
+    _freeEffects(&effects);
+    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.bpoll <dehydrator_name> <timeout>
+* like poll, but if nothing has expired yet, block until something does or until
+* <timeout> milliseconds pass (0 blocks indefinitely)
+*/
+int BPollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    long long timeout;
+    if ((RedisModule_StringToLongLong(argv[2], &timeout) == REDISMODULE_ERR) || (timeout < 0))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Timeout must be a non-negative number of milliseconds.");
+        return REDISMODULE_ERR;
+    }
+
+    // get key for dehydrator
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != DehydratorType)
+    {
+        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    long long now = current_time_ms();
+    long long expiration = LLONG_MAX;
+    if (type != REDISMODULE_KEYTYPE_EMPTY)
+    {
+        Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+        PollResult* result = _pollExpired(ctx, argv[1], dehydrator, now, 0);
+        if (result != NULL)
+        {
+            _replyWithPollResult(ctx, result);
+            _freePollResult(result);
+            RedisModule_CloseKey(key);
+            return REDISMODULE_OK;
+        }
+        _nextExpiration(dehydrator, &expiration);
+    }
+    RedisModule_CloseKey(key);
+
+    // clients can not be blocked inside MULTI or a script, act as if we timed out
+    if ((RedisModule_GetContextFlags != NULL) &&
+        (RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_LUA|REDISMODULE_CTX_FLAGS_MULTI)))
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    _blockPoll(ctx, argv[1], (timeout > 0) ? now + timeout : 0, expiration);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.dispatch <dehydrator_name> CHANNEL|LIST|STREAM <target>
+* dehydrator.dispatch <dehydrator_name> NONE
+* have the server send expired elements to a pubsub channel, a list or a stream
+*/
+int DispatchCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc != 3) && (argc != 4))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    int dispatch = _parseDispatch(argv[2]);
+    if (dispatch == -1)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Unknown dispatch target, expected CHANNEL, LIST, STREAM or NONE.");
+        return REDISMODULE_ERR;
+    }
+    if ((dispatch == DISPATCH_NONE) != (argc == 3))
+    {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, argv[1]);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString* target = NULL;
+    if (dispatch != DISPATCH_NONE)
+    {
+        target = RedisModule_CreateStringFromString(ctx, argv[3]);
+    }
+    // the key may have been renamed or moved since the dehydrator got its name
+    if (RedisModule_StringCompare(dehydrator->name, argv[1]) != 0)
+    {
+        RedisModule_FreeString(NULL, dehydrator->name);
+        dehydrator->name = RedisModule_CreateStringFromString(NULL, argv[1]);
+    }
+    _setDispatch(dehydrator, dispatch, target);
+    dehydrator->dispatch_db = RedisModule_GetSelectedDb(ctx);
+    RedisModule_ReplicateVerbatim(ctx);
+
+    // run now, there may already be expired elements waiting
+    if (dispatch != DISPATCH_NONE)
+    {
+        _scheduleDispatch(ctx, current_time_ms());
+    }
+
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return REDISMODULE_OK;
+}
+
+typedef struct xpoll_reply
+{
+    RedisModuleCtx* ctx;
+    PollLimits* limits;
+    int count;
+} XPollReply;
+
+// reply with the id of an expired node, as long as the limits allow
+static int _replyWithExpiredId(ElementListNode* node, void* data)
+{
+    XPollReply* reply = data;
+    if (_pollLimitReached(reply->limits, reply->count)) { return 0; }
+    RedisModule_ReplyWithStringBuffer(reply->ctx, _nodeId(node), node->id_len); // append node id to output
+    ++reply->count;
+    return 1;
+}
+
+
+/*
+* dehydrator.xpoll <dehydrator_name> [CURSOR <element_id>] [LEASE <milliseconds>] [COUNT <count>] [MAXTIME <microseconds>]
+* get all elements which were dried for long enogh, but dont remove them from the dehydrator.
+* ids are listed queue by queue (ordered by ttl), and the listing can be resumed after the last
+* listed id with CURSOR. a cursor that is no longer in the dehydrator starts over.
+* with LEASE the listed elements are claimed - hidden from other polls until they are acked, or
+* until the lease is over and they are expired again.
+*/
+int XPollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    PollLimits limits;
+    RedisModuleString* cursor;
+    long long lease;
+    if (_parsePollLimits(ctx, argv, argc, 2, &limits, &cursor, &lease) == REDISMODULE_ERR)
+    {
+        return REDISMODULE_ERR;
+    }
+
+    // get key for dehydrator
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    int expired_element_num = 0;
+    time_t now = current_time_ms();
+    _startPollLimits(&limits);
+
+    if (lease > 0)
+    {
+        // claim the expired elements, earliest first. claimed elements are scheduled to
+        // expire again once the lease is over, so they are hidden until then
+        long long lease_end = LLONG_MAX;
+        // replicated as taking the elements out and pushing them back leased, until lease_end
+        Effects taken, leased;
+        _initEffects(&taken, ctx);
+        _initEffects(&leased, ctx);
+        _addEffect(&leased, RedisModule_CreateString(ctx, "LEASED", 6));
+        ElementListNode* node;
+        while ((!_pollLimitReached(&limits, expired_element_num)) &&
+            ((node = _popExpiredNode(dehydrator, now)) != NULL))
+        {
+            RedisModule_ReplyWithStringBuffer(ctx, _nodeId(node), node->id_len); // append node id to output
+            ++expired_element_num;
+            _recordLateness(dehydrator, now - node->expiration);
+            // the ttl is kept, the node only waits for the end of its lease
+            node->expiration = now + lease;
+            node->flags |= NODE_LEASED;
+            _insertNode(dehydrator, node);
+            lease_end = node->expiration;
+            _addRemovedNode(&taken, node);
+            _addStoredNode(&leased, node);
+        }
+        _countStat(dehydrator, leased, expired_element_num);
+        if (expired_element_num > 0)
+        {
+            _replicateEffects(&taken, "REDE.MPULL", argv[1]);
+            _replicateEffects(&leased, "REDE.MPUSHAT", argv[1]);
+        }
+        _freeEffects(&taken);
+        _freeEffects(&leased);
+        if (expired_element_num > 0)
+        {
+            _notifyBlockedPolls(ctx, lease_end);
+            _notifyDispatcher(ctx, dehydrator, lease_end);
+        }
+        RedisModule_ReplySetArrayLength(ctx, expired_element_num);
+        RedisModule_CloseKey(key);
+        return REDISMODULE_OK;
+    }
+
+    // resume right after the cursor, as long as it is still an expired element
+    ElementListNode* resume = _getNodeForID(dehydrator, cursor);
+    if ((resume != NULL) && (resume->expiration > now)) { resume = NULL; }
+
+    XPollReply reply = { ctx, &limits, 0 };
+    _visitExpiredNodes(dehydrator, now, resume, _replyWithExpiredId, &reply);
+    expired_element_num = reply.count;
+    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* dehydrator.xack <element_id> <element_id> <element_id> ...
+* remove element off the bench by ids, but only if they are expired.
+* returns a list of the expired payloads, with Nulls for not-found, or not expired elements
+*/
+int XAckCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return REDISMODULE_OK;
+    }
+
+    time_t now = current_time_ms();
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    int expired_element_num = 0;
+    // whether an element had expired is decided here, replicas drop the acked ids
+    Effects effects;
+    _initEffects(&effects, ctx);
+
+    int i;
+    for (i=2;i<argc;++i)
+    {
+        ++expired_element_num;
+
+        ElementListNode* node = _getNodeForID(dehydrator, argv[i]);
+        // a claimed element whose lease ran out has expired again, like any other
+        int in_lease = (node != NULL) && (node->flags & NODE_LEASED) && (node->expiration > now);
+        if ((node != NULL) && ((node->expiration <= now) || in_lease))
+        {
+            if (!in_lease)
+            {
+                // elements acked during their lease were released when they were claimed
+                _recordLateness(dehydrator, now - node->expiration);
+            }
+            _unlinkNode(dehydrator, node);
+            _removeNodeFromMapping(dehydrator, node);
+            _replyWithNodeElement(ctx, node); // append node element to output
+            deleteNode(dehydrator, node);
+            _countStat(dehydrator, acked, 1);
+            _addRetainedEffect(&effects, argv[i]);
+        }
+        else
+        {
+            // no element with such element_id, or element had not expired yet
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }
+    _replicateEffects(&effects, "REDE.MPULL", argv[1]);
+    _freeEffects(&effects);
+    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+TIMED_COMMAND(PushCommand, STAT_PUSH)
+TIMED_COMMAND(GIDPushCommand, STAT_GIDPUSH)
+TIMED_COMMAND(MPushCommand, STAT_MPUSH)
+TIMED_COMMAND(GIDMPushCommand, STAT_GIDMPUSH)
+TIMED_COMMAND(MPushAtCommand, STAT_MPUSHAT)
+TIMED_COMMAND(PullCommand, STAT_PULL)
+TIMED_COMMAND(MPullCommand, STAT_MPULL)
+TIMED_COMMAND(PollCommand, STAT_POLL)
+TIMED_COMMAND(BPollCommand, STAT_BPOLL)
+TIMED_COMMAND(XPollCommand, STAT_XPOLL)
+TIMED_COMMAND(XAckCommand, STAT_XACK)
+TIMED_COMMAND(LookCommand, STAT_LOOK)
+TIMED_COMMAND(MLookCommand, STAT_MLOOK)
+TIMED_COMMAND(UpdateCommand, STAT_UPDATE)
+TIMED_COMMAND(TimeToNextCommand, STAT_TTN)
+
 
 int TestXPoll(RedisModuleCtx *ctx)
 {
@@ -1151,12 +2727,122 @@ int TestXPoll(RedisModuleCtx *ctx)
     // push element 3b (for 3 seconds)
     // 3b
     RedisModuleCallReply *push_three_b =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xpoll", "3000", "element_3b", "e3b");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xpoll", "3000", "element_3b", "e3b");
+    RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
+
+    // poll (t=1) - we expect only element 1 to be listed as pop out candidate
+    RedisModuleCallReply *xpoll_two_rep =
+      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll");
+    RMUtil_Assert(RedisModule_CallReplyType(xpoll_two_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_two_rep) == 1);
+    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(xpoll_two_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_a, "e1")
+
+    // sleep 2 secs and poll (t=3) - we expect elements 1 and 3a to pop out
+    sleep(2);
+    RedisModuleCallReply *xpoll_three_rep =
+      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll");
+    RMUtil_Assert(RedisModule_CallReplyType(xpoll_three_rep) != REDISMODULE_REPLY_ERROR);
+    // printf("%lu\n", RedisModule_CallReplyLength(poll_three_rep));
+    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_three_rep) == 2);
+    RedisModuleCallReply *subreply_b1 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_b1, "e1");
+    RedisModuleCallReply *subreply_b2 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 1);
+    RMUtil_AssertReplyEquals(subreply_b2, "e3a");
+
+    // clean everything and make sure poll still works as expected
+    RedisModuleCallReply *clean_poll_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
+    RMUtil_Assert(RedisModule_CallReplyType(clean_poll_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(clean_poll_rep) == 2);
+
+    // sleep 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
+    sleep(2);
+    RedisModuleCallReply *poll_four_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
+    RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
+    RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
+    RedisModuleCallReply *subreply_c_second = RedisModule_CallReplyArrayElement(poll_four_rep, 1);
+    RedisModuleString * first_str =  RedisModule_CreateStringFromCallReply(subreply_c_first);
+    RedisModuleString * second_str = RedisModule_CreateStringFromCallReply(subreply_c_second);
+    RedisModuleString * element_3b_str = RedisModule_CreateString(ctx, "element_3b", strlen("element_3b"));
+    RedisModuleString * element_4_str = RedisModule_CreateString(ctx, "element_4", strlen("element_4"));
+    RMUtil_Assert(
+    (
+        RMUtil_StringEquals(first_str, element_3b_str) &&
+        RMUtil_StringEquals(second_str, element_4_str)
+    ) ||
+    (
+        RMUtil_StringEquals(first_str, element_4_str) &&
+        RMUtil_StringEquals(second_str, element_3b_str)
+    )
+    );
+
+    // sleep 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
+    sleep(6);
+    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
+    RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll");
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+int TestXAck(RedisModuleCtx *ctx)
+{
+    printf("Testing XAak - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xack");
+
+    // start test
+    // push elements 1, 4, 7 & 3a (for 1, 4, 7 & 3 seconds)
+    // 1
+    RedisModuleCallReply *push1 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "1000", "element_1", "e1");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    // 4
+    RedisModuleCallReply *push4 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "4000", "element_4", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+
+    // 7
+    RedisModuleCallReply *push7 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "7000", "element_7", "e7");
+    RMUtil_Assert(RedisModule_CallReplyType(push7) != REDISMODULE_REPLY_ERROR);
+
+    // 3a
+    RedisModuleCallReply *push3a =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "3000", "element_3a", "e3a");
+    RMUtil_Assert(RedisModule_CallReplyType(push3a) != REDISMODULE_REPLY_ERROR);
+
+    // pull question 7
+    RedisModuleCallReply *pull_seven_rep =
+      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_xack", "e7");
+    RMUtil_Assert(RedisModule_CallReplyType(pull_seven_rep) != REDISMODULE_REPLY_ERROR);
+
+    // poll - make sure no element pops right out
+    RedisModuleCallReply *xpoll_one_rep =
+      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
+    RMUtil_Assert(RedisModule_CallReplyType(xpoll_one_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_one_rep) == 0);
+
+    // sleep 1 sec
+    sleep(1);
+    // push element 3b (for 3 seconds)
+    // 3b
+    RedisModuleCallReply *push_three_b =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "3000", "element_3b", "e3b");
     RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
 
     // poll (t=1) - we expect only element 1 to be listed as pop out candidate
     RedisModuleCallReply *xpoll_two_rep =
-      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll");
+      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
     RMUtil_Assert(RedisModule_CallReplyType(xpoll_two_rep) != REDISMODULE_REPLY_ERROR);
     RMUtil_Assert(RedisModule_CallReplyLength(xpoll_two_rep) == 1);
     RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(xpoll_two_rep, 0);
@@ -1165,25 +2851,30 @@ int TestXPoll(RedisModuleCtx *ctx)
     // sleep 2 secs and poll (t=3) - we expect elements 1 and 3a to pop out
     sleep(2);
     RedisModuleCallReply *xpoll_three_rep =
-      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll");
+      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
     RMUtil_Assert(RedisModule_CallReplyType(xpoll_three_rep) != REDISMODULE_REPLY_ERROR);
-    // printf("%lu\n", RedisModule_CallReplyLength(poll_three_rep));
     RMUtil_Assert(RedisModule_CallReplyLength(xpoll_three_rep) == 2);
     RedisModuleCallReply *subreply_b1 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 0);
     RMUtil_AssertReplyEquals(subreply_b1, "e1");
     RedisModuleCallReply *subreply_b2 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 1);
     RMUtil_AssertReplyEquals(subreply_b2, "e3a");
 
-    // clean everything and make sure poll still works as expected
-    RedisModuleCallReply *clean_poll_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
-    RMUtil_Assert(RedisModule_CallReplyType(clean_poll_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(clean_poll_rep) == 2);
+    // xack everything and make sure poll still works as expected
+    RedisModuleCallReply *xack_rep =
+      RedisModule_Call(ctx, "REDE.xack", "cccc", "TEST_DEHYDRATOR_xack", "e1", "non-existing-element", "e3a");
+    RMUtil_Assert(RedisModule_CallReplyType(xack_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(xack_rep) == 3);
+    RedisModuleCallReply *xack_subreply_1 = RedisModule_CallReplyArrayElement(xack_rep, 0);
+    RMUtil_AssertReplyEquals(xack_subreply_1, "element_1");
+    RedisModuleCallReply *xack_subreply_2 = RedisModule_CallReplyArrayElement(xack_rep, 1);
+    RMUtil_AssertNullReply(xack_subreply_2);
+    RedisModuleCallReply *xack_subreply_3 = RedisModule_CallReplyArrayElement(xack_rep, 2);
+    RMUtil_AssertReplyEquals(xack_subreply_3, "element_3a");
 
     // sleep 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
     sleep(2);
     RedisModuleCallReply *poll_four_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xack");
     RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
     RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
     RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
@@ -1205,100 +2896,341 @@ int TestXPoll(RedisModuleCtx *ctx)
 
     // sleep 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
     sleep(6);
-    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll");
+    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xack");
     RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
     RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
 
     // clear dehydrator
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xack");
 
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
-int TestXAck(RedisModuleCtx *ctx)
+int TestLook(RedisModuleCtx *ctx)
 {
-    printf("Testing XAak - ");
+    RedisModule_AutoMemory(ctx);
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
+    printf("Testing Look - ");
+
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    // check if X is dehydtaring (should be false)
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
+
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_look", "100000", "payload", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2), "payload"));
+
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check3));
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestUpdate(RedisModuleCtx *ctx)
+{
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
+    printf("Testing Update - ");
+
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
+    RMUtil_Assert(RedisModule_CallReplyType(check1) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_update", "100000", "some payload", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "some OTHER payload");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2),"some payload"));
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_update", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check3), "some OTHER payload"));
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_update", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check4 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
+    RMUtil_Assert(RedisModule_CallReplyType(check4) == REDISMODULE_REPLY_ERROR);
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestPollLimits(RedisModuleCtx *ctx)
+{
+    printf("Testing Poll Limits - ");
 
     // clear dehydrator
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xack");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll_limits");
+
+    // start test
+    // push 5 elements that expire right away, over two TTLs
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll_limits", "0", "element_1", "e1");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll_limits", "1", "element_2", "e2");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll_limits", "0", "element_3", "e3");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll_limits", "1", "element_4", "e4");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll_limits", "0", "element_5", "e5");
+    usleep(5000);
+
+    // bad limits are refused
+    RedisModuleCallReply *bad_option_rep =
+      RedisModule_Call(ctx, "REDE.poll", "ccc", "TEST_DEHYDRATOR_poll_limits", "LIMIT", "2");
+    RMUtil_Assert(RedisModule_CallReplyType(bad_option_rep) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *bad_count_rep =
+      RedisModule_Call(ctx, "REDE.poll", "ccc", "TEST_DEHYDRATOR_poll_limits", "COUNT", "0");
+    RMUtil_Assert(RedisModule_CallReplyType(bad_count_rep) == REDISMODULE_REPLY_ERROR);
+
+    // an option given last without its value is named in the error
+    const char* missing_options[] = { "COUNT", "MAXTIME", "CURSOR", "LEASE" };
+    int m;
+    for (m = 0; m < 4; ++m)
+    {
+        RedisModuleCallReply *missing_rep =
+          RedisModule_Call(ctx, "REDE.xpoll", "cccc", "TEST_DEHYDRATOR_poll_limits", "COUNT", "1", missing_options[m]);
+        RMUtil_Assert(RedisModule_CallReplyType(missing_rep) == REDISMODULE_REPLY_ERROR);
+        char expected[64];
+        size_t len;
+        const char* error = RedisModule_CallReplyStringPtr(missing_rep, &len);
+        snprintf(expected, sizeof(expected), "ERROR: Missing value for %s.", missing_options[m]);
+        RMUtil_Assert((len == strlen(expected)) && (memcmp(error, expected, len) == 0));
+    }
+
+    // xpoll only lists as many ids as asked for
+    RedisModuleCallReply *xpoll_rep =
+      RedisModule_Call(ctx, "REDE.xpoll", "ccc", "TEST_DEHYDRATOR_poll_limits", "COUNT", "3");
+    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_rep) == 3);
+
+    // poll in chunks of 2, elements come out by expiration whatever their TTL is
+    RedisModuleCallReply *poll1_rep =
+      RedisModule_Call(ctx, "REDE.poll", "ccc", "TEST_DEHYDRATOR_poll_limits", "COUNT", "2");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 2);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll1_rep, 0), "element_1");
+
+    RedisModuleCallReply *poll2_rep =
+      RedisModule_Call(ctx, "REDE.poll", "ccccc", "TEST_DEHYDRATOR_poll_limits", "MAXTIME", "1000000", "COUNT", "2");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll2_rep) == 2);
+
+    // the rest is picked up by the next poll
+    RedisModuleCallReply *poll3_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll_limits");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll3_rep) == 1);
+
+    RedisModuleCallReply *poll4_rep =
+      RedisModule_Call(ctx, "REDE.poll", "ccc", "TEST_DEHYDRATOR_poll_limits", "COUNT", "2");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll4_rep) == 0);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll_limits");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestTimeToNext(RedisModuleCtx *ctx)
+{
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
+    printf("Testing TTN - ");
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_ttn", "3000", "payload", "ttn_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check1) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check1) <= 3000);
+
+    sleep(2);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check2) <= 1000);
+
+    sleep(2);
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check3) == 0);
+
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestPush(RedisModuleCtx *ctx)
+{
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+    printf("Testing Push - ");
+    // char * element_id = "push_test_element";
+    // size_t len
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
+    // check if X is dehydtaring (should be false)
+    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_push", "1000", "payload", "push_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2), "payload"));
+
+    // TODO: test pushing more then one element
+    // TODO: add fail-case tests
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestPull(RedisModuleCtx *ctx)
+{
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
+    printf("Testing Pull - ");
+
+    char * store_key = "pull_test_element";
+    char * bad_store_key = "pull_test_bad_element";
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_pull", "100000", "payload", store_key);
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", store_key);
+    // RMUTIL_ASSERT_NOERROR(look1);
+    RMUtil_Assert(RedisModule_CallReplyType(look1) != REDISMODULE_REPLY_ERROR);
+    // RMUtil_Assert(RedisModule_CallReplyInteger(rep1) == 1);
+
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(pull1));
+
+
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look2));
+    // RMUtil_Assert(RedisModule_CallReplyInteger(rep2) == 0);
+
+
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", store_key);
+    RMUtil_Assert(RedisModule_CallReplyType(pull2) != REDISMODULE_REPLY_ERROR);
+
+
+    RedisModuleCallReply *look3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look3));
+
+    printf("Passed.\n");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
+    return REDISMODULE_OK;
+}
+
+
+int TestPoll(RedisModuleCtx *ctx)
+{
+    printf("Testing Poll - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
 
     // start test
     // push elements 1, 4, 7 & 3a (for 1, 4, 7 & 3 seconds)
     // 1
     RedisModuleCallReply *push1 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "1000", "element_1", "e1");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "1000", "element_1", "e1");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
 
     // 4
     RedisModuleCallReply *push4 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "4000", "element_4", "e4");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "4000", "element_4", "e4");
     RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
 
     // 7
     RedisModuleCallReply *push7 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "7000", "element_7", "e7");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "7000", "element_7", "e7");
     RMUtil_Assert(RedisModule_CallReplyType(push7) != REDISMODULE_REPLY_ERROR);
 
     // 3a
     RedisModuleCallReply *push3a =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "3000", "element_3a", "e3a");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3a", "e3a");
     RMUtil_Assert(RedisModule_CallReplyType(push3a) != REDISMODULE_REPLY_ERROR);
 
     // pull question 7
     RedisModuleCallReply *pull_seven_rep =
-      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_xack", "e7");
+      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_poll", "e7");
     RMUtil_Assert(RedisModule_CallReplyType(pull_seven_rep) != REDISMODULE_REPLY_ERROR);
 
     // poll - make sure no element pops right out
-    RedisModuleCallReply *xpoll_one_rep =
-      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
-    RMUtil_Assert(RedisModule_CallReplyType(xpoll_one_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_one_rep) == 0);
+    RedisModuleCallReply *poll1_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+    RMUtil_Assert(RedisModule_CallReplyType(poll1_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 0);
 
     // sleep 1 sec
     sleep(1);
     // push element 3b (for 3 seconds)
     // 3b
     RedisModuleCallReply *push_three_b =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xack", "3000", "element_3b", "e3b");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3b", "e3b");
     RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
 
-    // poll (t=1) - we expect only element 1 to be listed as pop out candidate
-    RedisModuleCallReply *xpoll_two_rep =
-      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
-    RMUtil_Assert(RedisModule_CallReplyType(xpoll_two_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_two_rep) == 1);
-    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(xpoll_two_rep, 0);
-    RMUtil_AssertReplyEquals(subreply_a, "e1")
+    // poll (t=1) - we expect only element 1 to pop out
+    RedisModuleCallReply *poll_two_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+    RMUtil_Assert(RedisModule_CallReplyType(poll_two_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_two_rep) == 1);
+    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(poll_two_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_a, "element_1")
 
-    // sleep 2 secs and poll (t=3) - we expect elements 1 and 3a to pop out
+    // sleep 2 secs and poll (t=3) - we expect only element 3a to pop out
     sleep(2);
-    RedisModuleCallReply *xpoll_three_rep =
-      RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xack");
-    RMUtil_Assert(RedisModule_CallReplyType(xpoll_three_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(xpoll_three_rep) == 2);
-    RedisModuleCallReply *subreply_b1 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 0);
-    RMUtil_AssertReplyEquals(subreply_b1, "e1");
-    RedisModuleCallReply *subreply_b2 = RedisModule_CallReplyArrayElement(xpoll_three_rep, 1);
-    RMUtil_AssertReplyEquals(subreply_b2, "e3a");
+    RedisModuleCallReply *poll_three_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+    RMUtil_Assert(RedisModule_CallReplyType(poll_three_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_three_rep) == 1);
+    RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(poll_three_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_b, "element_3a");
 
-    // xack everything and make sure poll still works as expected
-    RedisModuleCallReply *xack_rep =
-      RedisModule_Call(ctx, "REDE.xack", "cccc", "TEST_DEHYDRATOR_xack", "e1", "non-existing-element", "e3a");
-    RMUtil_Assert(RedisModule_CallReplyType(xack_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(xack_rep) == 3);
-    RedisModuleCallReply *xack_subreply_1 = RedisModule_CallReplyArrayElement(xack_rep, 0);
-    RMUtil_AssertReplyEquals(xack_subreply_1, "element_1");
-    RedisModuleCallReply *xack_subreply_2 = RedisModule_CallReplyArrayElement(xack_rep, 1);
-    RMUtil_AssertNullReply(xack_subreply_2);
-    RedisModuleCallReply *xack_subreply_3 = RedisModule_CallReplyArrayElement(xack_rep, 2);
-    RMUtil_AssertReplyEquals(xack_subreply_3, "element_3a");
 
     // sleep 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
     sleep(2);
     RedisModuleCallReply *poll_four_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xack");
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
     RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
     RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
     RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
@@ -1320,298 +3252,1092 @@ int TestXAck(RedisModuleCtx *ctx)
 
     // sleep 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
     sleep(6);
-    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xack");
+    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
     RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
     RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
 
     // clear dehydrator
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xack");
-
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
-int TestLook(RedisModuleCtx *ctx)
+
+int TestWheel(RedisModuleCtx *ctx)
 {
-    RedisModule_AutoMemory(ctx);
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
-    printf("Testing Look - ");
+    printf("Testing Wheel - ");
 
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    // check if X is dehydtaring (should be false)
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_wheel");
+
+    // start test
+    RedisModuleCallReply *create_rep =
+      RedisModule_Call(ctx, "REDE.create", "cc", "TEST_DEHYDRATOR_wheel", "WHEEL");
+    RMUtil_Assert(RedisModule_CallReplyType(create_rep) != REDISMODULE_REPLY_ERROR);
 
+    // the key exists now, so it can not be created again
+    RedisModuleCallReply *recreate_rep =
+      RedisModule_Call(ctx, "REDE.create", "cc", "TEST_DEHYDRATOR_wheel", "QUEUEMAP");
+    RMUtil_Assert(RedisModule_CallReplyType(recreate_rep) == REDISMODULE_REPLY_ERROR);
 
+    // push elements 1, 2, 3 & 90 (for 1, 2, 3 & 90 seconds) - 90 lands on a higher wheel level
     RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_look", "100000", "payload", "test_element");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "1000", "element_1", "e1");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2), "payload"));
+    RedisModuleCallReply *push2 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "2000", "element_2", "e2");
+    RMUtil_Assert(RedisModule_CallReplyType(push2) != REDISMODULE_REPLY_ERROR);
 
+    RedisModuleCallReply *push3 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "3000", "element_3", "e3");
+    RMUtil_Assert(RedisModule_CallReplyType(push3) != REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push90 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "90000", "element_90", "e90");
+    RMUtil_Assert(RedisModule_CallReplyType(push90) != REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check3));
+    // pull element 2
+    RedisModuleCallReply *pull_two_rep =
+      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_wheel", "e2");
+    RMUtil_AssertReplyEquals(pull_two_rep, "element_2");
 
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
+    // time to next is bounded by element 1
+    RedisModuleCallReply *ttn_rep =
+      RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn_rep) <= 1000);
+
+    // poll - make sure no element pops right out
+    RedisModuleCallReply *poll1_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyType(poll1_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 0);
+
+    // sleep 3 secs and poll (t=3) - we expect elements 1 and 3, in order of expiration
+    sleep(3);
+    RedisModuleCallReply *poll_two_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyType(poll_two_rep) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_two_rep) == 2);
+    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(poll_two_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_a, "element_1");
+    RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(poll_two_rep, 1);
+    RMUtil_AssertReplyEquals(subreply_b, "element_3");
+
+    // element 90 is still waiting, and can be looked up
+    RedisModuleCallReply *look_rep =
+      RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_wheel", "e90");
+    RMUtil_AssertReplyEquals(look_rep, "element_90");
+
+    // its slot spans seconds, yet time to next is its own expiration, not the slot's start
+    RedisModuleCallReply *ttn90_rep =
+      RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn90_rep) <= 87000);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn90_rep) > 86000);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_wheel");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestUpdate(RedisModuleCtx *ctx)
+int TestBPoll(RedisModuleCtx *ctx)
 {
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
-    printf("Testing Update - ");
+    printf("Testing BPoll - ");
 
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
-    RMUtil_Assert(RedisModule_CallReplyType(check1) == REDISMODULE_REPLY_ERROR);
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_bpoll");
+
+    // start test
+    // a bad timeout is refused
+    RedisModuleCallReply *bad_rep =
+      RedisModule_Call(ctx, "REDE.bpoll", "cc", "TEST_DEHYDRATOR_bpoll", "-1");
+    RMUtil_Assert(RedisModule_CallReplyType(bad_rep) == REDISMODULE_REPLY_ERROR);
+
+    // push elements 0a, 0b & 1 (for 0, 0 & 1 seconds)
+    RedisModuleCallReply *push0a =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll", "0", "element_0a", "e0a");
+    RMUtil_Assert(RedisModule_CallReplyType(push0a) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *push0b =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll", "0", "element_0b", "e0b");
+    RMUtil_Assert(RedisModule_CallReplyType(push0b) != REDISMODULE_REPLY_ERROR);
 
     RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_update", "100000", "some payload", "test_element");
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll", "1000", "element_1", "e1");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "some OTHER payload");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2),"some payload"));
+    // bpoll - expired elements are returned right away, without blocking
+    RedisModuleCallReply *bpoll_rep =
+      RedisModule_Call(ctx, "REDE.bpoll", "cc", "TEST_DEHYDRATOR_bpoll", "0");
+    RMUtil_Assert(RedisModule_CallReplyType(bpoll_rep) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(bpoll_rep) == 2);
+    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(bpoll_rep, 0);
+    RMUtil_AssertReplyEquals(subreply_a, "element_0a");
+    RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(bpoll_rep, 1);
+    RMUtil_AssertReplyEquals(subreply_b, "element_0b");
+
+    // element 1 was not polled
+    RedisModuleCallReply *look_rep =
+      RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_bpoll", "e1");
+    RMUtil_AssertReplyEquals(look_rep, "element_1");
+
+    // a client that disconnects while blocked is forgotten, and nothing is polled for it.
+    // the test client can not block, so waiters are linked by hand with stand-in clients
+    RedisModuleString* name = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_bpoll", 21);
+    BlockedPoll* waiters[2];
+    int i;
+    for (i = 0; i < 2; ++i)
+    {
+        waiters[i] = RedisModule_Alloc(sizeof(BlockedPoll));
+        waiters[i]->bc = (RedisModuleBlockedClient*)&waiters[i];
+        waiters[i]->dehydrator_name = RedisModule_CreateStringFromString(ctx, name);
+        waiters[i]->db = RedisModule_GetSelectedDb(ctx);
+        waiters[i]->deadline = 0;
+        _linkBlockedPoll(waiters[i]);
+    }
+    RMUtil_Assert(_takeBlockedPoll(waiters[0]->bc) == waiters[0]);
+    RMUtil_Assert((blocked_polls_head == waiters[1]) && (blocked_polls_tail == waiters[1]));
+    RMUtil_Assert(waiters[1]->prev == NULL);
+    RMUtil_Assert(_takeBlockedPoll(waiters[0]->bc) == NULL);
+    RMUtil_Assert(_takeBlockedPoll(waiters[1]->bc) == waiters[1]);
+    RMUtil_Assert((blocked_polls_head == NULL) && (blocked_polls_tail == NULL));
+    _freeBlockedPoll(waiters[0]);
+    _freeBlockedPoll(waiters[1]);
+
+    // what expires afterwards stays in the dehydrator for the next client
+    RedisModuleCallReply *push0c =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll", "0", "element_0c", "e0c");
+    RMUtil_Assert(RedisModule_CallReplyType(push0c) != REDISMODULE_REPLY_ERROR);
+    _serveBlockedPolls(ctx, NULL);
+    RedisModuleCallReply *look0c_rep =
+      RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_bpoll", "e0c");
+    RMUtil_AssertReplyEquals(look0c_rep, "element_0c");
+    RedisModule_FreeString(ctx, name);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_bpoll");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestDispatch(RedisModuleCtx *ctx)
+{
+    printf("Testing Dispatch - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_dispatch");
+
+    // start test
+    // unknown target types are refused
+    RedisModuleCallReply *bad_rep =
+      RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_dispatch", "SOCKET", "somewhere");
+    RMUtil_Assert(RedisModule_CallReplyType(bad_rep) == REDISMODULE_REPLY_ERROR);
+
+    // a target type needs a target
+    RedisModuleCallReply *no_target_rep =
+      RedisModule_Call(ctx, "REDE.dispatch", "cc", "TEST_DEHYDRATOR_dispatch", "LIST");
+    RMUtil_Assert(RedisModule_CallReplyType(no_target_rep) == REDISMODULE_REPLY_ERROR);
+
+    // dispatch to a list, creating the dehydrator
+    RedisModuleCallReply *list_rep =
+      RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_dispatch", "LIST", "TEST_DEHYDRATOR_dispatch_list");
+    RMUtil_AssertReplyEquals(list_rep, "OK");
+
+    // the dehydrator works as usual
+    RedisModuleCallReply *push1 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_dispatch", "1000", "element_1", "e1");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *look_rep =
+      RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_dispatch", "e1");
+    RMUtil_AssertReplyEquals(look_rep, "element_1");
+
+    // a renamed dispatcher is dropped on the next run, and dispatching is set up again
+    // under the new name
+    RedisModule_Call(ctx, "RENAME", "cc", "TEST_DEHYDRATOR_dispatch", "TEST_DEHYDRATOR_dispatch_renamed");
+    RedisModuleString* renamed = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_dispatch_renamed", 32);
+    RedisModuleKey* key = RedisModule_OpenKey(ctx, renamed, REDISMODULE_READ);
+    Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+    RedisModule_CloseKey(key);
+    RMUtil_Assert(dehydrator->dispatch == DISPATCH_LIST);
+    _runDispatchers(ctx, NULL);
+    RMUtil_Assert(dehydrator->dispatch == DISPATCH_NONE);
+    list_rep = RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_dispatch_renamed", "LIST", "TEST_DEHYDRATOR_dispatch_list");
+    RMUtil_AssertReplyEquals(list_rep, "OK");
+    RMUtil_Assert(RedisModule_StringCompare(dehydrator->name, renamed) == 0);
+    _runDispatchers(ctx, NULL);
+    RMUtil_Assert(dehydrator->dispatch == DISPATCH_LIST);
+    RedisModule_Call(ctx, "RENAME", "cc", "TEST_DEHYDRATOR_dispatch_renamed", "TEST_DEHYDRATOR_dispatch");
+    RedisModule_FreeString(ctx, renamed);
+
+    // switch to a channel, and stop dispatching
+    RedisModuleCallReply *channel_rep =
+      RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_dispatch", "channel", "TEST_DEHYDRATOR_dispatch_channel");
+    RMUtil_AssertReplyEquals(channel_rep, "OK");
+    RMUtil_Assert(dispatch_wakeup != 0);
+    RedisModuleCallReply *none_rep =
+      RedisModule_Call(ctx, "REDE.dispatch", "cc", "TEST_DEHYDRATOR_dispatch", "NONE");
+    RMUtil_AssertReplyEquals(none_rep, "OK");
+
+    // with no dispatchers left the heartbeat is not re-armed
+    if (dispatchers == NULL)
+    {
+        RedisModule_StopTimer(ctx, dispatch_timer, NULL);
+        _runDispatchers(ctx, NULL);
+        RMUtil_Assert(dispatch_wakeup == 0);
+    }
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_dispatch");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_dispatch_list");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestSlabs(RedisModuleCtx *ctx)
+{
+    printf("Testing Slabs - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_slabs");
+
+    // start test
+    // push 300 elements over 3 TTLs, more than fit in a single slab
+    int i;
+    char id[16];
+    for (i = 0; i < 300; ++i)
+    {
+        sprintf(id, "%d", i);
+        RedisModuleCallReply *push_rep =
+          RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_slabs", (i % 3 == 0) ? "1000" : ((i % 3 == 1) ? "2000" : "3000"), "element", id);
+        RMUtil_Assert(RedisModule_CallReplyType(push_rep) != REDISMODULE_REPLY_ERROR);
+    }
+
+    // 300 nodes and 3 lists are in use
+    RedisModuleCallReply *slabs_rep =
+      RedisModule_Call(ctx, "REDE.slabs", "c", "TEST_DEHYDRATOR_slabs");
+    RMUtil_Assert(RedisModule_CallReplyType(slabs_rep) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(slabs_rep) == 6);
+    RedisModuleCallReply *classes_rep = RedisModule_CallReplyArrayElement(slabs_rep, 5);
+    long long used = 0;
+    for (i = 0; i < RedisModule_CallReplyLength(classes_rep); ++i)
+    {
+        RedisModuleCallReply *class_rep = RedisModule_CallReplyArrayElement(classes_rep, i);
+        used += RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(class_rep, 7));
+    }
+    RMUtil_Assert(used == 303);
+
+    // pull them all, nothing is left in use
+    for (i = 0; i < 300; ++i)
+    {
+        sprintf(id, "%d", i);
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_slabs", id);
+    }
+    slabs_rep = RedisModule_Call(ctx, "REDE.slabs", "c", "TEST_DEHYDRATOR_slabs");
+    classes_rep = RedisModule_CallReplyArrayElement(slabs_rep, 5);
+    for (i = 0; i < RedisModule_CallReplyLength(classes_rep); ++i)
+    {
+        RedisModuleCallReply *class_rep = RedisModule_CallReplyArrayElement(classes_rep, i);
+        RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(class_rep, 7)) == 0);
+        // drained classes keep a single slab
+        RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(class_rep, 3)) == 1);
+    }
+
+    // push 2000 more and pull the first 1800, their slabs empty out while the class is
+    // still in use, and are given back rather than kept for the 200 that are left
+    for (i = 0; i < 2000; ++i)
+    {
+        sprintf(id, "%05d", i);
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_slabs", "1000", "element", id);
+    }
+    for (i = 0; i < 1800; ++i)
+    {
+        sprintf(id, "%05d", i);
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_slabs", id);
+    }
+    slabs_rep = RedisModule_Call(ctx, "REDE.slabs", "c", "TEST_DEHYDRATOR_slabs");
+    classes_rep = RedisModule_CallReplyArrayElement(slabs_rep, 5);
+    used = 0;
+    for (i = 0; i < RedisModule_CallReplyLength(classes_rep); ++i)
+    {
+        RedisModuleCallReply *class_rep = RedisModule_CallReplyArrayElement(classes_rep, i);
+        long long objects = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(class_rep, 5));
+        long long class_used = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(class_rep, 7));
+        RMUtil_Assert(objects - class_used <= 2 * SLAB_MAX_OBJECTS);
+        used += class_used;
+    }
+    RMUtil_Assert(used == 201);
+
+    // nil without a dehydrator, just the type error on a key of another type
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_slabs");
+    slabs_rep = RedisModule_Call(ctx, "REDE.slabs", "c", "TEST_DEHYDRATOR_slabs");
+    RMUtil_Assert(RedisModule_CallReplyType(slabs_rep) == REDISMODULE_REPLY_NULL);
+    RedisModule_Call(ctx, "SET", "cc", "TEST_DEHYDRATOR_slabs", "string");
+    slabs_rep = RedisModule_Call(ctx, "REDE.slabs", "c", "TEST_DEHYDRATOR_slabs");
+    RMUtil_Assert(RedisModule_CallReplyType(slabs_rep) == REDISMODULE_REPLY_ERROR);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_slabs");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestLargeElement(RedisModuleCtx *ctx)
+{
+    printf("Testing Large Element - ");
+
+    // an element too large to be stored inside its node
+    char large[1024];
+    memset(large, 'x', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\0';
+
+    int engine;
+    for (engine = 0; engine < 2; ++engine)
+    {
+        // clear dehydrator
+        RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_large");
+        RedisModule_Call(ctx, "REDE.create", "cc", "TEST_DEHYDRATOR_large", (engine == 0) ? "QUEUEMAP" : "WHEEL");
+
+        // start test
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_large", "0", "small", "a");
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_large", "0", large, "b");
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_large", "0", "small", "c");
+
+        RedisModuleCallReply *look_rep =
+          RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_large", "b");
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(look_rep), large));
+
+        // swap the element sizes of the first two, the order is kept
+        RedisModuleCallReply *update_rep =
+          RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_large", "a", large);
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(update_rep), "small"));
+        update_rep = RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_large", "b", "small");
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(update_rep), large));
+        usleep(5000);
+
+        RedisModuleCallReply *poll_rep =
+          RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_large");
+        RMUtil_Assert(RedisModule_CallReplyLength(poll_rep) == 3);
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(poll_rep, 0)), large));
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(poll_rep, 1)), "small"));
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(poll_rep, 2)), "small"));
+    }
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_large");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestIntegerIds(RedisModuleCtx *ctx)
+{
+    printf("Testing Integer Ids - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_integer_ids");
+
+    // start test
+    // integer ids, and ids that only look like integers, are all distinct
+    const char* ids[] = {"7", "007", "-3", "-0", "+7", "9223372036854775807", "9223372036854775808", "-9223372036854775808"};
+    int id_count = sizeof(ids) / sizeof(ids[0]);
+    char element[32];
+    int i;
+    for (i = 0; i < id_count; ++i)
+    {
+        sprintf(element, "element_%d", i);
+        RedisModuleCallReply *push_rep =
+          RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_integer_ids", "100000", element, ids[i]);
+        RMUtil_Assert(RedisModule_CallReplyType(push_rep) != REDISMODULE_REPLY_ERROR);
+    }
+    RedisModuleCallReply *push_rep =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_integer_ids", "100000", "element", "7");
+    RMUtil_Assert(RedisModule_CallReplyType(push_rep) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *update_rep =
+      RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_integer_ids", "-3", "updated");
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(update_rep), "element_2"));
+
+    for (i = 0; i < id_count; ++i)
+    {
+        sprintf(element, "element_%d", i);
+        RedisModuleCallReply *pull_rep =
+          RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_integer_ids", ids[i]);
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(pull_rep), (i == 2) ? "updated" : element));
+        RedisModuleCallReply *look_rep =
+          RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_integer_ids", ids[i]);
+        RMUtil_Assert(RedisModule_CallReplyType(look_rep) == REDISMODULE_REPLY_NULL);
+    }
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_integer_ids");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestGIDPush(RedisModuleCtx *ctx)
+{
+    printf("Testing GIDPush - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_gidpush");
+
+    // start test
+    // generated ids are unique and sorted by creation, even within a millisecond
+    RedisModuleString* last_id = NULL;
+    int i;
+    for (i = 0; i < 1000; ++i)
+    {
+        RedisModuleCallReply *push_rep =
+          RedisModule_Call(ctx, "REDE.gidpush", "ccc", "TEST_DEHYDRATOR_gidpush", "100000", "element");
+        RMUtil_Assert(RedisModule_CallReplyType(push_rep) == REDISMODULE_REPLY_STRING);
+        RedisModuleString* id = RedisModule_CreateStringFromCallReply(push_rep);
+        size_t id_len;
+        RedisModule_StringPtrLen(id, &id_len);
+        RMUtil_Assert(id_len == ID_LENGTH);
+        if (last_id != NULL)
+        {
+            RMUtil_Assert(RedisModule_StringCompare(last_id, id) < 0);
+        }
+        last_id = id;
+
+        RedisModuleCallReply *look_rep =
+          RedisModule_Call(ctx, "REDE.look", "cs", "TEST_DEHYDRATOR_gidpush", id);
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(look_rep), "element"));
+    }
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_gidpush");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestMPush(RedisModuleCtx *ctx)
+{
+    printf("Testing MPush - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpush");
+
+    // start test
+    RedisModuleCallReply *mpush_rep =
+      RedisModule_Call(ctx, "REDE.mpush", "cccccccccc", "TEST_DEHYDRATOR_mpush",
+        "0", "element_1", "e1", "100000", "element_2", "e2", "0", "element_3", "e3");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush_rep) == REDISMODULE_REPLY_INTEGER);
+    RMUtil_Assert(RedisModule_CallReplyInteger(mpush_rep) == 3);
+
+    // a taken id fails the whole batch
+    mpush_rep = RedisModule_Call(ctx, "REDE.mpush", "ccccccc", "TEST_DEHYDRATOR_mpush",
+        "0", "element_4", "e4", "0", "element_5", "e2");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush_rep) == REDISMODULE_REPLY_ERROR);
+    mpush_rep = RedisModule_Call(ctx, "REDE.mpush", "ccccccc", "TEST_DEHYDRATOR_mpush",
+        "0", "element_4", "e4", "0", "element_5", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush_rep) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *look_rep =
+      RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_mpush", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(look_rep) == REDISMODULE_REPLY_NULL);
+    mpush_rep = RedisModule_Call(ctx, "REDE.mpush", "cccc", "TEST_DEHYDRATOR_mpush", "0", "element_4", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush_rep) == REDISMODULE_REPLY_INTEGER);
+
+    RedisModuleCallReply *gid_rep =
+      RedisModule_Call(ctx, "REDE.gidmpush", "ccccc", "TEST_DEHYDRATOR_mpush", "0", "element_5", "100000", "element_6");
+    RMUtil_Assert(RedisModule_CallReplyType(gid_rep) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(gid_rep) == 2);
+    look_rep = RedisModule_Call(ctx, "REDE.look", "cs", "TEST_DEHYDRATOR_mpush",
+        RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(gid_rep, 1)));
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(look_rep), "element_6"));
+    usleep(5000);
+
+    RedisModuleCallReply *poll_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_mpush");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_rep) == 4);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(poll_rep, 0)), "element_1"));
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(poll_rep, 1)), "element_3"));
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpush");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestMPullMLook(RedisModuleCtx *ctx)
+{
+    printf("Testing MPull & MLook - ");
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpull");
+
+    // start test
+    RedisModule_Call(ctx, "REDE.mpush", "cccccccccc", "TEST_DEHYDRATOR_mpull",
+        "100000", "element_1", "e1", "100000", "element_2", "e2", "0", "element_3", "e3");
+
+    // replies are aligned to the ids, missing ones are nil
+    RedisModuleCallReply *mlook_rep =
+      RedisModule_Call(ctx, "REDE.mlook", "cccc", "TEST_DEHYDRATOR_mpull", "e3", "nope", "e1");
+    RMUtil_Assert(RedisModule_CallReplyLength(mlook_rep) == 3);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(mlook_rep, 0)), "element_3"));
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mlook_rep, 1)) == REDISMODULE_REPLY_NULL);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(mlook_rep, 2)), "element_1"));
+
+    RedisModuleCallReply *mpull_rep =
+      RedisModule_Call(ctx, "REDE.mpull", "cccc", "TEST_DEHYDRATOR_mpull", "e1", "e3", "e1");
+    RMUtil_Assert(RedisModule_CallReplyLength(mpull_rep) == 3);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(mpull_rep, 0)), "element_1"));
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(mpull_rep, 1)), "element_3"));
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mpull_rep, 2)) == REDISMODULE_REPLY_NULL);
+
+    // only e2 is left
+    mlook_rep = RedisModule_Call(ctx, "REDE.mlook", "ccc", "TEST_DEHYDRATOR_mpull", "e1", "e2");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mlook_rep, 0)) == REDISMODULE_REPLY_NULL);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(mlook_rep, 1)), "element_2"));
+    usleep(5000);
+    RedisModuleCallReply *poll_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_mpull");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_rep) == 0);
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpull");
+    mlook_rep = RedisModule_Call(ctx, "REDE.mlook", "ccc", "TEST_DEHYDRATOR_mpull", "e1", "e2");
+    RMUtil_Assert(RedisModule_CallReplyLength(mlook_rep) == 2);
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestXPollCursor(RedisModuleCtx *ctx)
+{
+    printf("Testing XPoll Cursor - ");
+
+    int engine;
+    for (engine = 0; engine < 2; ++engine)
+    {
+        // clear dehydrator
+        RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll_cursor");
+        RedisModule_Call(ctx, "REDE.create", "cc", "TEST_DEHYDRATOR_xpoll_cursor", (engine == 0) ? "QUEUEMAP" : "WHEEL");
+
+        // start test
+        // 100 expired elements over 3 TTLs, and one that is not expired
+        int i;
+        char id[16];
+        for (i = 0; i < 100; ++i)
+        {
+            sprintf(id, "%d", i);
+            RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xpoll_cursor", (i % 3 == 0) ? "0" : ((i % 3 == 1) ? "1" : "2"), "element", id);
+        }
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_xpoll_cursor", "100000", "element", "late");
+        usleep(5000);
+
+        // page through with a cursor, every expired id is listed exactly once
+        int seen[100] = {0};
+        int listed = 0;
+        RedisModuleString* cursor = RedisModule_CreateString(ctx, "none", 4);
+        while (1)
+        {
+            RedisModuleCallReply *xpoll_rep =
+              RedisModule_Call(ctx, "REDE.xpoll", "ccscc", "TEST_DEHYDRATOR_xpoll_cursor", "CURSOR", cursor, "COUNT", "7");
+            RMUtil_Assert(RedisModule_CallReplyType(xpoll_rep) == REDISMODULE_REPLY_ARRAY);
+            size_t len = RedisModule_CallReplyLength(xpoll_rep);
+            RMUtil_Assert(len <= 7);
+            for (i = 0; i < len; ++i)
+            {
+                cursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(xpoll_rep, i));
+                long long index;
+                RMUtil_Assert(RedisModule_StringToLongLong(cursor, &index) == REDISMODULE_OK);
+                RMUtil_Assert(!seen[index]);
+                seen[index] = 1;
+                ++listed;
+            }
+            if (len < 7) { break; }
+        }
+        RMUtil_Assert(listed == 100);
+
+        // a cursor that was acked starts over
+        RedisModule_Call(ctx, "REDE.xack", "cs", "TEST_DEHYDRATOR_xpoll_cursor", cursor);
+        RedisModuleCallReply *xpoll_rep =
+          RedisModule_Call(ctx, "REDE.xpoll", "ccs", "TEST_DEHYDRATOR_xpoll_cursor", "CURSOR", cursor);
+        RMUtil_Assert(RedisModule_CallReplyLength(xpoll_rep) == 99);
+    }
+
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll_cursor");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_update", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check3), "some OTHER payload"));
 
-    RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_update", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+int TestXPollLease(RedisModuleCtx *ctx)
+{
+    printf("Testing XPoll Lease - ");
 
-    RedisModuleCallReply *check4 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
-    RMUtil_Assert(RedisModule_CallReplyType(check4) == REDISMODULE_REPLY_ERROR);
+    int engine;
+    for (engine = 0; engine < 2; ++engine)
+    {
+        // clear dehydrator
+        RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll_lease");
+        RedisModule_Call(ctx, "REDE.create", "cc", "TEST_DEHYDRATOR_xpoll_lease", (engine == 0) ? "QUEUEMAP" : "WHEEL");
+
+        // start test
+        RedisModule_Call(ctx, "REDE.mpush", "cccccccccc", "TEST_DEHYDRATOR_xpoll_lease",
+            "0", "element_1", "e1", "1", "element_2", "e2", "2", "element_3", "e3");
+        usleep(5000);
+
+        RedisModuleCallReply *bad_lease_rep =
+          RedisModule_Call(ctx, "REDE.xpoll", "ccc", "TEST_DEHYDRATOR_xpoll_lease", "LEASE", "0");
+        RMUtil_Assert(RedisModule_CallReplyType(bad_lease_rep) == REDISMODULE_REPLY_ERROR);
+
+        // claim the two earliest, only the third is left for others
+        RedisModuleCallReply *lease_rep =
+          RedisModule_Call(ctx, "REDE.xpoll", "ccccc", "TEST_DEHYDRATOR_xpoll_lease", "LEASE", "200", "COUNT", "2");
+        RMUtil_Assert(RedisModule_CallReplyLength(lease_rep) == 2);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(lease_rep, 0), "e1");
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(lease_rep, 1), "e2");
+        RedisModuleCallReply *xpoll_rep =
+          RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll_lease");
+        RMUtil_Assert(RedisModule_CallReplyLength(xpoll_rep) == 1);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(xpoll_rep, 0), "e3");
+        RedisModuleCallReply *poll_rep =
+          RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_xpoll_lease");
+        RMUtil_Assert(RedisModule_CallReplyLength(poll_rep) == 1);
+
+        // a claimed element can be acked during its lease
+        RedisModuleCallReply *xack_rep =
+          RedisModule_Call(ctx, "REDE.xack", "cc", "TEST_DEHYDRATOR_xpoll_lease", "e1");
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(xack_rep, 0)), "element_1"));
+
+        // the other one comes back once the lease is over
+        usleep(250000);
+        xpoll_rep = RedisModule_Call(ctx, "REDE.xpoll", "c", "TEST_DEHYDRATOR_xpoll_lease");
+        RMUtil_Assert(RedisModule_CallReplyLength(xpoll_rep) == 1);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(xpoll_rep, 0), "e2");
+
+        // with the ttl it was pushed with, and acking it now counts how late it is
+        RedisModuleString* name = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_xpoll_lease", 27);
+        RedisModuleString* e2 = RedisModule_CreateString(ctx, "e2", 2);
+        RedisModuleKey* key = RedisModule_OpenKey(ctx, name, REDISMODULE_READ);
+        Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+        RedisModule_CloseKey(key);
+        RMUtil_Assert(_getNodeForID(dehydrator, e2)->ttl == 1);
+        long long released = dehydrator->lateness->count;
+        xack_rep = RedisModule_Call(ctx, "REDE.xack", "cc", "TEST_DEHYDRATOR_xpoll_lease", "e2");
+        RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(xack_rep, 0)), "element_2"));
+        RMUtil_Assert(dehydrator->lateness->count == released + 1);
+        RedisModule_FreeString(ctx, e2);
+        RedisModule_FreeString(ctx, name);
+    }
 
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_xpoll_lease");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestTimeToNext(RedisModuleCtx *ctx)
+int TestMPushAt(RedisModuleCtx *ctx)
 {
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
-    printf("Testing TTN - ");
-
-    RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_ttn", "3000", "payload", "ttn_test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    printf("Testing MPushAt - ");
 
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check1) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check1) <= 3000);
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpushat");
 
-    sleep(2);
+    // start test
+    // expirations are kept as given, even out of order within a ttl
+    char now[32], past[32], later[32];
+    long long t = current_time_ms();
+    sprintf(now, "%lld", t);
+    sprintf(past, "%lld", t - 50000);
+    sprintf(later, "%lld", t + 100000);
+    RedisModuleCallReply *mpushat_rep =
+      RedisModule_Call(ctx, "REDE.mpushat", "ccccccccccccc", "TEST_DEHYDRATOR_mpushat",
+        "100000", later, "element_1", "e1", "100000", now, "element_2", "e2", "100000", past, "element_3", "e3");
+    RMUtil_Assert(RedisModule_CallReplyType(mpushat_rep) == REDISMODULE_REPLY_INTEGER);
+    RMUtil_Assert(RedisModule_CallReplyInteger(mpushat_rep) == 3);
+
+    RedisModuleCallReply *bad_rep =
+      RedisModule_Call(ctx, "REDE.mpushat", "ccccc", "TEST_DEHYDRATOR_mpushat", "100000", "soon", "element_4", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(bad_rep) == REDISMODULE_REPLY_ERROR);
+
+    // leased elements can be acked before they expire
+    mpushat_rep = RedisModule_Call(ctx, "REDE.mpushat", "cccccc", "TEST_DEHYDRATOR_mpushat",
+        "LEASED", "100000", later, "element_4", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(mpushat_rep) == REDISMODULE_REPLY_INTEGER);
+
+    RedisModuleCallReply *poll_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_mpushat");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll_rep) == 2);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll_rep, 0), "element_3");
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll_rep, 1), "element_2");
+    RedisModuleCallReply *xack_rep =
+      RedisModule_Call(ctx, "REDE.xack", "ccc", "TEST_DEHYDRATOR_mpushat", "e1", "e4");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(xack_rep, 0)) == REDISMODULE_REPLY_NULL);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(xack_rep, 1), "element_4");
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check2) <= 1000);
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_mpushat");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    sleep(2);
 
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check3) == 0);
+int TestEffects(RedisModuleCtx *ctx)
+{
+    printf("Testing Effects - ");
 
+    // start test
+    // a stored node is replicated as a REDE.MPUSHAT record, a removed one by its id
+    Dehydrator* dehydrator = _createDehydrator(NULL, DEHYDRATOR_ENGINE_QUEUEMAP);
+    ElementListNode* node = _createNewNode(dehydrator, "e1", 2, "element_1", 9, NULL, 1000, 123456);
+    _storeNode(dehydrator, node, NULL);
+
+    Effects effects;
+    _initEffects(&effects, ctx);
+    _addStoredNode(&effects, node);
+    _addRemovedNode(&effects, node);
+    RMUtil_Assert(effects.argc == 5);
+    const char* expected[] = { "1000", "123456", "element_1", "e1", "e1" };
+    int i;
+    for (i = 0; i < 5; ++i)
+    {
+        size_t len;
+        const char* arg = RedisModule_StringPtrLen(effects.argv[i], &len);
+        RMUtil_Assert((len == strlen(expected[i])) && (memcmp(arg, expected[i], len) == 0));
+    }
+    _clearEffects(&effects);
+    RMUtil_Assert(effects.argc == 0);
 
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
+    _freeEffects(&effects);
+    deleteDehydrator(dehydrator);
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestPush(RedisModuleCtx *ctx)
+int TestLazyFree(RedisModuleCtx *ctx)
 {
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
-    printf("Testing Push - ");
-    // char * element_id = "push_test_element";
-    // size_t len
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
-    // check if X is dehydtaring (should be false)
-    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+    printf("Testing Lazy Free - ");
 
-    RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_push", "1000", "payload", "push_test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
-
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2), "payload"));
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lazyfree");
 
-    // TODO: test pushing more then one element
-    // TODO: add fail-case tests
+    // start test
+    // a dehydrator past the threshold is freed in the background, with large elements and all
+    char large[1024];
+    memset(large, 'x', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\0';
+    char element_id[32];
+    int i;
+    for (i = 0; i < 2 * LAZYFREE_THRESHOLD; ++i)
+    {
+        sprintf(element_id, (i % 3) ? "%d" : "id_%d", i);
+        RedisModuleCallReply *push_rep =
+          RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_lazyfree", (i % 2) ? "100000" : "200000",
+            (i % 100) ? "element" : large, element_id);
+        RMUtil_Assert(RedisModule_CallReplyType(push_rep) != REDISMODULE_REPLY_ERROR);
+    }
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lazyfree");
+    RedisModuleCallReply *exists_rep = RedisModule_Call(ctx, "EXISTS", "c", "TEST_DEHYDRATOR_lazyfree");
+    RMUtil_Assert(RedisModule_CallReplyInteger(exists_rep) == 0);
+
+    // the name is free to reuse right away
+    RedisModuleCallReply *push_rep =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_lazyfree", "100000", "element", "1");
+    RMUtil_Assert(RedisModule_CallReplyType(push_rep) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *look_rep = RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_lazyfree", "2");
+    RMUtil_Assert(RedisModule_CallReplyType(look_rep) == REDISMODULE_REPLY_NULL);
+
+    for (i = 0; (i < 1000) && (lazyfreePending() > 0); ++i)
+    {
+        usleep(1000);
+    }
+    RMUtil_Assert(lazyfreePending() == 0);
 
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lazyfree");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestPull(RedisModuleCtx *ctx)
+// walk the dispatchers the way _runDispatchers does
+int _countDispatchers()
 {
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
-    printf("Testing Pull - ");
+    int count = 0;
+    _lockDehydrators();
+    Dehydrator* dehydrator;
+    for (dehydrator = dispatchers; dehydrator != NULL; dehydrator = dispatch_cursor)
+    {
+        dispatch_cursor = dehydrator->dispatch_next;
+        if (dehydrator->dispatch_target != NULL) { ++count; }
+    }
+    dispatch_cursor = NULL;
+    _unlockDehydrators();
+    return count;
+}
 
-    char * store_key = "pull_test_element";
-    char * bad_store_key = "pull_test_bad_element";
 
-    RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_pull", "100000", "payload", store_key);
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+void* _detachOnThread(void* arg)
+{
+    Dehydrator** dehydrators = arg;
+    int i;
+    for (i = 0; dehydrators[i] != NULL; ++i)
+    {
+        DehydratorTypeFree(dehydrators[i]);
+    }
+    return NULL;
+}
 
 
-    RedisModuleCallReply *look1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", store_key);
-    // RMUTIL_ASSERT_NOERROR(look1);
-    RMUtil_Assert(RedisModule_CallReplyType(look1) != REDISMODULE_REPLY_ERROR);
-    // RMUtil_Assert(RedisModule_CallReplyInteger(rep1) == 1);
+int TestThreadedFree(RedisModuleCtx *ctx)
+{
+    printf("Testing Threaded Free - ");
 
+    // start test
+    // Redis frees values on its own threads too (FLUSHALL ASYNC), while the dispatchers
+    // are walked on the main thread
+    #define THREADED_FREE_COUNT 256
+    Dehydrator* dehydrators[THREADED_FREE_COUNT + 1];
+    long long count = _dehydratorCount();
+    int dispatcher_count = _countDispatchers();
+    int i;
+    for (i = 0; i < THREADED_FREE_COUNT; ++i)
+    {
+        dehydrators[i] = _createDehydrator(RedisModule_CreateString(NULL, "threaded", 8),
+            (i % 2) ? DEHYDRATOR_ENGINE_WHEEL : DEHYDRATOR_ENGINE_QUEUEMAP);
+        _setDispatch(dehydrators[i], DISPATCH_LIST, RedisModule_CreateString(NULL, "threaded_list", 13));
+    }
+    dehydrators[THREADED_FREE_COUNT] = NULL;
+    RMUtil_Assert(_dehydratorCount() == count + THREADED_FREE_COUNT);
 
-    RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(pull1));
+    pthread_t thread;
+    RMUtil_Assert(pthread_create(&thread, NULL, _detachOnThread, dehydrators) == 0);
+    while (_countDispatchers() > dispatcher_count);
+    pthread_join(thread, NULL);
 
+    RMUtil_Assert(_countDispatchers() == dispatcher_count);
+    RMUtil_Assert(_dehydratorCount() == count);
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    RedisModuleCallReply *look2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look2));
-    // RMUtil_Assert(RedisModule_CallReplyInteger(rep2) == 0);
 
+int TestExpiredDispatcher(RedisModuleCtx *ctx)
+{
+    printf("Testing Expired Dispatcher - ");
 
-    RedisModuleCallReply *pull2 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", store_key);
-    RMUtil_Assert(RedisModule_CallReplyType(pull2) != REDISMODULE_REPLY_ERROR);
+    // clear dehydrators
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_expired_small");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_expired_large");
+
+    // start test
+    // the dispatcher opens the key of a dehydrator with an EXPIRE after it is due, which
+    // frees it - right away when it is small, and on the lazyfree thread when it is large
+    int dispatcher_count = _countDispatchers();
+    long long count = _dehydratorCount();
+    RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_expired_small", "LIST", "TEST_DEHYDRATOR_expired_list");
+    RedisModule_Call(ctx, "REDE.dispatch", "ccc", "TEST_DEHYDRATOR_expired_large", "LIST", "TEST_DEHYDRATOR_expired_list");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_expired_small", "100000", "element", "id");
+    int i;
+    char id[16];
+    for (i = 0; i < 2 * LAZYFREE_THRESHOLD; ++i)
+    {
+        sprintf(id, "%d", i);
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_expired_large", "100000", "element", id);
+    }
+    RMUtil_Assert(_countDispatchers() == dispatcher_count + 2);
+    RedisModule_Call(ctx, "PEXPIRE", "cc", "TEST_DEHYDRATOR_expired_small", "1");
+    RedisModule_Call(ctx, "PEXPIRE", "cc", "TEST_DEHYDRATOR_expired_large", "1");
+    usleep(5000);
+
+    // both are gone, and the walk went on without touching them
+    _runDispatchers(ctx, NULL);
+    RMUtil_Assert(_countDispatchers() == dispatcher_count);
+    RMUtil_Assert(_dehydratorCount() == count);
+    RMUtil_Assert(dispatch_current == NULL);
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_expired_list");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
 
-    RedisModuleCallReply *look3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look3));
+int TestClock(RedisModuleCtx *ctx)
+{
+    printf("Testing Clock - ");
+
+    // start test
+    // the clock follows the wall clock it was anchored to, and never goes back
+    RMUtil_Assert(llabs(current_time_ms() - (long long)time(NULL) * 1000) < 2000);
+    long long last = current_time_us();
+    int i;
+    for (i = 0; i < 100000; ++i)
+    {
+        long long now = current_time_us();
+        RMUtil_Assert(now >= last);
+        last = now;
+    }
+    RMUtil_Assert(current_time_ms() >= last / 1000);
+
+    // generated ids keep increasing, even if the time they are generated for goes back
+    char first[ID_LENGTH], second[ID_LENGTH];
+    generate_id(first, last / 1000 + 1);
+    generate_id(second, last / 1000);
+    RMUtil_Assert(memcmp(first, second, ID_LENGTH) < 0);
 
     printf("Passed.\n");
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
     return REDISMODULE_OK;
 }
 
 
-int TestPoll(RedisModuleCtx *ctx)
+int TestStats(RedisModuleCtx *ctx)
 {
-    printf("Testing Poll - ");
+    printf("Testing Stats - ");
 
     // clear dehydrator
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_stats");
 
     // start test
-    // push elements 1, 4, 7 & 3a (for 1, 4, 7 & 3 seconds)
-    // 1
-    RedisModuleCallReply *push1 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "1000", "element_1", "e1");
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    char large[1024];
+    memset(large, 'x', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\0';
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_stats", "0", "element", "a");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_stats", "100000", "element", "b");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_stats", "100000", "element", "c");
+    RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_stats", "b");
+    RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_stats", "c", large);
+    RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_stats");
+
+    RedisModuleCallReply *stats_rep = RedisModule_Call(ctx, "REDE.stats", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(RedisModule_CallReplyType(stats_rep) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(stats_rep) == 30);
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 3)) == 1); // elements
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 5)) == 1); // queues
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 7)) > 1024); // bytes
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 9)) == 3); // pushed
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 11)) == 1); // pulled
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 13)) == 1); // expired
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 19)) == 1); // updated
+
+    // every command called so far has a latency line
+    RedisModuleCallReply *module_rep = RedisModule_Call(ctx, "REDE.stats", "");
+    RMUtil_Assert(RedisModule_CallReplyLength(module_rep) == 18);
+    RedisModuleCallReply *commands_rep = RedisModule_CallReplyArrayElement(module_rep, 17);
+    int found = 0;
+    size_t i;
+    for (i = 0; i < RedisModule_CallReplyLength(commands_rep); ++i)
+    {
+        RedisModuleCallReply *command_rep = RedisModule_CallReplyArrayElement(commands_rep, i);
+        size_t len;
+        const char* name = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(command_rep, 1), &len);
+        if ((len != 4) || (strncmp(name, "push", len) != 0)) { continue; }
+        found = 1;
+        RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(command_rep, 3)) >= 3);
+        RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(command_rep, 5)) <=
+            RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(command_rep, 11)));
+    }
+    RMUtil_Assert(found);
 
-    // 4
-    RedisModuleCallReply *push4 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "4000", "element_4", "e4");
-    RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+    // percentiles are within a bucket (1/8) of the real ones
+    LatencyHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    long long us;
+    for (us = 1; us <= 10000; ++us)
+    {
+        _recordLatency(&histogram, us);
+    }
+    RMUtil_Assert(llabs(_latencyPercentile(&histogram, 500) - 5000) <= 5000 / 8);
+    RMUtil_Assert(llabs(_latencyPercentile(&histogram, 990) - 9900) <= 9900 / 8);
+    RMUtil_Assert(_latencyPercentile(&histogram, 1000) == 10000);
+    _recordLatency(&histogram, 1LL << 50);
+    RMUtil_Assert(histogram.max == 1LL << 50);
+
+    // nil without a dehydrator, just the type error on a key of another type
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_stats");
+    stats_rep = RedisModule_Call(ctx, "REDE.stats", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(RedisModule_CallReplyType(stats_rep) == REDISMODULE_REPLY_NULL);
+    RedisModule_Call(ctx, "SET", "cc", "TEST_DEHYDRATOR_stats", "string");
+    stats_rep = RedisModule_Call(ctx, "REDE.stats", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(RedisModule_CallReplyType(stats_rep) == REDISMODULE_REPLY_ERROR);
 
-    // 7
-    RedisModuleCallReply *push7 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "7000", "element_7", "e7");
-    RMUtil_Assert(RedisModule_CallReplyType(push7) != REDISMODULE_REPLY_ERROR);
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_stats");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    // 3a
-    RedisModuleCallReply *push3a =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3a", "e3a");
-    RMUtil_Assert(RedisModule_CallReplyType(push3a) != REDISMODULE_REPLY_ERROR);
 
-    // pull question 7
-    RedisModuleCallReply *pull_seven_rep =
-      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_poll", "e7");
-    RMUtil_Assert(RedisModule_CallReplyType(pull_seven_rep) != REDISMODULE_REPLY_ERROR);
+int TestLateness(RedisModuleCtx *ctx)
+{
+    printf("Testing Lateness - ");
 
-    // poll - make sure no element pops right out
-    RedisModuleCallReply *poll1_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-    RMUtil_Assert(RedisModule_CallReplyType(poll1_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 0);
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lateness");
 
-    // sleep 1 sec
-    sleep(1);
-    // push element 3b (for 3 seconds)
-    // 3b
-    RedisModuleCallReply *push_three_b =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3b", "e3b");
-    RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
+    // start test
+    // nothing was released yet
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_lateness", "0", "element", "a");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_lateness", "0", "element", "b");
+    RedisModuleCallReply *stats_rep = RedisModule_Call(ctx, "REDE.stats", "c", "TEST_DEHYDRATOR_lateness");
+    RMUtil_Assert(RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 27)) == 0);
+
+    // a is polled and b is acked 50ms after they expire, c is acked 100ms after
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_lateness", "-50", "element", "c");
+    usleep(50000);
+    RedisModule_Call(ctx, "REDE.poll", "ccc", "TEST_DEHYDRATOR_lateness", "COUNT", "1");
+    RedisModule_Call(ctx, "REDE.xack", "ccc", "TEST_DEHYDRATOR_lateness", "b", "c");
+
+    stats_rep = RedisModule_Call(ctx, "REDE.stats", "c", "TEST_DEHYDRATOR_lateness");
+    RMUtil_Assert(RedisModule_CallReplyLength(stats_rep) == 30);
+    long long p50 = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 21));
+    long long max = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats_rep, 27));
+    RMUtil_Assert((p50 >= 50) && (p50 < 100));
+    RMUtil_Assert((max >= 100) && (max < 1000));
 
-    // poll (t=1) - we expect only element 1 to pop out
-    RedisModuleCallReply *poll_two_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-    RMUtil_Assert(RedisModule_CallReplyType(poll_two_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(poll_two_rep) == 1);
-    RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(poll_two_rep, 0);
-    RMUtil_AssertReplyEquals(subreply_a, "element_1")
+    // clear dehydrator
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lateness");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    // sleep 2 secs and poll (t=3) - we expect only element 3a to pop out
-    sleep(2);
-    RedisModuleCallReply *poll_three_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-    RMUtil_Assert(RedisModule_CallReplyType(poll_three_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(poll_three_rep) == 1);
-    RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(poll_three_rep, 0);
-    RMUtil_AssertReplyEquals(subreply_b, "element_3a");
 
+int TestRdbEncoding(RedisModuleCtx *ctx)
+{
+    printf("Testing RDB Encoding - ");
 
-    // sleep 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
-    sleep(2);
-    RedisModuleCallReply *poll_four_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-    RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
-    RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
-    RedisModuleCallReply *subreply_c_second = RedisModule_CallReplyArrayElement(poll_four_rep, 1);
-    RedisModuleString * first_str =  RedisModule_CreateStringFromCallReply(subreply_c_first);
-    RedisModuleString * second_str = RedisModule_CreateStringFromCallReply(subreply_c_second);
-    RedisModuleString * element_3b_str = RedisModule_CreateString(ctx, "element_3b", strlen("element_3b"));
-    RedisModuleString * element_4_str = RedisModule_CreateString(ctx, "element_4", strlen("element_4"));
-    RMUtil_Assert(
-    (
-        RMUtil_StringEquals(first_str, element_3b_str) &&
-        RMUtil_StringEquals(second_str, element_4_str)
-    ) ||
-    (
-        RMUtil_StringEquals(first_str, element_4_str) &&
-        RMUtil_StringEquals(second_str, element_3b_str)
-    )
-    );
+    // start test
+    // varints and zigzag deltas survive a round trip, including the extremes
+    long long values[] = {0, 1, -1, 63, -64, 64, 127, 128, 16383, 16384, 1500000000000LL, LLONG_MAX, LLONG_MIN};
+    int value_count = sizeof(values) / sizeof(values[0]);
+    unsigned char buf[10 * sizeof(values) / sizeof(values[0])];
+    size_t len = 0;
+    int i;
+    for (i = 0; i < value_count; ++i)
+    {
+        len += varint_encode(zigzag_encode(values[i]), buf + len);
+    }
+    RMUtil_Assert(varint_encode(0, buf + len) == 1);
+    RMUtil_Assert(varint_encode(UINT64_MAX, buf + len) == 10);
 
-    // sleep 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
-    sleep(6);
-    RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-    RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
+    const unsigned char* pos = buf;
+    for (i = 0; i < value_count; ++i)
+    {
+        uint64_t decoded;
+        RMUtil_Assert(varint_decode(&pos, buf + len, &decoded));
+        RMUtil_Assert(zigzag_decode(decoded) == values[i]);
+    }
+    RMUtil_Assert(pos == buf + len);
+
+    // a truncated varint is rejected
+    uint64_t decoded;
+    unsigned char truncated[] = {0x80, 0x80};
+    pos = truncated;
+    RMUtil_Assert(!varint_decode(&pos, truncated + sizeof(truncated), &decoded));
 
-    // clear dehydrator
-    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
@@ -1623,12 +4349,33 @@ int TestModule(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
     RMUtil_Test(TestLook);
     RMUtil_Test(TestPush);
+    RMUtil_Test(TestGIDPush);
+    RMUtil_Test(TestMPush);
+    RMUtil_Test(TestMPullMLook);
+    RMUtil_Test(TestMPushAt);
+    RMUtil_Test(TestEffects);
     RMUtil_Test(TestPull);
     RMUtil_Test(TestPoll);
+    RMUtil_Test(TestPollLimits);
     RMUtil_Test(TestTimeToNext);
     RMUtil_Test(TestUpdate);
     RMUtil_Test(TestXPoll)
+    RMUtil_Test(TestXPollCursor);
+    RMUtil_Test(TestXPollLease);
     RMUtil_Test(TestXAck)
+    RMUtil_Test(TestWheel);
+    RMUtil_Test(TestBPoll);
+    RMUtil_Test(TestDispatch);
+    RMUtil_Test(TestSlabs);
+    RMUtil_Test(TestLargeElement);
+    RMUtil_Test(TestIntegerIds);
+    RMUtil_Test(TestLazyFree);
+    RMUtil_Test(TestThreadedFree);
+    RMUtil_Test(TestExpiredDispatcher);
+    RMUtil_Test(TestRdbEncoding);
+    RMUtil_Test(TestClock);
+    RMUtil_Test(TestStats);
+    RMUtil_Test(TestLateness);
     printf("All Tests Passed Succesfully!\n");
 
     RedisModule_ReplyWithSimpleString(ctx, "PASS");
@@ -1644,6 +4391,9 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    init_clock();
+    seed_id_generator();
+
     RedisModuleTypeMethods tm = {
         .version = REDISMODULE_TYPE_METHOD_VERSION,
         .rdb_load = DehydratorTypeRdbLoad,
@@ -1652,35 +4402,77 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         .free = DehydratorTypeFree,
     };
 
-    DehydratorType = RedisModule_CreateDataType(ctx, "dehy-type", 0, &tm);
+    DehydratorType = RedisModule_CreateDataType(ctx, "dehy-type", 5, &tm);
     if (DehydratorType == NULL) return REDISMODULE_ERR;
 
+    // register dehydrator.create - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.CREATE", CreateCommand);
+
     // register TimeToNextCommand - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.TTN", TimeToNextCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.TTN", TimeToNextCommandTimed);
 
     // register dehydrator.update - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.UPDATE", UpdateCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.UPDATE", UpdateCommandTimed);
 
     // register dehydrator.push - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.PUSH", PushCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.PUSH", PushCommandTimed);
 
     // register dehydrator.pull - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.PULL", PullCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.PULL", PullCommandTimed);
 
     // register dehydrator.poll - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.POLL", PollCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.POLL", PollCommandTimed);
+
+    // register dehydrator.bpoll, blocking needs the timer API (redis 5.0 and up)
+    if (RedisModule_CreateTimer != NULL)
+    {
+        RMUtil_RegisterWriteCmd(ctx, "REDE.BPOLL", BPollCommandTimed);
+    }
+
+    // register dehydrator.dispatch, the dispatcher runs on a timer (redis 5.0 and up)
+    if (RedisModule_CreateTimer != NULL)
+    {
+        RMUtil_RegisterWriteCmd(ctx, "REDE.DISPATCH", DispatchCommand);
+    }
+
+    // register dehydrator.mpull - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPULL", MPullCommandTimed);
 
     // register dehydrator.poll - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.XPOLL", XPollCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.XPOLL", XPollCommandTimed);
 
         // register dehydrator.poll - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.XACK", XAckCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.XACK", XAckCommandTimed);
 
     // register dehydrator.look - using the shortened utility registration macro
-    RMUtil_RegisterReadCmd(ctx, "REDE.LOOK", LookCommand);
+    RMUtil_RegisterReadCmd(ctx, "REDE.LOOK", LookCommandTimed);
+
+    // register dehydrator.mlook - using the shortened utility registration macro
+    RMUtil_RegisterReadCmd(ctx, "REDE.MLOOK", MLookCommandTimed);
+
+    // register dehydrator.slabs - using the shortened utility registration macro
+    RMUtil_RegisterReadCmd(ctx, "REDE.SLABS", SlabsCommand);
 
     // register dehydrator.gidpush - using the shortened utility registration macro
-    RMUtil_RegisterWriteCmd(ctx, "REDE.GIDPUSH", GIDPushCommand);
+    RMUtil_RegisterWriteCmd(ctx, "REDE.GIDPUSH", GIDPushCommandTimed);
+
+    // register dehydrator.mpush - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPUSH", MPushCommandTimed);
+
+    // register dehydrator.gidmpush - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.GIDMPUSH", GIDMPushCommandTimed);
+
+    // register dehydrator.mpushat - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPUSHAT", MPushAtCommandTimed);
+
+    // register dehydrator.stats - using the shortened utility registration macro
+    RMUtil_RegisterReadCmd(ctx, "REDE.STATS", StatsCommand);
+
+    // the same stats in INFO, the info API needs redis 6.0 and up
+    if (RedisModule_RegisterInfoFunc != NULL)
+    {
+        RedisModule_RegisterInfoFunc(ctx, StatsInfo);
+    }
 
     //  TEST OUTPUTS TO THE SERVER SIDE, USE WITH CAUTION
     // register the unit test
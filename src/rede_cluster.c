@@ -0,0 +1,639 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "rede_cluster.h"
+
+// most redirections followed for a single command
+#define CLUSTER_MAX_REDIRECTS 5
+#define MOVED 1
+#define ASK 2
+
+
+//##########################################################
+//#
+//#                     Slots
+//#
+//#########################################################
+
+// CRC16-CCITT (XMODEM), the key hash of Redis Cluster
+static unsigned short _crc16(const char* buf, size_t len)
+{
+    unsigned short crc = 0;
+    size_t i;
+    int bit;
+    for (i = 0; i < len; ++i)
+    {
+        crc ^= (unsigned short)((unsigned char)buf[i] << 8);
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (unsigned short)((crc << 1) ^ 0x1021) : (unsigned short)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+int clusterKeySlot(const char* key, size_t len)
+{
+    // only the part between the first '{' and the next '}' is hashed, when it is not empty
+    size_t start, end;
+    for (start = 0; (start < len) && (key[start] != '{'); ++start);
+    if (start < len)
+    {
+        for (end = start + 1; (end < len) && (key[end] != '}'); ++end);
+        if ((end < len) && (end > start + 1))
+        {
+            key += start + 1;
+            len = end - start - 1;
+        }
+    }
+    return _crc16(key, len) & (CLUSTER_SLOTS - 1);
+}
+
+static char* _copyString(const char* str, size_t len)
+{
+    char* copy = respAlloc(NULL, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// a reply made up here rather than read from a server
+static Reply* _newReply(int type)
+{
+    Reply* reply = respAlloc(NULL, sizeof(Reply));
+    memset(reply, 0, sizeof(Reply));
+    reply->type = type;
+    return reply;
+}
+
+
+//##########################################################
+//#
+//#                     Nodes
+//#
+//#########################################################
+
+static int _findNode(ReDeCluster* cluster, const char* host, int port)
+{
+    int i;
+    for (i = 0; i < cluster->node_count; ++i)
+    {
+        if ((cluster->nodes[i].port == port) && (strcmp(cluster->nodes[i].host, host) == 0)) { return i; }
+    }
+    cluster->nodes = respAlloc(cluster->nodes, (cluster->node_count + 1) * sizeof(ClusterNode));
+    cluster->nodes[i].host = _copyString(host, strlen(host));
+    cluster->nodes[i].port = port;
+    cluster->nodes[i].conn = NULL;
+    return cluster->node_count++;
+}
+
+static Connection* _nodeConnection(ReDeCluster* cluster, int node)
+{
+    ClusterNode* entry = &cluster->nodes[node];
+    if (entry->conn == NULL)
+    {
+        entry->conn = respOpen(entry->host, entry->port, NULL, cluster->password, NULL);
+    }
+    return entry->conn;
+}
+
+static void _dropConnection(ReDeCluster* cluster, int node)
+{
+    respDisconnect(cluster->nodes[node].conn);
+    cluster->nodes[node].conn = NULL;
+}
+
+// take in a CLUSTER SLOTS reply, given by `asked`
+static void _applySlots(ReDeCluster* cluster, int asked, Reply* reply)
+{
+    size_t i;
+    for (i = 0; i < reply->count; ++i)
+    {
+        Reply* range = reply->elements[i];
+        if ((range->type != REPLY_ARRAY) || (range->count < 3) ||
+            (range->elements[2]->type != REPLY_ARRAY) || (range->elements[2]->count < 2))
+        {
+            continue;
+        }
+        Reply* master = range->elements[2];
+        // newer servers leave out the host when it is the one that was asked
+        const char* host = master->elements[0]->str;
+        if ((host == NULL) || (host[0] == '\0') || (strcmp(host, "?") == 0)) { host = cluster->nodes[asked].host; }
+        int node = _findNode(cluster, host, (int)master->elements[1]->integer);
+
+        long long slot;
+        for (slot = range->elements[0]->integer; (slot <= range->elements[1]->integer) && (slot < CLUSTER_SLOTS); ++slot)
+        {
+            if (slot >= 0) { cluster->slots[slot] = node; }
+        }
+    }
+}
+
+// ask the known nodes for the slot map until one answers, returns -1 if none did
+static int _refreshSlots(ReDeCluster* cluster)
+{
+    int i;
+    for (i = 0; i < cluster->node_count; ++i)
+    {
+        Connection* conn = _nodeConnection(cluster, i);
+        if (conn == NULL) { continue; }
+        const char* argv[] = { "CLUSTER", "SLOTS" };
+        respAppendCommand(conn, 2, argv, NULL);
+        Reply* reply = (respFlush(conn) == 0) ? respReadReply(conn) : NULL;
+        if (reply == NULL)
+        {
+            _dropConnection(cluster, i);
+            continue;
+        }
+
+        if (reply->type == REPLY_ERROR)
+        {
+            // not a cluster, this server has every slot
+            int slot;
+            for (slot = 0; slot < CLUSTER_SLOTS; ++slot) { cluster->slots[slot] = i; }
+        }
+        else if (reply->type == REPLY_ARRAY)
+        {
+            _applySlots(cluster, i, reply);
+        }
+        respFreeReply(reply);
+        return 0;
+    }
+    return -1;
+}
+
+// MOVED or ASK, with the node the reply points to
+static int _redirection(ReDeCluster* cluster, Reply* reply, int* slot, int* node)
+{
+    if ((reply->type != REPLY_ERROR) || (reply->str == NULL)) { return 0; }
+    int kind;
+    const char* rest;
+    if (strncmp(reply->str, "MOVED ", 6) == 0) { kind = MOVED; rest = reply->str + 6; }
+    else if (strncmp(reply->str, "ASK ", 4) == 0) { kind = ASK; rest = reply->str + 4; }
+    else { return 0; }
+
+    // <slot> <host>:<port>, the host may be an ipv6 address
+    char* end;
+    *slot = (int)strtol(rest, &end, 10);
+    if ((end == rest) || (*end != ' ') || (*slot < 0) || (*slot >= CLUSTER_SLOTS)) { return 0; }
+    const char* address = end + 1;
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL) { return 0; }
+    char* host = _copyString(address, colon - address);
+    *node = _findNode(cluster, host, atoi(colon + 1));
+    free(host);
+    return kind;
+}
+
+static int _isRedirection(Reply* reply)
+{
+    return (reply->type == REPLY_ERROR) && (reply->str != NULL) &&
+        ((strncmp(reply->str, "MOVED ", 6) == 0) || (strncmp(reply->str, "ASK ", 4) == 0));
+}
+
+
+//##########################################################
+//#
+//#                     Cluster
+//#
+//#########################################################
+
+ReDeCluster* clusterConnect(const char* host, int port, const char* password)
+{
+    ReDeCluster* cluster = respAlloc(NULL, sizeof(ReDeCluster));
+    memset(cluster, 0, sizeof(ReDeCluster));
+    int slot;
+    for (slot = 0; slot < CLUSTER_SLOTS; ++slot) { cluster->slots[slot] = -1; }
+    cluster->password = (password != NULL) ? _copyString(password, strlen(password)) : NULL;
+    _findNode(cluster, host, port);
+
+    if (_refreshSlots(cluster) != 0)
+    {
+        clusterDisconnect(cluster);
+        return NULL;
+    }
+    return cluster;
+}
+
+void clusterDisconnect(ReDeCluster* cluster)
+{
+    if (cluster == NULL) { return; }
+    int i;
+    for (i = 0; i < cluster->node_count; ++i)
+    {
+        respDisconnect(cluster->nodes[i].conn);
+        free(cluster->nodes[i].host);
+    }
+    free(cluster->nodes);
+    free(cluster->password);
+    free(cluster);
+}
+
+// send a command to the node serving `slot`. a command whose reply was lost with its
+// connection may have run anyway, it is sent again only if `resend_lost` (running it twice
+// does no harm) - a redirected command did not run, and is always sent where it belongs.
+static Reply* _clusterCommand(ReDeCluster* cluster, int slot, int argc, const char** argv, const size_t* argv_len,
+    int resend_lost)
+{
+    int asking = -1; // the node an ASK sent us to, for this one command
+    int attempt;
+    for (attempt = 0; attempt <= CLUSTER_MAX_REDIRECTS; ++attempt)
+    {
+        if ((asking < 0) && (cluster->slots[slot] < 0)) { _refreshSlots(cluster); }
+        int node = (asking >= 0) ? asking : cluster->slots[slot];
+        if (node < 0) { return NULL; }
+        Connection* conn = _nodeConnection(cluster, node);
+        if (conn == NULL)
+        {
+            // the node is gone, another one may have taken over its slots
+            if (_refreshSlots(cluster) != 0) { return NULL; }
+            asking = -1;
+            continue;
+        }
+
+        if (asking >= 0)
+        {
+            const char* asking_argv[] = { "ASKING" };
+            respAppendCommand(conn, 1, asking_argv, NULL);
+        }
+        respAppendCommand(conn, argc, argv, argv_len);
+        Reply* reply = (respFlush(conn) == 0) ? respReadReply(conn) : NULL;
+        if ((reply != NULL) && (asking >= 0))
+        {
+            respFreeReply(reply);
+            reply = respReadReply(conn);
+        }
+        if (reply == NULL)
+        {
+            _dropConnection(cluster, node);
+            if (!resend_lost) { return NULL; }
+            asking = -1;
+            continue;
+        }
+
+        int redirected_slot, redirected_node;
+        int redirection = (attempt < CLUSTER_MAX_REDIRECTS) ?
+            _redirection(cluster, reply, &redirected_slot, &redirected_node) : 0;
+        if (redirection == 0) { return reply; }
+        respFreeReply(reply);
+        asking = -1;
+        if (redirection == ASK)
+        {
+            asking = redirected_node;
+        }
+        else
+        {
+            // the slot has moved for good, and others probably moved with it
+            cluster->slots[redirected_slot] = redirected_node;
+            _refreshSlots(cluster);
+            cluster->slots[redirected_slot] = redirected_node;
+        }
+    }
+    return NULL;
+}
+
+Reply* clusterCommand(ReDeCluster* cluster, int slot, int argc, const char** argv, const size_t* argv_len)
+{
+    return _clusterCommand(cluster, slot, argc, argv, argv_len, 1);
+}
+
+
+//##########################################################
+//#
+//#                     Sharded Dehydrator
+//#
+//#########################################################
+
+// a command sent to one of the shards
+typedef struct shard_command
+{
+    int shard;
+    int argc;
+    const char* argv[4];
+    char number[24];
+} ShardCommand;
+
+// send commands to several shards at once, in one pipeline per node. replies[i] answers
+// commands[i], or is NULL if it got no reply. commands that were redirected, or could not be
+// sent, are sent again one by one. commands lost with a failed connection may have run on
+// the node, so they are sent again only if `resend_lost` - POLL must not be, the elements
+// it took out went down with the lost reply, and a second POLL would take out more.
+// returns the number of commands that got no reply.
+static int _fanOut(ShardedDehydrator* dehydrator, ShardCommand* commands, int count, Reply** replies,
+    int resend_lost)
+{
+    ReDeCluster* cluster = dehydrator->cluster;
+    int* nodes = respAlloc(NULL, (count > 0 ? count : 1) * sizeof(int));
+    int i;
+    // before anything is pipelined, the slot map is asked for on the same connections
+    for (i = 0; i < count; ++i)
+    {
+        if (cluster->slots[dehydrator->slots[commands[i].shard]] < 0)
+        {
+            _refreshSlots(cluster);
+            break;
+        }
+    }
+    for (i = 0; i < count; ++i)
+    {
+        replies[i] = NULL;
+        nodes[i] = cluster->slots[dehydrator->slots[commands[i].shard]];
+        if ((nodes[i] < 0) || (_nodeConnection(cluster, nodes[i]) == NULL))
+        {
+            nodes[i] = -1;
+            continue;
+        }
+        respAppendCommand(cluster->nodes[nodes[i]].conn, commands[i].argc, commands[i].argv, NULL);
+    }
+
+    for (i = 0; i < cluster->node_count; ++i)
+    {
+        Connection* conn = cluster->nodes[i].conn;
+        if ((conn != NULL) && (conn->out_len > 0) && (respFlush(conn) != 0)) { _dropConnection(cluster, i); }
+    }
+
+    // every node answers its part of the pipeline in order
+    for (i = 0; i < count; ++i)
+    {
+        if ((nodes[i] < 0) || (cluster->nodes[nodes[i]].conn == NULL)) { continue; }
+        replies[i] = respReadReply(cluster->nodes[nodes[i]].conn);
+        if (replies[i] == NULL)
+        {
+            _dropConnection(cluster, nodes[i]);
+        }
+        else if (_isRedirection(replies[i]))
+        {
+            // not run, safe to send again
+            respFreeReply(replies[i]);
+            replies[i] = NULL;
+            nodes[i] = -1;
+        }
+    }
+
+    // from here on nodes[i] >= 0 marks a command that was sent and lost
+    int failed = 0;
+    for (i = 0; i < count; ++i)
+    {
+        if (replies[i] != NULL) { continue; }
+        if ((nodes[i] < 0) || resend_lost)
+        {
+            replies[i] = _clusterCommand(cluster, dehydrator->slots[commands[i].shard],
+                commands[i].argc, commands[i].argv, NULL, resend_lost);
+        }
+        if (replies[i] == NULL) { ++failed; }
+    }
+    free(nodes);
+    return failed;
+}
+
+static void _freeReplies(Reply** replies, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i) { respFreeReply(replies[i]); }
+    free(replies);
+}
+
+// the first error among the replies, taken out of them
+static Reply* _takeError(Reply** replies, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        if ((replies[i] != NULL) && (replies[i]->type == REPLY_ERROR))
+        {
+            Reply* error = replies[i];
+            replies[i] = NULL;
+            return error;
+        }
+    }
+    return NULL;
+}
+
+ShardedDehydrator* shardedDehydrator(ReDeCluster* cluster, const char* name, int shards)
+{
+    if ((strchr(name, '{') != NULL) || (shards <= 0) || (shards > CLUSTER_SLOTS)) { return NULL; }
+
+    ShardedDehydrator* dehydrator = respAlloc(NULL, sizeof(ShardedDehydrator));
+    dehydrator->cluster = cluster;
+    dehydrator->shards = shards;
+    dehydrator->keys = respAlloc(NULL, shards * sizeof(char*));
+    dehydrator->slots = respAlloc(NULL, shards * sizeof(int));
+    dehydrator->next_poll = 0;
+
+    // shard i takes the first tag (counting up from 0) that hashes into the i-th of
+    // `shards` equal parts of the slot range. every slot is reached before 110000.
+    int* part_of_slot = respAlloc(NULL, CLUSTER_SLOTS * sizeof(int));
+    int i, slot;
+    for (i = 0; i < shards; ++i)
+    {
+        dehydrator->keys[i] = NULL;
+        int first = (int)((long long)i * CLUSTER_SLOTS / shards);
+        int last = (int)((long long)(i + 1) * CLUSTER_SLOTS / shards);
+        for (slot = first; slot < last; ++slot) { part_of_slot[slot] = i; }
+    }
+
+    int found = 0, tag;
+    size_t name_len = strlen(name);
+    for (tag = 0; found < shards; ++tag)
+    {
+        char tag_str[16];
+        int tag_len = snprintf(tag_str, sizeof(tag_str), "%d", tag);
+        slot = _crc16(tag_str, tag_len) & (CLUSTER_SLOTS - 1);
+        i = part_of_slot[slot];
+        if (dehydrator->keys[i] != NULL) { continue; }
+        dehydrator->keys[i] = respAlloc(NULL, name_len + 32);
+        sprintf(dehydrator->keys[i], "%s:%d{%s}", name, i, tag_str);
+        dehydrator->slots[i] = slot;
+        ++found;
+    }
+    free(part_of_slot);
+    return dehydrator;
+}
+
+void shardedFree(ShardedDehydrator* dehydrator)
+{
+    if (dehydrator == NULL) { return; }
+    int i;
+    for (i = 0; i < dehydrator->shards; ++i) { free(dehydrator->keys[i]); }
+    free(dehydrator->keys);
+    free(dehydrator->slots);
+    free(dehydrator);
+}
+
+int shardedShardOf(ShardedDehydrator* dehydrator, const char* id, size_t id_len)
+{
+    // FNV-1a, which unlike CRC16 does not follow the slots of the shard keys
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < id_len; ++i)
+    {
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ULL;
+    }
+    return (int)(hash % (unsigned long long)dehydrator->shards);
+}
+
+Reply* shardedCreate(ShardedDehydrator* dehydrator, const char* engine)
+{
+    int shards = dehydrator->shards;
+    ShardCommand* commands = respAlloc(NULL, shards * sizeof(ShardCommand));
+    Reply** replies = respAlloc(NULL, shards * sizeof(Reply*));
+    int i;
+    for (i = 0; i < shards; ++i)
+    {
+        commands[i].shard = i;
+        commands[i].argc = (engine != NULL) ? 3 : 2;
+        commands[i].argv[0] = "REDE.CREATE";
+        commands[i].argv[1] = dehydrator->keys[i];
+        commands[i].argv[2] = engine;
+    }
+    int failed = _fanOut(dehydrator, commands, shards, replies, 1);
+    free(commands);
+
+    Reply* reply = failed ? NULL : _takeError(replies, shards);
+    if ((reply == NULL) && !failed)
+    {
+        reply = _newReply(REPLY_STATUS);
+        reply->str = _copyString("OK", 2);
+        reply->len = 2;
+    }
+    _freeReplies(replies, shards);
+    return reply;
+}
+
+static Reply* _shardCommand(ShardedDehydrator* dehydrator, const char* command, const char* id, size_t id_len)
+{
+    int shard = shardedShardOf(dehydrator, id, id_len);
+    const char* argv[] = { command, dehydrator->keys[shard], id };
+    size_t argv_len[] = { strlen(command), strlen(dehydrator->keys[shard]), id_len };
+    return clusterCommand(dehydrator->cluster, dehydrator->slots[shard], 3, argv, argv_len);
+}
+
+Reply* shardedPush(ShardedDehydrator* dehydrator, const char* ttl, const char* element, size_t element_len,
+    const char* id, size_t id_len)
+{
+    int shard = shardedShardOf(dehydrator, id, id_len);
+    const char* argv[] = { "REDE.PUSH", dehydrator->keys[shard], ttl, element, id };
+    size_t argv_len[] = { 9, strlen(dehydrator->keys[shard]), strlen(ttl), element_len, id_len };
+    return clusterCommand(dehydrator->cluster, dehydrator->slots[shard], 5, argv, argv_len);
+}
+
+Reply* shardedPull(ShardedDehydrator* dehydrator, const char* id, size_t id_len)
+{
+    return _shardCommand(dehydrator, "REDE.PULL", id, id_len);
+}
+
+Reply* shardedLook(ShardedDehydrator* dehydrator, const char* id, size_t id_len)
+{
+    return _shardCommand(dehydrator, "REDE.LOOK", id, id_len);
+}
+
+// REDE.TTN of every shard, NULL for the shards that did not answer. `failed` is set to
+// their number.
+static Reply** _fetchTTNs(ShardedDehydrator* dehydrator, int* failed)
+{
+    int shards = dehydrator->shards;
+    ShardCommand* commands = respAlloc(NULL, shards * sizeof(ShardCommand));
+    Reply** replies = respAlloc(NULL, shards * sizeof(Reply*));
+    int i;
+    for (i = 0; i < shards; ++i)
+    {
+        commands[i].shard = i;
+        commands[i].argc = 2;
+        commands[i].argv[0] = "REDE.TTN";
+        commands[i].argv[1] = dehydrator->keys[i];
+    }
+    *failed = _fanOut(dehydrator, commands, shards, replies, 1);
+    free(commands);
+    return replies;
+}
+
+Reply* shardedTTN(ShardedDehydrator* dehydrator)
+{
+    int failed;
+    Reply** ttns = _fetchTTNs(dehydrator, &failed);
+    if (failed)
+    {
+        _freeReplies(ttns, dehydrator->shards);
+        return NULL;
+    }
+
+    Reply* reply = _takeError(ttns, dehydrator->shards);
+    if (reply == NULL)
+    {
+        reply = _newReply(REPLY_NIL);
+        int i;
+        for (i = 0; i < dehydrator->shards; ++i)
+        {
+            // nil for a missing shard, -1 for an empty one
+            if ((ttns[i]->type != REPLY_INTEGER) || (ttns[i]->integer < 0)) { continue; }
+            if ((reply->type == REPLY_NIL) || (ttns[i]->integer < reply->integer))
+            {
+                reply->type = REPLY_INTEGER;
+                reply->integer = ttns[i]->integer;
+            }
+        }
+    }
+    _freeReplies(ttns, dehydrator->shards);
+    return reply;
+}
+
+Reply* shardedPoll(ShardedDehydrator* dehydrator, int count, int* failed)
+{
+    int shards = dehydrator->shards;
+    Reply** ttns = _fetchTTNs(dehydrator, failed);
+
+    // the shards with expired elements, starting from a different one every time. a shard
+    // that did not answer, or answered with an error, is not polled and counts as failed
+    ShardCommand* commands = respAlloc(NULL, shards * sizeof(ShardCommand));
+    int i, ready = 0;
+    *failed = 0;
+    for (i = 0; i < shards; ++i)
+    {
+        int shard = (dehydrator->next_poll + i) % shards;
+        if ((ttns[shard] == NULL) || (ttns[shard]->type == REPLY_ERROR)) { ++*failed; }
+        else if ((ttns[shard]->type == REPLY_INTEGER) && (ttns[shard]->integer == 0)) { commands[ready++].shard = shard; }
+    }
+    _freeReplies(ttns, shards);
+    dehydrator->next_poll = (dehydrator->next_poll + 1) % shards;
+
+    // the count is split between them, shards left without a share wait for the next poll
+    if ((count > 0) && (ready > count)) { ready = count; }
+    for (i = 0; i < ready; ++i)
+    {
+        commands[i].argc = 2;
+        commands[i].argv[0] = "REDE.POLL";
+        commands[i].argv[1] = dehydrator->keys[commands[i].shard];
+        if (count > 0)
+        {
+            snprintf(commands[i].number, sizeof(commands[i].number), "%d",
+                count / ready + ((i < count % ready) ? 1 : 0));
+            commands[i].argc = 4;
+            commands[i].argv[2] = "COUNT";
+            commands[i].argv[3] = commands[i].number;
+        }
+    }
+
+    Reply** polled = respAlloc(NULL, (ready > 0 ? ready : 1) * sizeof(Reply*));
+    _fanOut(dehydrator, commands, ready, polled, 0);
+    free(commands);
+
+    // fan in, the elements of every shard that answered are moved over to a single reply.
+    // they are already out of their shards, so they are returned whatever happened to the others
+    Reply* reply = _newReply(REPLY_ARRAY);
+    for (i = 0; i < ready; ++i)
+    {
+        if ((polled[i] == NULL) || (polled[i]->type == REPLY_ERROR))
+        {
+            ++*failed;
+            continue;
+        }
+        if (polled[i]->type != REPLY_ARRAY) { continue; }
+        reply->elements = respAlloc(reply->elements, (reply->count + polled[i]->count + 1) * sizeof(Reply*));
+        memcpy(reply->elements + reply->count, polled[i]->elements, polled[i]->count * sizeof(Reply*));
+        reply->count += polled[i]->count;
+        polled[i]->count = 0;
+    }
+    _freeReplies(polled, ready);
+    return reply;
+}
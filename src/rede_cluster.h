@@ -0,0 +1,87 @@
+#ifndef __REDE_CLUSTER_H__
+#define __REDE_CLUSTER_H__
+
+/*
+* a client for sharded dehydrators - one logical dehydrator kept in N dehydrator keys, which
+* Redis Cluster spreads over its slots, so the push and poll load of a single hot dehydrator
+* is taken by all the nodes of the cluster rather than by the one owning its key.
+*
+* shard i of dehydrator <name> is the key "<name>:<i>{<tag>}", where the hash tag is picked
+* so that the shards are spread evenly over the slot range (and so over the nodes, when each
+* owns a contiguous range). every client computes the same keys from the name and the shard
+* count, so all clients of a sharded dehydrator must agree on both.
+*
+* an element goes to the shard picked by a hash of its id, so PUSH, PULL, LOOK and UPDATE go
+* to a single shard. POLL and TTN fan in: the shards are asked in one pipeline per node and
+* the answers are merged.
+*
+* MOVED and ASK redirections are followed, so the client keeps working while slots migrate.
+* against a server that is not a cluster, every shard is simply kept on that server.
+*/
+#include "resp.h"
+
+#define CLUSTER_SLOTS 16384
+
+typedef struct cluster_node
+{
+    char* host;
+    int port;
+    Connection* conn; // NULL until it is needed, or after it failed
+} ClusterNode;
+
+typedef struct rede_cluster
+{
+    char* password;
+    ClusterNode* nodes;
+    int node_count;
+    int slots[CLUSTER_SLOTS]; // the node serving every slot, -1 while unknown
+} ReDeCluster;
+
+typedef struct sharded_dehydrator
+{
+    ReDeCluster* cluster;
+    int shards;
+    char** keys;
+    int* slots; // of every shard key
+    int next_poll; // the shard the next partial poll starts from
+} ShardedDehydrator;
+
+// connect to a node of the cluster (or a standalone server) and learn the slot map.
+// returns NULL if the node can not be reached.
+ReDeCluster* clusterConnect(const char* host, int port, const char* password);
+void clusterDisconnect(ReDeCluster* cluster);
+
+// the cluster slot of a key, honoring hash tags
+int clusterKeySlot(const char* key, size_t len);
+
+// send a command to the node serving `slot`, following redirections.
+// returns NULL if no node could be reached.
+Reply* clusterCommand(ReDeCluster* cluster, int slot, int argc, const char** argv, const size_t* argv_len);
+
+// the logical dehydrator `name` in `shards` keys. NULL if the name has a '{' (it would
+// become the hash tag of every shard) or the shard count is out of range.
+ShardedDehydrator* shardedDehydrator(ReDeCluster* cluster, const char* name, int shards);
+void shardedFree(ShardedDehydrator* dehydrator);
+
+// the shard an element id belongs to
+int shardedShardOf(ShardedDehydrator* dehydrator, const char* id, size_t id_len);
+
+// REDE.CREATE every shard, `engine` may be NULL. replies with OK, or with the first error
+Reply* shardedCreate(ShardedDehydrator* dehydrator, const char* engine);
+// REDE.PUSH, REDE.PULL and REDE.LOOK on the shard of the id
+Reply* shardedPush(ShardedDehydrator* dehydrator, const char* ttl, const char* element, size_t element_len,
+    const char* id, size_t id_len);
+Reply* shardedPull(ShardedDehydrator* dehydrator, const char* id, size_t id_len);
+Reply* shardedLook(ShardedDehydrator* dehydrator, const char* id, size_t id_len);
+
+// the elements expired in all the shards, at most `count` of them (0 for all).
+// only shards with expired elements are polled, and a partial poll starts from a
+// different shard every time, so no shard is starved. always an array: POLL takes the
+// elements out, so what the shards returned is returned even if some of them failed.
+// `failed` is set to the number of shards that failed or replied with an error. a POLL
+// whose reply was lost with its connection is not sent again, its elements are lost.
+Reply* shardedPoll(ShardedDehydrator* dehydrator, int count, int* failed);
+// the least REDE.TTN of the shards - an integer, or nil when all of them are empty
+Reply* shardedTTN(ShardedDehydrator* dehydrator);
+
+#endif
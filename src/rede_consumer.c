@@ -0,0 +1,329 @@
+/*
+* rede_consumer - polls dehydrators and sends their expired elements on, like REDE.DISPATCH
+* does from within the server, for servers that can not dispatch (before Redis 5.0, or
+* replicas of one) and for sending elements to another server.
+*
+* every round asks all the dehydrators for their REDE.TTN in one pipeline, polls the ones
+* that have expired elements in a second one, and sends the elements on in a third. when
+* nothing has expired it sleeps until the earliest TTN, but no longer than the -m interval,
+* so elements pushed with a shorter ttl in the meantime are not late by more than that.
+*
+* like POLL itself, an element is delivered at most once: if sending it fails, it is lost.
+*
+* usage: rede_consumer [-h host] [-p port] [-s socket] [-a password] [-n db] [-c count]
+*                      [-m max_sleep_ms] <dehydrator> CHANNEL|LIST|STREAM <target> [...]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "resp.h"
+
+
+//##########################################################
+//#
+//#                     Consumer
+//#
+//#########################################################
+
+#define TARGET_CHANNEL 0
+#define TARGET_LIST 1
+#define TARGET_STREAM 2
+
+typedef struct consumer_config
+{
+    const char* host;
+    int port;
+    const char* socket_path;
+    const char* password;
+    const char* db;
+    int count; // elements polled from a dehydrator at once
+    long long max_sleep; // ms
+} ConsumerConfig;
+
+typedef struct source
+{
+    const char* name;
+    int target_type;
+    const char* target;
+    long long ttn; // -1 while there is nothing to wait for
+    Reply* polled;
+    int reported; // an error of this dehydrator was already reported
+} Source;
+
+static volatile sig_atomic_t running = 1;
+
+static void _stop(int sig)
+{
+    running = 0;
+}
+
+static void _sleepMs(long long ms)
+{
+    struct timespec spec;
+    spec.tv_sec = ms / 1000;
+    spec.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&spec, NULL);
+}
+
+static int _parseTarget(const char* type)
+{
+    if (strcasecmp(type, "CHANNEL") == 0) { return TARGET_CHANNEL; }
+    if (strcasecmp(type, "LIST") == 0) { return TARGET_LIST; }
+    if (strcasecmp(type, "STREAM") == 0) { return TARGET_STREAM; }
+    return -1;
+}
+
+static void _reportError(Source* source, const char* what, Reply* reply)
+{
+    if (source->reported) { return; }
+    fprintf(stderr, "rede_consumer: %s %s failed: %s (this is reported once)\n", what, source->name,
+        (reply != NULL) && (reply->str != NULL) ? reply->str : "unexpected reply");
+    source->reported = 1;
+}
+
+// update the TTN of every source in one round trip
+static int _fetchTTNs(Connection* conn, Source* sources, int source_count)
+{
+    int i;
+    for (i = 0; i < source_count; ++i)
+    {
+        const char* argv[] = { "REDE.TTN", sources[i].name };
+        respAppendCommand(conn, 2, argv, NULL);
+    }
+    if (respFlush(conn) != 0) { return -1; }
+
+    for (i = 0; i < source_count; ++i)
+    {
+        Reply* reply = respReadReply(conn);
+        if (reply == NULL) { return -1; }
+        sources[i].ttn = -1;
+        if (reply->type == REPLY_INTEGER) { sources[i].ttn = reply->integer; }
+        else if (reply->type != REPLY_NIL) { _reportError(&sources[i], "REDE.TTN", reply); }
+        respFreeReply(reply);
+    }
+    return 0;
+}
+
+// poll the sources that have expired elements in one round trip,
+// returns the number of sources that had more than `count` to give
+static int _pollSources(Connection* conn, Source* sources, int source_count, int count)
+{
+    char count_str[16];
+    snprintf(count_str, sizeof(count_str), "%d", count);
+
+    int i;
+    for (i = 0; i < source_count; ++i)
+    {
+        if (sources[i].ttn != 0) { continue; }
+        const char* argv[] = { "REDE.POLL", sources[i].name, "COUNT", count_str };
+        respAppendCommand(conn, 4, argv, NULL);
+    }
+    if (respFlush(conn) != 0) { return -1; }
+
+    int full = 0;
+    for (i = 0; i < source_count; ++i)
+    {
+        if (sources[i].ttn != 0) { continue; }
+        Reply* reply = respReadReply(conn);
+        if (reply == NULL) { return -1; }
+        if (reply->type != REPLY_ARRAY)
+        {
+            _reportError(&sources[i], "REDE.POLL", reply);
+            respFreeReply(reply);
+            continue;
+        }
+        if (reply->count >= (size_t)count) { ++full; }
+        size_t j;
+        for (j = 0; j < reply->count; ++j)
+        {
+            if (reply->elements[j]->type != REPLY_STRING)
+            {
+                // not a reply POLL gives, do not send any of it
+                _reportError(&sources[i], "REDE.POLL", reply->elements[j]);
+                while (reply->count > j) { respFreeReply(reply->elements[--reply->count]); }
+                break;
+            }
+        }
+        sources[i].polled = reply;
+    }
+    return full;
+}
+
+// send the polled elements to their targets in one round trip. list elements
+// go out in one RPUSH per source, like REDE.DISPATCH does
+static int _sendPolled(Connection* conn, Source* sources, int source_count)
+{
+    int i, pending = 0;
+    size_t j;
+    for (i = 0; i < source_count; ++i)
+    {
+        Reply* polled = sources[i].polled;
+        if ((polled == NULL) || (polled->count == 0)) { continue; }
+
+        if (sources[i].target_type == TARGET_LIST)
+        {
+            const char** argv = respAlloc(NULL, (polled->count + 2) * sizeof(char*));
+            size_t* argv_len = respAlloc(NULL, (polled->count + 2) * sizeof(size_t));
+            argv[0] = "RPUSH";
+            argv_len[0] = 5;
+            argv[1] = sources[i].target;
+            argv_len[1] = strlen(sources[i].target);
+            for (j = 0; j < polled->count; ++j)
+            {
+                argv[j + 2] = polled->elements[j]->str;
+                argv_len[j + 2] = polled->elements[j]->len;
+            }
+            respAppendCommand(conn, polled->count + 2, argv, argv_len);
+            free(argv);
+            free(argv_len);
+            ++pending;
+            continue;
+        }
+
+        for (j = 0; j < polled->count; ++j)
+        {
+            Reply* element = polled->elements[j];
+            if (sources[i].target_type == TARGET_CHANNEL)
+            {
+                const char* argv[] = { "PUBLISH", sources[i].target, element->str };
+                size_t argv_len[] = { 7, strlen(sources[i].target), element->len };
+                respAppendCommand(conn, 3, argv, argv_len);
+            }
+            else
+            {
+                const char* argv[] = { "XADD", sources[i].target, "*", "element", element->str };
+                size_t argv_len[] = { 4, strlen(sources[i].target), 1, 7, element->len };
+                respAppendCommand(conn, 5, argv, argv_len);
+            }
+            ++pending;
+        }
+    }
+    if (respFlush(conn) != 0) { return -1; }
+
+    for (; pending > 0; --pending)
+    {
+        Reply* reply = respReadReply(conn);
+        if (reply == NULL) { return -1; }
+        if (reply->type == REPLY_ERROR)
+        {
+            fprintf(stderr, "rede_consumer: sending an element failed: %s\n", reply->str);
+        }
+        respFreeReply(reply);
+    }
+    return 0;
+}
+
+static void _clearPolled(Source* sources, int source_count)
+{
+    int i;
+    for (i = 0; i < source_count; ++i)
+    {
+        respFreeReply(sources[i].polled);
+        sources[i].polled = NULL;
+    }
+}
+
+// one round of TTN, POLL and send. returns how long to sleep before the next one, or -1
+// if the connection failed
+static long long _consumeRound(Connection* conn, ConsumerConfig* config, Source* sources, int source_count)
+{
+    if (_fetchTTNs(conn, sources, source_count) != 0) { return -1; }
+
+    int i, ready = 0;
+    long long sleep_ms = config->max_sleep;
+    for (i = 0; i < source_count; ++i)
+    {
+        if (sources[i].ttn == 0) { ++ready; }
+        else if ((sources[i].ttn > 0) && (sources[i].ttn < sleep_ms)) { sleep_ms = sources[i].ttn; }
+    }
+    if (ready == 0) { return sleep_ms; }
+
+    int full = _pollSources(conn, sources, source_count, config->count);
+    int failed = (full < 0) || (_sendPolled(conn, sources, source_count) != 0);
+    _clearPolled(sources, source_count);
+    if (failed) { return -1; }
+
+    // polled sources have a new TTN by now, so look again right away
+    return 0;
+}
+
+static void _usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-s socket] [-a password] [-n db] [-c count]\n"
+        "       [-m max_sleep_ms] <dehydrator> CHANNEL|LIST|STREAM <target> [...]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    ConsumerConfig config = { "127.0.0.1", 6379, NULL, NULL, NULL, 1000, 100 };
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:a:n:c:m:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': config.host = optarg; break;
+            case 'p': config.port = atoi(optarg); break;
+            case 's': config.socket_path = optarg; break;
+            case 'a': config.password = optarg; break;
+            case 'n': config.db = optarg; break;
+            case 'c': config.count = atoi(optarg); break;
+            case 'm': config.max_sleep = atoll(optarg); break;
+            default: _usage(argv[0]);
+        }
+    }
+    int source_count = (argc - optind) / 3;
+    if ((source_count == 0) || ((argc - optind) % 3 != 0) || (config.count <= 0) || (config.max_sleep <= 0))
+    {
+        _usage(argv[0]);
+    }
+
+    Source* sources = respAlloc(NULL, source_count * sizeof(Source));
+    memset(sources, 0, source_count * sizeof(Source));
+    int i;
+    for (i = 0; i < source_count; ++i)
+    {
+        sources[i].name = argv[optind + 3 * i];
+        sources[i].target_type = _parseTarget(argv[optind + 3 * i + 1]);
+        sources[i].target = argv[optind + 3 * i + 2];
+        if (sources[i].target_type == -1) { _usage(argv[0]); }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, _stop);
+    signal(SIGTERM, _stop);
+
+    Connection* conn = NULL;
+    while (running)
+    {
+        if (conn == NULL)
+        {
+            conn = respOpen(config.host, config.port, config.socket_path, config.password, config.db);
+            if (conn == NULL)
+            {
+                fprintf(stderr, "rede_consumer: can not connect, retrying in a second\n");
+                _sleepMs(1000);
+                continue;
+            }
+        }
+
+        long long sleep_ms = _consumeRound(conn, &config, sources, source_count);
+        if (sleep_ms < 0)
+        {
+            fprintf(stderr, "rede_consumer: connection lost: %s\n", strerror(errno));
+            respDisconnect(conn);
+            conn = NULL;
+            continue;
+        }
+        if (sleep_ms > 0) { _sleepMs(sleep_ms); }
+    }
+
+    respDisconnect(conn);
+    free(sources);
+    return 0;
+}
@@ -0,0 +1,486 @@
+/*
+* rede_load - a load generator for the module. every connection runs on a thread of its own,
+* sending pipelines of push, pull, poll and gidpush commands mixed by the given ratios, and the
+* throughput and latency percentiles of each command are reported at the end. error replies
+* are counted per command, and left out of its throughput and latencies.
+*
+* pulls draw their ids from the -i ids the dehydrator is prefilled with, uniformly or with a
+* Zipfian skew (-z). pushes add new elements, with ids past those (and past -f) - every
+* connection counts up its own, so they never collide. ttls are drawn from -t:
+*   <ms>                    every element for the same ttl
+*   uniform:<min>-<max>     uniformly between min and max
+*   exp:<mean>              exponentially distributed around the mean
+*   list:<ms>,<ms>,...      one of the listed ttls
+*
+* usage: rede_load [-h host] [-p port] [-s socket] [-a password] [-n db] [-c connections]
+*                  [-P pipeline] [-d seconds] [-k dehydrator] [-i ids] [-z zipf_exponent]
+*                  [-t ttls] [-r push:pull:poll[:gidpush]] [-b payload_bytes] [-C poll_count]
+*                  [-f prefill]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include "resp.h"
+#include "latency.h"
+
+
+//##########################################################
+//#
+//#                     Distributions
+//#
+//#########################################################
+
+#define TTL_FIXED 0
+#define TTL_UNIFORM 1
+#define TTL_EXP 2
+#define TTL_LIST 3
+#define MAX_TTL_LIST 64
+
+typedef struct ttl_distribution
+{
+    int type;
+    long long min, max; // the fixed ttl is min, the exponential mean is min
+    long long list[MAX_TTL_LIST];
+    int list_len;
+} TTLDistribution;
+
+// xorshift64*, every worker has its own state
+static inline unsigned long long _random(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, 1)
+static inline double _randomUnit(unsigned long long* state)
+{
+    return (_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int _parseTTLDistribution(const char* spec, TTLDistribution* ttl)
+{
+    memset(ttl, 0, sizeof(TTLDistribution));
+    if (strncasecmp(spec, "uniform:", 8) == 0)
+    {
+        ttl->type = TTL_UNIFORM;
+        if (sscanf(spec + 8, "%lld-%lld", &ttl->min, &ttl->max) != 2) { return -1; }
+        return ((ttl->min >= 0) && (ttl->min <= ttl->max)) ? 0 : -1;
+    }
+    if (strncasecmp(spec, "exp:", 4) == 0)
+    {
+        ttl->type = TTL_EXP;
+        ttl->min = atoll(spec + 4);
+        return (ttl->min > 0) ? 0 : -1;
+    }
+    if (strncasecmp(spec, "list:", 5) == 0)
+    {
+        ttl->type = TTL_LIST;
+        const char* p = spec + 5;
+        while ((*p != '\0') && (ttl->list_len < MAX_TTL_LIST))
+        {
+            ttl->list[ttl->list_len++] = atoll(p);
+            p = strchr(p, ',');
+            if (p == NULL) { break; }
+            ++p;
+        }
+        return (ttl->list_len > 0) ? 0 : -1;
+    }
+    char* end;
+    ttl->type = TTL_FIXED;
+    ttl->min = strtoll(spec, &end, 10);
+    return ((end != spec) && (*end == '\0') && (ttl->min >= 0)) ? 0 : -1;
+}
+
+static long long _sampleTTL(TTLDistribution* ttl, unsigned long long* state)
+{
+    switch (ttl->type)
+    {
+        case TTL_UNIFORM:
+            return ttl->min + (long long)(_random(state) % (unsigned long long)(ttl->max - ttl->min + 1));
+        case TTL_EXP:
+            return (long long)(-log(1.0 - _randomUnit(state)) * ttl->min);
+        case TTL_LIST:
+            return ttl->list[_random(state) % ttl->list_len];
+        default:
+            return ttl->min;
+    }
+}
+
+// the cumulative distribution of a Zipfian keyspace - id k is drawn with a weight of
+// 1/(k+1)^exponent. NULL when the exponent is 0, and ids are drawn uniformly.
+static double* _createZipf(long long ids, double exponent)
+{
+    if (exponent <= 0) { return NULL; }
+    double* cdf = respAlloc(NULL, ids * sizeof(double));
+    double sum = 0;
+    long long k;
+    for (k = 0; k < ids; ++k)
+    {
+        sum += 1.0 / pow((double)(k + 1), exponent);
+        cdf[k] = sum;
+    }
+    for (k = 0; k < ids; ++k)
+    {
+        cdf[k] /= sum;
+    }
+    return cdf;
+}
+
+static long long _sampleId(double* zipf, long long ids, unsigned long long* state)
+{
+    if (zipf == NULL) { return (long long)(_random(state) % (unsigned long long)ids); }
+
+    // the first id the cumulative distribution reaches u at
+    double u = _randomUnit(state);
+    long long low = 0, high = ids - 1;
+    while (low < high)
+    {
+        long long mid = low + (high - low) / 2;
+        if (zipf[mid] < u) { low = mid + 1; }
+        else { high = mid; }
+    }
+    return low;
+}
+
+
+//##########################################################
+//#
+//#                     Load
+//#
+//#########################################################
+
+#define OP_PUSH 0
+#define OP_PULL 1
+#define OP_POLL 2
+#define OP_GIDPUSH 3
+#define OP_COUNT 4
+
+static const char* op_names[OP_COUNT] = {"push", "pull", "poll", "gidpush"};
+
+typedef struct load_config
+{
+    const char* host;
+    int port;
+    const char* socket_path;
+    const char* password;
+    const char* db;
+    int connections;
+    int pipeline;
+    double seconds;
+    const char* dehydrator;
+    long long ids;
+    double zipf_exponent;
+    const char* ttl_spec;
+    TTLDistribution ttl;
+    int ratios[OP_COUNT];
+    int payload_size;
+    int poll_count;
+    long long prefill;
+} LoadConfig;
+
+typedef struct worker
+{
+    pthread_t thread;
+    unsigned long long random;
+    long long next_id; // of the next push
+    LatencyHistogram latency[OP_COUNT]; // microseconds, of the replies that are not errors
+    long long errors[OP_COUNT];
+    long long polled; // elements returned by polls
+    int failed; // could not connect, or lost the connection
+} Worker;
+
+static LoadConfig config;
+static double* zipf = NULL;
+static char* payload = NULL;
+static volatile int stopping = 0;
+
+static long long _now_us(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (long long)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+static int _pickOp(unsigned long long* state)
+{
+    int total = 0;
+    int op;
+    for (op = 0; op < OP_COUNT; ++op)
+    {
+        total += config.ratios[op];
+    }
+    int slot = (int)(_random(state) % (unsigned long long)total);
+    for (op = 0; slot >= config.ratios[op]; ++op)
+    {
+        slot -= config.ratios[op];
+    }
+    return op;
+}
+
+static void _appendPush(Connection* conn, long long id, long long ttl)
+{
+    char ttl_str[24], id_str[24];
+    snprintf(ttl_str, sizeof(ttl_str), "%lld", ttl);
+    snprintf(id_str, sizeof(id_str), "%lld", id);
+    const char* argv[] = { "REDE.PUSH", config.dehydrator, ttl_str, payload, id_str };
+    respAppendCommand(conn, 5, argv, NULL);
+}
+
+static void _appendOp(Connection* conn, int op, Worker* worker)
+{
+    unsigned long long* state = &worker->random;
+    char str[24];
+    if (op == OP_PUSH)
+    {
+        _appendPush(conn, worker->next_id, _sampleTTL(&config.ttl, state));
+        worker->next_id += config.connections;
+    }
+    else if (op == OP_GIDPUSH)
+    {
+        snprintf(str, sizeof(str), "%lld", _sampleTTL(&config.ttl, state));
+        const char* argv[] = { "REDE.GIDPUSH", config.dehydrator, str, payload };
+        respAppendCommand(conn, 4, argv, NULL);
+    }
+    else if (op == OP_PULL)
+    {
+        snprintf(str, sizeof(str), "%lld", _sampleId(zipf, config.ids, state));
+        const char* argv[] = { "REDE.PULL", config.dehydrator, str };
+        respAppendCommand(conn, 3, argv, NULL);
+    }
+    else
+    {
+        snprintf(str, sizeof(str), "%d", config.poll_count);
+        const char* argv[] = { "REDE.POLL", config.dehydrator, "COUNT", str };
+        respAppendCommand(conn, 4, argv, NULL);
+    }
+}
+
+static void* _runWorker(void* arg)
+{
+    Worker* worker = arg;
+    Connection* conn = respOpen(config.host, config.port, config.socket_path, config.password, config.db);
+    if (conn == NULL)
+    {
+        worker->failed = 1;
+        return NULL;
+    }
+
+    int* ops = respAlloc(NULL, config.pipeline * sizeof(int));
+    while (!stopping)
+    {
+        int i;
+        for (i = 0; i < config.pipeline; ++i)
+        {
+            ops[i] = _pickOp(&worker->random);
+            _appendOp(conn, ops[i], worker);
+        }
+
+        long long start = _now_us();
+        if (respFlush(conn) != 0) { worker->failed = 1; break; }
+        for (i = 0; i < config.pipeline; ++i)
+        {
+            Reply* reply = respReadReply(conn);
+            if (reply == NULL) { worker->failed = 1; break; }
+            if (reply->type == REPLY_ERROR) { ++worker->errors[ops[i]]; }
+            else
+            {
+                _recordLatency(&worker->latency[ops[i]], _now_us() - start);
+                if (ops[i] == OP_POLL) { worker->polled += reply->count; }
+            }
+            respFreeReply(reply);
+        }
+        if (worker->failed) { break; }
+    }
+    free(ops);
+    respDisconnect(conn);
+    return NULL;
+}
+
+// recreate the dehydrator with `prefill` elements, before the clock starts
+static int _prefill(void)
+{
+    Connection* conn = respOpen(config.host, config.port, config.socket_path, config.password, config.db);
+    if (conn == NULL) { return -1; }
+
+    const char* argv[] = { "DEL", config.dehydrator };
+    respAppendCommand(conn, 2, argv, NULL);
+    long long pending = 1;
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    long long id;
+    for (id = 0; id < config.prefill; ++id)
+    {
+        _appendPush(conn, id, _sampleTTL(&config.ttl, &state));
+        ++pending;
+        if ((pending < 1000) && (id + 1 < config.prefill)) { continue; }
+
+        // a thousand commands per round trip
+        if (respFlush(conn) != 0) { break; }
+        for (; pending > 0; --pending)
+        {
+            Reply* reply = respReadReply(conn);
+            if (reply == NULL) { break; }
+            respFreeReply(reply);
+        }
+        if (pending > 0) { break; }
+    }
+    respDisconnect(conn);
+    return (pending == 0) ? 0 : -1;
+}
+
+static void _printRow(const char* name, LatencyHistogram* latency, long long errors, double seconds)
+{
+    printf("%-8s %12lld %12.1f %10.3f %10.3f %10.3f %10.3f %10lld\n", name, latency->count, latency->count / seconds,
+        _latencyPercentile(latency, 500) / 1000.0, _latencyPercentile(latency, 990) / 1000.0,
+        _latencyPercentile(latency, 999) / 1000.0, latency->max / 1000.0, errors);
+}
+
+static void _report(Worker* workers, double seconds)
+{
+    static LatencyHistogram totals[OP_COUNT], all;
+    long long errors[OP_COUNT] = {0}, all_errors = 0, polled = 0;
+    int i, op, failed = 0;
+    for (i = 0; i < config.connections; ++i)
+    {
+        for (op = 0; op < OP_COUNT; ++op)
+        {
+            _mergeLatency(&totals[op], &workers[i].latency[op]);
+            _mergeLatency(&all, &workers[i].latency[op]);
+            errors[op] += workers[i].errors[op];
+            all_errors += workers[i].errors[op];
+        }
+        polled += workers[i].polled;
+        failed += workers[i].failed;
+    }
+
+    printf("%d connections, pipeline %d, %.1f seconds, %lld ids (zipf %.2f), ttl %s, "
+        "push:pull:poll:gidpush %d:%d:%d:%d, %d bytes payload\n\n", config.connections, config.pipeline, seconds,
+        config.ids, config.zipf_exponent, config.ttl_spec, config.ratios[OP_PUSH], config.ratios[OP_PULL],
+        config.ratios[OP_POLL], config.ratios[OP_GIDPUSH], config.payload_size);
+    printf("%-8s %12s %12s %10s %10s %10s %10s %10s\n", "command", "requests", "req/sec",
+        "p50 ms", "p99 ms", "p99.9 ms", "max ms", "errors");
+    for (op = 0; op < OP_COUNT; ++op)
+    {
+        if (config.ratios[op] > 0) { _printRow(op_names[op], &totals[op], errors[op], seconds); }
+    }
+    _printRow("total", &all, all_errors, seconds);
+    printf("\n%lld elements polled (%.1f/sec)", polled, polled / seconds);
+    if (failed > 0) { printf(", %d connections failed", failed); }
+    printf("\n");
+}
+
+static void _usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-s socket] [-a password] [-n db] [-c connections]\n"
+        "       [-P pipeline] [-d seconds] [-k dehydrator] [-i ids] [-z zipf_exponent]\n"
+        "       [-t ttls] [-r push:pull:poll[:gidpush]] [-b payload_bytes] [-C poll_count]\n"
+        "       [-f prefill]\n"
+        "ttls: <ms> | uniform:<min>-<max> | exp:<mean> | list:<ms>,<ms>,...\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    config.host = "127.0.0.1";
+    config.port = 6379;
+    config.connections = 50;
+    config.pipeline = 1;
+    config.seconds = 10;
+    config.dehydrator = "rede_load";
+    config.ids = 1000000;
+    config.ttl_spec = "1000";
+    config.ratios[OP_PUSH] = 8;
+    config.ratios[OP_PULL] = 1;
+    config.ratios[OP_POLL] = 1;
+    config.payload_size = 16;
+    config.poll_count = 100;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:a:n:c:P:d:k:i:z:t:r:b:C:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': config.host = optarg; break;
+            case 'p': config.port = atoi(optarg); break;
+            case 's': config.socket_path = optarg; break;
+            case 'a': config.password = optarg; break;
+            case 'n': config.db = optarg; break;
+            case 'c': config.connections = atoi(optarg); break;
+            case 'P': config.pipeline = atoi(optarg); break;
+            case 'd': config.seconds = atof(optarg); break;
+            case 'k': config.dehydrator = optarg; break;
+            case 'i': config.ids = atoll(optarg); break;
+            case 'z': config.zipf_exponent = atof(optarg); break;
+            case 't': config.ttl_spec = optarg; break;
+            case 'r':
+                config.ratios[OP_GIDPUSH] = 0;
+                if (sscanf(optarg, "%d:%d:%d:%d", &config.ratios[OP_PUSH], &config.ratios[OP_PULL],
+                    &config.ratios[OP_POLL], &config.ratios[OP_GIDPUSH]) < 3) { _usage(argv[0]); }
+                break;
+            case 'b': config.payload_size = atoi(optarg); break;
+            case 'C': config.poll_count = atoi(optarg); break;
+            case 'f': config.prefill = atoll(optarg); break;
+            default: _usage(argv[0]);
+        }
+    }
+    if ((optind != argc) || (config.connections <= 0) || (config.pipeline <= 0) || (config.seconds <= 0) ||
+        (config.ids <= 0) || (config.payload_size < 0) || (config.poll_count <= 0) || (config.prefill < 0) ||
+        (config.ratios[OP_PUSH] < 0) || (config.ratios[OP_PULL] < 0) || (config.ratios[OP_POLL] < 0) ||
+        (config.ratios[OP_GIDPUSH] < 0) ||
+        (config.ratios[OP_PUSH] + config.ratios[OP_PULL] + config.ratios[OP_POLL] + config.ratios[OP_GIDPUSH] == 0) ||
+        (_parseTTLDistribution(config.ttl_spec, &config.ttl) != 0))
+    {
+        _usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    payload = respAlloc(NULL, config.payload_size + 1);
+    memset(payload, 'x', config.payload_size);
+    payload[config.payload_size] = '\0';
+    zipf = _createZipf(config.ids, config.zipf_exponent);
+
+    if ((config.prefill > 0) && (_prefill() != 0))
+    {
+        fprintf(stderr, "rede_load: prefilling %s failed\n", config.dehydrator);
+        return 1;
+    }
+
+    Worker* workers = respAlloc(NULL, config.connections * sizeof(Worker));
+    memset(workers, 0, config.connections * sizeof(Worker));
+    unsigned long long seed = (unsigned long long)time(NULL) * 0x9E3779B97F4A7C15ULL;
+    int i;
+    for (i = 0; i < config.connections; ++i)
+    {
+        workers[i].random = seed + (unsigned long long)(i + 1) * 0xD1B54A32D192ED03ULL;
+        workers[i].next_id = ((config.prefill > config.ids) ? config.prefill : config.ids) + i;
+        if (pthread_create(&workers[i].thread, NULL, _runWorker, &workers[i]) != 0)
+        {
+            fprintf(stderr, "rede_load: can not start %d threads\n", config.connections);
+            return 1;
+        }
+    }
+
+    long long start = _now_us();
+    struct timespec duration;
+    duration.tv_sec = (time_t)config.seconds;
+    duration.tv_nsec = (long)((config.seconds - duration.tv_sec) * 1e9);
+    nanosleep(&duration, NULL);
+    stopping = 1;
+    for (i = 0; i < config.connections; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    _report(workers, (_now_us() - start) / 1e6);
+    free(workers);
+    free(zipf);
+    free(payload);
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+* rede_shard - runs commands on a sharded dehydrator (see rede_cluster.h), from the shell or
+* from scripts. KEYS lists the shard keys, the slots they hash to and the nodes serving them.
+*
+* usage: rede_shard [-h host] [-p port] [-a password] [-N shards] <dehydrator> <command> [args]
+*   KEYS
+*   CREATE [QUEUEMAP|WHEEL]
+*   PUSH <ttl> <element> <element_id>
+*   PULL <element_id>
+*   LOOK <element_id>
+*   POLL [count]
+*   TTN
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "rede_cluster.h"
+
+
+static void _printReply(Reply* reply, int indent)
+{
+    size_t i;
+    switch (reply->type)
+    {
+        case REPLY_STATUS: printf("%s\n", reply->str); break;
+        case REPLY_ERROR: printf("(error) %s\n", reply->str); break;
+        case REPLY_INTEGER: printf("(integer) %lld\n", reply->integer); break;
+        case REPLY_STRING: printf("\"%.*s\"\n", (int)reply->len, reply->str); break;
+        case REPLY_NIL: printf("(nil)\n"); break;
+        case REPLY_ARRAY:
+            if (reply->count == 0) { printf("(empty array)\n"); }
+            for (i = 0; i < reply->count; ++i)
+            {
+                printf("%*s%zu) ", (i == 0) ? 0 : indent, "", i + 1);
+                _printReply(reply->elements[i], indent + 3);
+            }
+            break;
+    }
+}
+
+static void _usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-a password] [-N shards] <dehydrator> <command> [args]\n"
+        "commands: KEYS | CREATE [QUEUEMAP|WHEEL] | PUSH <ttl> <element> <element_id> |\n"
+        "          PULL <element_id> | LOOK <element_id> | POLL [count] | TTN\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    const char* host = "127.0.0.1";
+    int port = 6379;
+    const char* password = NULL;
+    int shards = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:a:N:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'a': password = optarg; break;
+            case 'N': shards = atoi(optarg); break;
+            default: _usage(argv[0]);
+        }
+    }
+    if (argc - optind < 2) { _usage(argv[0]); }
+    const char* name = argv[optind];
+    const char* command = argv[optind + 1];
+    char** args = argv + optind + 2;
+    int arg_count = argc - optind - 2;
+
+    ReDeCluster* cluster = clusterConnect(host, port, password);
+    if (cluster == NULL)
+    {
+        fprintf(stderr, "rede_shard: can not connect to %s:%d\n", host, port);
+        return 1;
+    }
+    ShardedDehydrator* dehydrator = shardedDehydrator(cluster, name, shards);
+    if (dehydrator == NULL)
+    {
+        fprintf(stderr, "rede_shard: the name can not have a '{', and there can be 1 to %d shards\n", CLUSTER_SLOTS);
+        clusterDisconnect(cluster);
+        return 1;
+    }
+
+    Reply* reply = NULL;
+    int failed_shards = 0;
+    if ((strcasecmp(command, "KEYS") == 0) && (arg_count == 0))
+    {
+        int i;
+        for (i = 0; i < dehydrator->shards; ++i)
+        {
+            const char* key = dehydrator->keys[i];
+            int node = cluster->slots[clusterKeySlot(key, strlen(key))];
+            printf("%s slot %d", key, dehydrator->slots[i]);
+            if (node >= 0) { printf(" at %s:%d", cluster->nodes[node].host, cluster->nodes[node].port); }
+            printf("\n");
+        }
+    }
+    else if ((strcasecmp(command, "CREATE") == 0) && (arg_count <= 1))
+    {
+        reply = shardedCreate(dehydrator, (arg_count == 1) ? args[0] : NULL);
+    }
+    else if ((strcasecmp(command, "PUSH") == 0) && (arg_count == 3))
+    {
+        reply = shardedPush(dehydrator, args[0], args[1], strlen(args[1]), args[2], strlen(args[2]));
+    }
+    else if ((strcasecmp(command, "PULL") == 0) && (arg_count == 1))
+    {
+        reply = shardedPull(dehydrator, args[0], strlen(args[0]));
+    }
+    else if ((strcasecmp(command, "LOOK") == 0) && (arg_count == 1))
+    {
+        reply = shardedLook(dehydrator, args[0], strlen(args[0]));
+    }
+    else if ((strcasecmp(command, "POLL") == 0) && (arg_count <= 1))
+    {
+        reply = shardedPoll(dehydrator, (arg_count == 1) ? atoi(args[0]) : 0, &failed_shards);
+    }
+    else if ((strcasecmp(command, "TTN") == 0) && (arg_count == 0))
+    {
+        reply = shardedTTN(dehydrator);
+    }
+    else
+    {
+        _usage(argv[0]);
+    }
+
+    int status = 0;
+    if (strcasecmp(command, "KEYS") != 0)
+    {
+        if (reply == NULL)
+        {
+            fprintf(stderr, "rede_shard: the cluster could not be reached\n");
+            status = 1;
+        }
+        else
+        {
+            _printReply(reply, 0);
+            status = (reply->type == REPLY_ERROR);
+        }
+    }
+    if (failed_shards > 0)
+    {
+        fprintf(stderr, "rede_shard: %d shards could not be polled\n", failed_shards);
+        status = 1;
+    }
+    respFreeReply(reply);
+    shardedFree(dehydrator);
+    clusterDisconnect(cluster);
+    return status;
+}
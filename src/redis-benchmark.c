@@ -48,6 +48,11 @@
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
+#define TTL_PLACEHOLDER "__ttl__"
+#define TTL_PLACEHOLDER_LEN 7
+#define TTL_BASE 1000000 /* __ttl__ values are TTL_BASE + (0 ... ttls-1) milliseconds */
+#define TTL_MAX_CARDINALITY 8999999 /* so that they keep to TTL_PLACEHOLDER_LEN digits */
+#define MIX_MAX_COMMANDS 16
 
 static struct config {
     aeEventLoop *el;
@@ -63,6 +68,7 @@ static struct config {
     int datasize;
     int randomkeys;
     int randomkeys_keyspacelen;
+    int randomkeys_offset;
     int keepalive;
     int pipeline;
     int showerrors;
@@ -79,6 +85,11 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    int ttls;               /* Number of distinct values __ttl__ takes */
+    int mixlen;             /* Number of commands in a mixed benchmark, 0 otherwise */
+    long long *mixlatency[MIX_MAX_COMMANDS]; /* Latencies of each command in the mix */
+    int mixfinished[MIX_MAX_COMMANDS];
+    const char *engine;     /* Engine of the benchmarked dehydrators, NULL for the default */
 } config;
 
 typedef struct _client {
@@ -95,6 +106,9 @@ typedef struct _client {
                                such as auth and select are prefixed to the pipeline of
                                benchmark commands and discarded after the first send. */
     int prefixlen;          /* Size in bytes of the pending prefix commands */
+    char **ttlptr;          /* Pointers to __ttl__ strings inside the command buf */
+    size_t ttllen;          /* Number of pointers in client->ttlptr */
+    int mix;                /* Index of the command in a mixed benchmark, -1 otherwise */
 } *client;
 
 /* Prototypes */
@@ -129,6 +143,7 @@ static void freeClient(client c) {
     redisFree(c->context);
     sdsfree(c->obuf);
     zfree(c->randptr);
+    zfree(c->ttlptr);
     zfree(c);
     config.liveclients--;
     ln = listSearchKey(config.clients,c);
@@ -159,7 +174,7 @@ static void randomizeClientKey(client c) {
 
     for (i = 0; i < c->randlen; i++) {
         char *p = c->randptr[i]+11;
-        size_t r = random() % config.randomkeys_keyspacelen;
+        size_t r = config.randomkeys_offset + random() % config.randomkeys_keyspacelen;
         size_t j;
 
         for (j = 0; j < 12; j++) {
@@ -170,6 +185,22 @@ static void randomizeClientKey(client c) {
     }
 }
 
+static void randomizeClientTTL(client c) {
+    size_t i;
+
+    for (i = 0; i < c->ttllen; i++) {
+        char *p = c->ttlptr[i]+TTL_PLACEHOLDER_LEN-1;
+        size_t r = TTL_BASE + random() % config.ttls;
+        size_t j;
+
+        for (j = 0; j < TTL_PLACEHOLDER_LEN; j++) {
+            *p = '0'+r%10;
+            r/=10;
+            p--;
+        }
+    }
+}
+
 static void clientDone(client c) {
     if (config.requests_finished == config.requests) {
         freeClient(c);
@@ -236,13 +267,18 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                         * we need to randomize. */
                         for (j = 0; j < c->randlen; j++)
                             c->randptr[j] -= c->prefixlen;
+                        for (j = 0; j < c->ttllen; j++)
+                            c->ttlptr[j] -= c->prefixlen;
                         c->prefixlen = 0;
                     }
                     continue;
                 }
 
-                if (config.requests_finished < config.requests)
+                if (config.requests_finished < config.requests) {
                     config.latency[config.requests_finished++] = c->latency;
+                    if (c->mix >= 0)
+                        config.mixlatency[c->mix][config.mixfinished[c->mix]++] = c->latency;
+                }
                 c->pending--;
                 if (c->pending == 0) {
                     clientDone(c);
@@ -271,6 +307,7 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
         /* Really initialize: randomize keys and set start time. */
         if (config.randomkeys) randomizeClientKey(c);
+        if (c->ttllen) randomizeClientTTL(c);
         c->start = ustime();
         c->latency = -1;
     }
@@ -403,6 +440,30 @@ static client createClient(char *cmd, size_t len, client from) {
             }
         }
     }
+
+    /* Find the __ttl__ substrings, these are randomized even without -r. */
+    c->ttlptr = NULL;
+    c->ttllen = 0;
+    c->mix = -1;
+    if (from) {
+        c->mix = from->mix;
+        c->ttllen = from->ttllen;
+        if (c->ttllen) {
+            c->ttlptr = zmalloc(sizeof(char*)*c->ttllen);
+            for (j = 0; j < (int)c->ttllen; j++) {
+                c->ttlptr[j] = c->obuf + (from->ttlptr[j]-from->obuf);
+                c->ttlptr[j] += c->prefixlen - from->prefixlen;
+            }
+        }
+    } else {
+        char *p = c->obuf;
+
+        while ((p = strstr(p,TTL_PLACEHOLDER)) != NULL) {
+            c->ttlptr = zrealloc(c->ttlptr,sizeof(char*)*(c->ttllen+1));
+            c->ttlptr[c->ttllen++] = p;
+            p += TTL_PLACEHOLDER_LEN;
+        }
+    }
     if (config.idlemode == 0)
         aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
     listAddNodeTail(config.clients,c);
@@ -428,11 +489,41 @@ static int compareLatency(const void *a, const void *b) {
     return (*(long long*)a)-(*(long long*)b);
 }
 
+/* Latency in milliseconds below which 'perc' percent of the sorted 'latency'
+ * samples are. */
+static float latencyPercentile(long long *latency, int count, float perc) {
+    int i;
+
+    if (count == 0) return 0;
+    i = (int)(perc*count/100);
+    if (i >= count) i = count-1;
+    return (float)latency[i]/1000;
+}
+
+/* Show the percentiles of a sorted latency sample, for a benchmark or for one
+ * of the commands of a mixed benchmark. */
+static void showPercentiles(const char *title, long long *latency, int count) {
+    float p50 = latencyPercentile(latency,count,50);
+    float p99 = latencyPercentile(latency,count,99);
+    float p999 = latencyPercentile(latency,count,99.9);
+    float max = count ? (float)latency[count-1]/1000 : 0;
+
+    if (config.csv) {
+        printf("\"%s\",\"\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n", title, p50, p99, p999, max);
+    } else {
+        printf("  %s: %d requests, p50=%.3f p99=%.3f p99.9=%.3f max=%.3f milliseconds\n",
+            title, count, p50, p99, p999, max);
+    }
+}
+
 static void showLatencyReport(void) {
     int i, curlat = 0;
     float perc, reqpersec;
+    long long *latency = config.latency;
+    int count = config.requests_finished;
 
     reqpersec = (float)config.requests_finished/((float)config.totlatency/1000);
+    qsort(latency,count,sizeof(long long),compareLatency);
     if (!config.quiet && !config.csv) {
         printf("====== %s ======\n", config.title);
         printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
@@ -442,19 +533,25 @@ static void showLatencyReport(void) {
         printf("  keep alive: %d\n", config.keepalive);
         printf("\n");
 
-        qsort(config.latency,config.requests,sizeof(long long),compareLatency);
-        for (i = 0; i < config.requests; i++) {
-            if (config.latency[i]/1000 != curlat || i == (config.requests-1)) {
-                curlat = config.latency[i]/1000;
-                perc = ((float)(i+1)*100)/config.requests;
+        for (i = 0; i < count; i++) {
+            if (latency[i]/1000 != curlat || i == (count-1)) {
+                curlat = latency[i]/1000;
+                perc = ((float)(i+1)*100)/count;
                 printf("%.2f%% <= %d milliseconds\n", perc, curlat);
             }
         }
+        printf("p50=%.3f p99=%.3f p99.9=%.3f max=%.3f milliseconds\n",
+            latencyPercentile(latency,count,50), latencyPercentile(latency,count,99),
+            latencyPercentile(latency,count,99.9), count ? (float)latency[count-1]/1000 : 0);
         printf("%.2f requests per second\n\n", reqpersec);
     } else if (config.csv) {
-        printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
+        printf("\"%s\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n", config.title, reqpersec,
+            latencyPercentile(latency,count,50), latencyPercentile(latency,count,99),
+            latencyPercentile(latency,count,99.9), count ? (float)latency[count-1]/1000 : 0);
     } else {
-        printf("%s: %.2f requests per second\n", config.title, reqpersec);
+        printf("%s: %.2f requests per second, p50=%.3f p99=%.3f p99.9=%.3f milliseconds\n",
+            config.title, reqpersec, latencyPercentile(latency,count,50),
+            latencyPercentile(latency,count,99), latencyPercentile(latency,count,99.9));
     }
 }
 
@@ -476,6 +573,139 @@ static void benchmark(char *title, char *cmd, int len) {
     freeAllClients();
 }
 
+/* Benchmark several commands at once: the clients are split between the 'count'
+ * commands in 'cmds' by their 'weights', and besides the overall report the
+ * latency percentiles of every command are shown under its own title. */
+static void benchmarkMix(char *title, char **titles, char **cmds, int *lens, int *weights, int count) {
+    int i, j, slots = 0;
+
+    config.title = title;
+    config.requests_issued = 0;
+    config.requests_finished = 0;
+    config.mixlen = count;
+    for (i = 0; i < count; i++) {
+        config.mixlatency[i] = zmalloc(sizeof(long long)*config.requests);
+        config.mixfinished[i] = 0;
+        slots += weights[i];
+    }
+
+    /* Client j runs the command that owns slot j % slots. */
+    for (j = 0; j < config.numclients; j++) {
+        int slot = j % slots;
+        client c;
+
+        for (i = 0; slot >= weights[i]; i++) slot -= weights[i];
+        c = createClient(cmds[i],lens[i],NULL);
+        c->mix = i;
+    }
+
+    config.start = mstime();
+    aeMain(config.el);
+    config.totlatency = mstime()-config.start;
+
+    showLatencyReport();
+    for (i = 0; i < count; i++) {
+        qsort(config.mixlatency[i],config.mixfinished[i],sizeof(long long),compareLatency);
+        showPercentiles(titles[i],config.mixlatency[i],config.mixfinished[i]);
+        zfree(config.mixlatency[i]);
+    }
+    if (!config.csv) printf("\n");
+    config.mixlen = 0;
+    freeAllClients();
+}
+
+static void setupReply(redisContext *ctx, redisReply *reply) {
+    if (reply == NULL) {
+        fprintf(stderr,"Setup failed: %s\n",ctx->errstr);
+        exit(1);
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+        fprintf(stderr,"Setup failed: %s\n",reply->str);
+        exit(1);
+    }
+    freeReplyObject(reply);
+}
+
+/* A blocking connection for preparing the data a benchmark needs, outside of
+ * the measurements. */
+static redisContext *setupConnect(void) {
+    redisContext *ctx;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx == NULL || ctx->err) {
+        fprintf(stderr,"Could not connect to Redis for setup: %s\n",
+            ctx ? ctx->errstr : "out of memory");
+        exit(1);
+    }
+    if (config.auth) setupReply(ctx,redisCommand(ctx,"AUTH %s",config.auth));
+    if (config.dbnum != 0) setupReply(ctx,redisCommand(ctx,"SELECT %d",config.dbnum));
+    return ctx;
+}
+
+static void setupCommand(const char *key, const char *name) {
+    redisContext *ctx = setupConnect();
+
+    setupReply(ctx,redisCommand(ctx,"%s %s",name,key));
+    redisFree(ctx);
+}
+
+#define REDE_FILL_BATCH 100
+#define REDE_BATCH 10
+
+/* Recreate the dehydrator 'key' with 'elements' elements, spread over 'ttls'
+ * distinct ttls starting at 'ttl'. The ids are formatted like __rand_int__,
+ * so that benchmarks with the same keyspace hit them. */
+static void redeFill(const char *key, int elements, int ttls, long long ttl, const char *data) {
+    redisContext *ctx = setupConnect();
+    const char *argv[2+3*REDE_FILL_BATCH];
+    char ttlbuf[REDE_FILL_BATCH][24];
+    char idbuf[REDE_FILL_BATCH][24];
+    int i, j, batches = 0;
+
+    setupReply(ctx,redisCommand(ctx,"DEL %s",key));
+    if (config.engine) setupReply(ctx,redisCommand(ctx,"REDE.CREATE %s %s",key,config.engine));
+    for (i = 0; i < elements; i += REDE_FILL_BATCH) {
+        int argc = 2;
+
+        argv[0] = "REDE.MPUSH";
+        argv[1] = key;
+        for (j = 0; j < REDE_FILL_BATCH && i+j < elements; j++) {
+            snprintf(ttlbuf[j],sizeof(ttlbuf[j]),"%lld",ttl+(i+j)%ttls);
+            snprintf(idbuf[j],sizeof(idbuf[j]),"%012d",i+j);
+            argv[argc++] = ttlbuf[j];
+            argv[argc++] = data;
+            argv[argc++] = idbuf[j];
+        }
+        redisAppendCommandArgv(ctx,argc,argv,NULL);
+        batches++;
+    }
+    while (batches--) {
+        redisReply *reply;
+
+        if (redisGetReply(ctx,(void**)&reply) != REDIS_OK) reply = NULL;
+        setupReply(ctx,reply);
+    }
+    redisFree(ctx);
+}
+
+/* Format the REDE command 'name' on 'key' with REDE_BATCH repetitions of the
+ * 'fields' arguments in 'record'. */
+static int redeFormatBatch(char **cmd, const char *name, const char *key,
+                           const char **record, int fields) {
+    const char *argv[2+4*REDE_BATCH];
+    int argc = 0, i, j;
+
+    argv[argc++] = name;
+    argv[argc++] = key;
+    for (i = 0; i < REDE_BATCH; i++)
+        for (j = 0; j < fields; j++)
+            argv[argc++] = record[j];
+    return redisFormatCommandArgv(cmd,argc,argv,NULL);
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -542,6 +772,14 @@ int parseOptions(int argc, const char **argv) {
             config.tests = sdscat(config.tests,(char*)argv[++i]);
             config.tests = sdscat(config.tests,",");
             sdstolower(config.tests);
+        } else if (!strcmp(argv[i],"--ttls")) {
+            if (lastarg) goto invalid;
+            config.ttls = atoi(argv[++i]);
+            if (config.ttls < 1) config.ttls = 1;
+            if (config.ttls > TTL_MAX_CARDINALITY) config.ttls = TTL_MAX_CARDINALITY;
+        } else if (!strcmp(argv[i],"--engine")) {
+            if (lastarg) goto invalid;
+            config.engine = strdup(argv[++i]);
         } else if (!strcmp(argv[i],"--dbnum")) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
@@ -581,6 +819,10 @@ usage:
 "  from 0 to keyspacelen-1. The substitution changes every time a command\n"
 "  is executed. Default tests use this to hit random keys in the\n"
 "  specified range.\n"
+" --ttls <ttls>      Number of distinct values __ttl__ takes (default 1)\n"
+"  __ttl__ inside an argument is expanded to a 7 digits ttl in milliseconds,\n"
+"  one of <ttls> values starting at 1000000, on every command.\n"
+" --engine <engine>  Create the benchmarked dehydrators with QUEUEMAP or WHEEL\n"
 " -P <numreq>        Pipeline <numreq> requests. Default 1 (no pipeline).\n"
 " -e                 If server replies with errors, show them on stdout.\n"
 "                    (no more than 1 error per second is displayed)\n"
@@ -603,6 +845,8 @@ usage:
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
+" Benchmark the dehydrator commands on 100k elements, and a mixed workload:\n"
+"   $ redis-benchmark -t rede,rede_mixed -r 100000 -n 100000\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
 " with a range of values selected by the -r option.\n"
     );
@@ -645,6 +889,267 @@ int test_is_selected(char *name) {
     return strstr(config.tests,buf) != NULL;
 }
 
+#define REDE_DEFAULT_ELEMENTS 100000
+#define REDE_SWEEP_BYTES (64*1024*1024) /* Size of the payload sweep dehydrators */
+#define REDE_LONG_TTL "3600000"
+#define REDE_PUSH_KEYSPACE 1000000000 /* Ids pushes draw from, past the filled ones */
+
+static int rede_test_is_selected(char *name) {
+    return test_is_selected(name) || test_is_selected("rede");
+}
+
+/* Run a benchmark with a title and a command both formatted from 'fmt'-like
+ * arguments: 'title' may hold one %d, replaced by 'n'. */
+static void redeBenchmark(const char *title, int n, char *cmd, int len) {
+    sds t = sdscatprintf(sdsempty(),title,n);
+
+    benchmark(t,cmd,len);
+    sdsfree(t);
+    free(cmd);
+}
+
+/* Like redeBenchmark(), for pushes to a dehydrator filled with ids below
+ * 'filled': the pushed ids are drawn from the REDE_PUSH_KEYSPACE ids after
+ * those, so that the pushes are inserts, and not the error replies of ids
+ * that are already dehydrating. Pushes may still draw the same id twice, but
+ * rarely so in such a keyspace. */
+static void redePushBenchmark(const char *title, int n, char *cmd, int len, int filled) {
+    int keyspacelen = config.randomkeys_keyspacelen;
+
+    config.randomkeys_offset = filled;
+    config.randomkeys_keyspacelen = REDE_PUSH_KEYSPACE;
+    redeBenchmark(title,n,cmd,len);
+    config.randomkeys_offset = 0;
+    config.randomkeys_keyspacelen = keyspacelen;
+}
+
+/* The dehydrator benchmarks. Elements are addressed by __rand_int__ ids, so
+ * unless -r is given, a keyspace of REDE_DEFAULT_ELEMENTS ids is used, and the
+ * dehydrators are filled with that many elements before they are measured.
+ * Lookups and pulls hit the filled ids, pushes add new ones past them. */
+static void benchmarkRede(char *data) {
+    static char *commands[] = {"rede.create","rede.push","rede.gidpush","rede.mpush",
+        "rede.gidmpush","rede.mpushat","rede.look","rede.mlook","rede.update","rede.ttn",
+        "rede.slabs","rede.stats","rede.dispatch","rede.pull","rede.mpull",NULL};
+    int randomkeys = config.randomkeys;
+    int keyspacelen = config.randomkeys_keyspacelen;
+    int elements, len, j, fill = 0;
+    char *cmd;
+
+    if (!config.randomkeys || config.randomkeys_keyspacelen == 0) {
+        config.randomkeys = 1;
+        config.randomkeys_keyspacelen = REDE_DEFAULT_ELEMENTS;
+    }
+    elements = config.randomkeys_keyspacelen;
+
+    /* Single commands on a dehydrator of elements that do not expire. */
+    for (j = 0; commands[j]; j++)
+        if (rede_test_is_selected(commands[j])) fill = 1;
+    if (fill) redeFill("myDehydrator",elements,1,atoll(REDE_LONG_TTL),data);
+
+    if (rede_test_is_selected("rede.create")) {
+        len = redisFormatCommand(&cmd,"REDE.CREATE rede:created:__rand_int__ %s",
+            config.engine ? config.engine : "QUEUEMAP");
+        redeBenchmark("REDE.CREATE",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.push")) {
+        len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator " REDE_LONG_TTL " %s __rand_int__",data);
+        redePushBenchmark("REDE.PUSH",0,cmd,len,elements);
+    }
+
+    if (rede_test_is_selected("rede.gidpush")) {
+        len = redisFormatCommand(&cmd,"REDE.GIDPUSH myDehydrator " REDE_LONG_TTL " %s",data);
+        redeBenchmark("REDE.GIDPUSH",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.mpush")) {
+        const char *record[] = {REDE_LONG_TTL,data,"__rand_int__"};
+        len = redeFormatBatch(&cmd,"REDE.MPUSH","myDehydrator",record,3);
+        redePushBenchmark("REDE.MPUSH (%d elements)",REDE_BATCH,cmd,len,elements);
+    }
+
+    if (rede_test_is_selected("rede.gidmpush")) {
+        const char *record[] = {REDE_LONG_TTL,data};
+        len = redeFormatBatch(&cmd,"REDE.GIDMPUSH","myDehydrator",record,2);
+        redeBenchmark("REDE.GIDMPUSH (%d elements)",REDE_BATCH,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.mpushat")) {
+        char expiration[24];
+        const char *record[] = {REDE_LONG_TTL,expiration,data,"__rand_int__"};
+        snprintf(expiration,sizeof(expiration),"%lld",mstime()+atoll(REDE_LONG_TTL));
+        len = redeFormatBatch(&cmd,"REDE.MPUSHAT","myDehydrator",record,4);
+        redePushBenchmark("REDE.MPUSHAT (%d elements)",REDE_BATCH,cmd,len,elements);
+    }
+
+    if (rede_test_is_selected("rede.look")) {
+        len = redisFormatCommand(&cmd,"REDE.LOOK myDehydrator __rand_int__");
+        redeBenchmark("REDE.LOOK",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.mlook")) {
+        const char *record[] = {"__rand_int__"};
+        len = redeFormatBatch(&cmd,"REDE.MLOOK","myDehydrator",record,1);
+        redeBenchmark("REDE.MLOOK (%d elements)",REDE_BATCH,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.update")) {
+        len = redisFormatCommand(&cmd,"REDE.UPDATE myDehydrator __rand_int__ %s",data);
+        redeBenchmark("REDE.UPDATE",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.ttn")) {
+        len = redisFormatCommand(&cmd,"REDE.TTN myDehydrator");
+        redeBenchmark("REDE.TTN",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.slabs")) {
+        len = redisFormatCommand(&cmd,"REDE.SLABS myDehydrator");
+        redeBenchmark("REDE.SLABS",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.stats")) {
+        len = redisFormatCommand(&cmd,"REDE.STATS myDehydrator");
+        redeBenchmark("REDE.STATS",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.dispatch")) {
+        len = redisFormatCommand(&cmd,"REDE.DISPATCH myDehydrator NONE");
+        redeBenchmark("REDE.DISPATCH",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.pull")) {
+        redeFill("myDehydrator",elements,1,atoll(REDE_LONG_TTL),data);
+        len = redisFormatCommand(&cmd,"REDE.PULL myDehydrator __rand_int__");
+        redeBenchmark("REDE.PULL",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.mpull")) {
+        const char *record[] = {"__rand_int__"};
+        redeFill("myDehydrator",elements,1,atoll(REDE_LONG_TTL),data);
+        len = redeFormatBatch(&cmd,"REDE.MPULL","myDehydrator",record,1);
+        redeBenchmark("REDE.MPULL (%d elements)",REDE_BATCH,cmd,len);
+    }
+
+    /* Consumer commands on a dehydrator where everything has expired. */
+    if (rede_test_is_selected("rede.xpoll") || rede_test_is_selected("rede.xack")) {
+        redeFill("rede:expired",elements,1,1,data);
+        usleep(10000);
+        if (rede_test_is_selected("rede.xpoll")) {
+            len = redisFormatCommand(&cmd,"REDE.XPOLL rede:expired COUNT 100");
+            redeBenchmark("REDE.XPOLL (COUNT 100)",0,cmd,len);
+            len = redisFormatCommand(&cmd,"REDE.XPOLL rede:expired LEASE " REDE_LONG_TTL " COUNT 1");
+            redeBenchmark("REDE.XPOLL (LEASE, COUNT 1)",0,cmd,len);
+        }
+        if (rede_test_is_selected("rede.xack")) {
+            len = redisFormatCommand(&cmd,"REDE.XACK rede:expired __rand_int__");
+            redeBenchmark("REDE.XACK",0,cmd,len);
+        }
+    }
+
+    if (rede_test_is_selected("rede.poll")) {
+        redeFill("rede:expired",elements,1,1,data);
+        usleep(10000);
+        len = redisFormatCommand(&cmd,"REDE.POLL rede:expired COUNT 1");
+        redeBenchmark("REDE.POLL (COUNT 1)",0,cmd,len);
+        redeFill("rede:expired",elements,1,1,data);
+        usleep(10000);
+        len = redisFormatCommand(&cmd,"REDE.POLL rede:expired COUNT 100");
+        redeBenchmark("REDE.POLL (COUNT 100)",0,cmd,len);
+    }
+
+    if (rede_test_is_selected("rede.bpoll")) {
+        /* Blocked polls are served as the producers' elements expire. */
+        char *titles[] = {"REDE.PUSH (1 millisecond)","REDE.BPOLL"};
+        char *cmds[2];
+        int lens[2], weights[] = {1,1};
+
+        setupCommand("rede:bpoll","DEL");
+        lens[0] = redisFormatCommand(&cmds[0],"REDE.PUSH rede:bpoll 1 %s __rand_int__",data);
+        lens[1] = redisFormatCommand(&cmds[1],"REDE.BPOLL rede:bpoll 100");
+        benchmarkMix("REDE.BPOLL (with producers)",titles,cmds,lens,weights,2);
+        free(cmds[0]);
+        free(cmds[1]);
+    }
+
+    /* Payload sizes, from inline nodes to large elements. Each dehydrator
+     * holds about REDE_SWEEP_BYTES of payload. */
+    if (rede_test_is_selected("rede_payload")) {
+        static int sizes[] = {16, 256, 1024, 16384, 0};
+
+        for (j = 0; sizes[j]; j++) {
+            char *payload = zmalloc(sizes[j]+1);
+            int count = REDE_SWEEP_BYTES/sizes[j];
+
+            memset(payload,'x',sizes[j]);
+            payload[sizes[j]] = '\0';
+            if (count > elements) count = elements;
+            config.randomkeys_keyspacelen = count;
+            redeFill("rede:payload",count,1,atoll(REDE_LONG_TTL),payload);
+
+            len = redisFormatCommand(&cmd,"REDE.PUSH rede:payload " REDE_LONG_TTL " %s __rand_int__",payload);
+            redePushBenchmark("REDE.PUSH (%d bytes payload)",sizes[j],cmd,len,count);
+            len = redisFormatCommand(&cmd,"REDE.LOOK rede:payload __rand_int__");
+            redeBenchmark("REDE.LOOK (%d bytes payload)",sizes[j],cmd,len);
+            len = redisFormatCommand(&cmd,"REDE.PULL rede:payload __rand_int__");
+            redeBenchmark("REDE.PULL (%d bytes payload)",sizes[j],cmd,len);
+            zfree(payload);
+        }
+        config.randomkeys_keyspacelen = elements;
+        setupCommand("rede:payload","DEL");
+    }
+
+    /* TTL cardinality: the elements, and the pushes, spread over more and
+     * more distinct ttls. Nothing expires during these. */
+    if (rede_test_is_selected("rede_ttls")) {
+        static int cardinalities[] = {1, 64, 4096, 262144, 0};
+        int ttls = config.ttls;
+
+        for (j = 0; cardinalities[j]; j++) {
+            config.ttls = cardinalities[j];
+            redeFill("rede:ttls",elements,config.ttls,TTL_BASE,data);
+
+            len = redisFormatCommand(&cmd,"REDE.PUSH rede:ttls " TTL_PLACEHOLDER " %s __rand_int__",data);
+            redePushBenchmark("REDE.PUSH (%d ttls)",config.ttls,cmd,len,elements);
+            len = redisFormatCommand(&cmd,"REDE.TTN rede:ttls");
+            redeBenchmark("REDE.TTN (%d ttls)",config.ttls,cmd,len);
+            len = redisFormatCommand(&cmd,"REDE.POLL rede:ttls");
+            redeBenchmark("REDE.POLL (%d ttls)",config.ttls,cmd,len);
+            len = redisFormatCommand(&cmd,"REDE.XPOLL rede:ttls COUNT 100");
+            redeBenchmark("REDE.XPOLL (%d ttls)",config.ttls,cmd,len);
+        }
+        config.ttls = ttls;
+        setupCommand("rede:ttls","DEL");
+    }
+
+    /* Producers and consumers together. The dehydrator starts with 'elements'
+     * elements, and as pushes reuse the ids pulled, polled and acked in the same
+     * keyspace and expire after a second, it stays about that size. Pushes of
+     * ids still dehydrating are answered with errors, as they would be in an
+     * application reusing its ids. */
+    if (rede_test_is_selected("rede_mixed")) {
+        char *titles[] = {"REDE.PUSH","REDE.LOOK","REDE.PULL","REDE.POLL (COUNT 100)",
+            "REDE.XPOLL (LEASE, COUNT 10)","REDE.XACK"};
+        char *cmds[6];
+        int lens[6], weights[] = {4,2,1,1,1,1};
+
+        redeFill("rede:mixed",elements,1000,1000,data);
+        lens[0] = redisFormatCommand(&cmds[0],"REDE.PUSH rede:mixed 1000 %s __rand_int__",data);
+        lens[1] = redisFormatCommand(&cmds[1],"REDE.LOOK rede:mixed __rand_int__");
+        lens[2] = redisFormatCommand(&cmds[2],"REDE.PULL rede:mixed __rand_int__");
+        lens[3] = redisFormatCommand(&cmds[3],"REDE.POLL rede:mixed COUNT 100");
+        lens[4] = redisFormatCommand(&cmds[4],"REDE.XPOLL rede:mixed LEASE 1000 COUNT 10");
+        lens[5] = redisFormatCommand(&cmds[5],"REDE.XACK rede:mixed __rand_int__");
+        benchmarkMix("REDE mixed producers and consumers",titles,cmds,lens,weights,6);
+        for (j = 0; j < 6; j++) free(cmds[j]);
+        setupCommand("rede:mixed","DEL");
+    }
+
+    config.randomkeys = randomkeys;
+    config.randomkeys_keyspacelen = keyspacelen;
+}
+
 int main(int argc, const char **argv) {
     int i;
     char *data, *cmd;
@@ -667,6 +1172,7 @@ int main(int argc, const char **argv) {
     config.showerrors = 0;
     config.randomkeys = 0;
     config.randomkeys_keyspacelen = 0;
+    config.randomkeys_offset = 0;
     config.quiet = 0;
     config.csv = 0;
     config.loop = 0;
@@ -679,6 +1185,9 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.ttls = 1;
+    config.mixlen = 0;
+    config.engine = NULL;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -820,19 +1329,6 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
-        if (test_is_selected("rede.push") || test_is_selected("rede")) {
-            len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 1000 payload __rand_int__");
-            benchmark("REDE.PUSH",cmd,len);
-            free(cmd);
-        }
-
-
-        if (test_is_selected("rede.pull") || test_is_selected("rede")) {
-            len = redisFormatCommand(&cmd,"REDE.PULL myDehydrator __rand_int__");
-            benchmark("REDE.PUSH",cmd,len);
-            free(cmd);
-        }
-
         if (test_is_selected("mset")) {
             const char *argv[21];
             argv[0] = "MSET";
@@ -845,23 +1341,7 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
-        if (test_is_selected("rede.poll") || test_is_selected("rede")) {
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 10000000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 10000 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 15000 payload __rand_int__");
-            benchmark("REDE.PUSH - 15 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-  			len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 10000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 10 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 5000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 5 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-            len = redisFormatCommand(&cmd,"REDE.POLL myDehydrator");
-            benchmark("REDE.POLL",cmd,len);
-            free(cmd);
-        }
+        benchmarkRede(data);
 
         if (!config.csv) printf("\n");
     } while(config.loop);
@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "resp.h"
+
+#define READ_CHUNK (16 * 1024)
+
+
+void* respAlloc(void* ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+void respFreeReply(Reply* reply)
+{
+    if (reply == NULL) { return; }
+    size_t i;
+    for (i = 0; i < reply->count; ++i)
+    {
+        respFreeReply(reply->elements[i]);
+    }
+    free(reply->elements);
+    free(reply->str);
+    free(reply);
+}
+
+void respDisconnect(Connection* conn)
+{
+    if (conn == NULL) { return; }
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static void _outReserve(Connection* conn, size_t size)
+{
+    if (conn->out_len + size <= conn->out_cap) { return; }
+    while (conn->out_len + size > conn->out_cap)
+    {
+        conn->out_cap = (conn->out_cap == 0) ? READ_CHUNK : conn->out_cap * 2;
+    }
+    conn->out = respAlloc(conn->out, conn->out_cap);
+}
+
+static void _outAppend(Connection* conn, const char* data, size_t len)
+{
+    _outReserve(conn, len);
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+void respAppendCommand(Connection* conn, int argc, const char** argv, const size_t* argv_len)
+{
+    char header[32];
+    int i;
+    _outAppend(conn, header, sprintf(header, "*%d\r\n", argc));
+    for (i = 0; i < argc; ++i)
+    {
+        size_t len = (argv_len != NULL) ? argv_len[i] : strlen(argv[i]);
+        _outAppend(conn, header, sprintf(header, "$%zu\r\n", len));
+        _outAppend(conn, argv[i], len);
+        _outAppend(conn, "\r\n", 2);
+    }
+}
+
+int respFlush(Connection* conn)
+{
+    size_t written = 0;
+    while (written < conn->out_len)
+    {
+        ssize_t n = write(conn->fd, conn->out + written, conn->out_len - written);
+        if (n < 0)
+        {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        written += n;
+    }
+    conn->out_len = 0;
+    return 0;
+}
+
+// make sure at least `size` unparsed bytes are buffered
+static int _fill(Connection* conn, size_t size)
+{
+    while (conn->len - conn->pos < size)
+    {
+        if (conn->pos > 0)
+        {
+            memmove(conn->in, conn->in + conn->pos, conn->len - conn->pos);
+            conn->len -= conn->pos;
+            conn->pos = 0;
+        }
+        if (conn->in_cap - conn->len < READ_CHUNK)
+        {
+            conn->in_cap = (conn->in_cap < size) ? size + READ_CHUNK : conn->in_cap * 2;
+            conn->in = respAlloc(conn->in, conn->in_cap);
+        }
+        ssize_t n = read(conn->fd, conn->in + conn->len, conn->in_cap - conn->len);
+        if (n == 0) { errno = ECONNRESET; }
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno == EINTR)) { continue; }
+            return -1;
+        }
+        conn->len += n;
+    }
+    return 0;
+}
+
+// the next line of the reply, without its CRLF. it stays valid until the next read.
+static char* _readLine(Connection* conn, size_t* len)
+{
+    size_t scanned = 0;
+    while (1)
+    {
+        char* start = conn->in + conn->pos;
+        char* end = (conn->len - conn->pos > scanned) ?
+            memchr(start + scanned, '\n', conn->len - conn->pos - scanned) : NULL;
+        if ((end != NULL) && (end > start) && (end[-1] == '\r'))
+        {
+            *len = end - start - 1;
+            conn->pos += *len + 2;
+            return start;
+        }
+        scanned = conn->len - conn->pos;
+        if (_fill(conn, scanned + 1) != 0) { return NULL; }
+    }
+}
+
+static char* _copyString(const char* str, size_t len)
+{
+    char* copy = respAlloc(NULL, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+Reply* respReadReply(Connection* conn)
+{
+    size_t len;
+    char* line = _readLine(conn, &len);
+    if ((line == NULL) || (len == 0)) { return NULL; }
+
+    Reply* reply = respAlloc(NULL, sizeof(Reply));
+    memset(reply, 0, sizeof(Reply));
+    long long value = strtoll(line + 1, NULL, 10);
+    switch (line[0])
+    {
+        case '+':
+        case '-':
+            reply->type = (line[0] == '+') ? REPLY_STATUS : REPLY_ERROR;
+            reply->str = _copyString(line + 1, len - 1);
+            reply->len = len - 1;
+            return reply;
+        case ':':
+            reply->type = REPLY_INTEGER;
+            reply->integer = value;
+            return reply;
+        case '$':
+            if (value < 0)
+            {
+                reply->type = REPLY_NIL;
+                return reply;
+            }
+            if (_fill(conn, value + 2) != 0) { break; }
+            reply->type = REPLY_STRING;
+            reply->str = _copyString(conn->in + conn->pos, value);
+            reply->len = value;
+            conn->pos += value + 2;
+            return reply;
+        case '*':
+            if (value < 0)
+            {
+                reply->type = REPLY_NIL;
+                return reply;
+            }
+            reply->type = REPLY_ARRAY;
+            reply->elements = respAlloc(NULL, (value + 1) * sizeof(Reply*));
+            for (reply->count = 0; reply->count < (size_t)value; ++reply->count)
+            {
+                Reply* element = respReadReply(conn);
+                if (element == NULL) { break; }
+                reply->elements[reply->count] = element;
+            }
+            if (reply->count == (size_t)value) { return reply; }
+            break;
+        default:
+            errno = EPROTO;
+            break;
+    }
+    respFreeReply(reply);
+    return NULL;
+}
+
+Connection* respConnect(const char* host, int port, const char* socket_path)
+{
+    int fd = -1;
+    if (socket_path != NULL)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((fd >= 0) && (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        char port_str[16];
+        struct addrinfo hints, *addrs, *addr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(port_str, sizeof(port_str), "%d", port);
+        if (getaddrinfo(host, port_str, &hints, &addrs) != 0) { return NULL; }
+        for (addr = addrs; (addr != NULL) && (fd < 0); addr = addr->ai_next)
+        {
+            fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd < 0) { continue; }
+            if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+        freeaddrinfo(addrs);
+    }
+    if (fd < 0) { return NULL; }
+
+    Connection* conn = respAlloc(NULL, sizeof(Connection));
+    memset(conn, 0, sizeof(Connection));
+    conn->fd = fd;
+    return conn;
+}
+
+
+Connection* respOpen(const char* host, int port, const char* socket_path, const char* password, const char* db)
+{
+    Connection* conn = respConnect(host, port, socket_path);
+    if (conn == NULL) { return NULL; }
+
+    int pending = 0;
+    if (password != NULL)
+    {
+        const char* argv[] = { "AUTH", password };
+        respAppendCommand(conn, 2, argv, NULL);
+        ++pending;
+    }
+    if (db != NULL)
+    {
+        const char* argv[] = { "SELECT", db };
+        respAppendCommand(conn, 2, argv, NULL);
+        ++pending;
+    }
+    if (respFlush(conn) != 0) { pending = -1; }
+    while (pending > 0)
+    {
+        Reply* reply = respReadReply(conn);
+        int ok = (reply != NULL) && (reply->type == REPLY_STATUS);
+        if ((reply != NULL) && !ok)
+        {
+            fprintf(stderr, "connection setup failed: %s\n",
+                reply->str != NULL ? reply->str : "unexpected reply");
+        }
+        respFreeReply(reply);
+        pending = ok ? pending - 1 : -1;
+    }
+    if (pending < 0)
+    {
+        respDisconnect(conn);
+        return NULL;
+    }
+    return conn;
+}
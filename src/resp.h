@@ -0,0 +1,55 @@
+#ifndef __RESP_H__
+#define __RESP_H__
+
+/*
+* a minimal blocking RESP client, for the tools that talk to a server running the module
+* (rede_consumer, rede_load) without depending on a client library.
+* commands are pipelined with respAppendCommand and sent together with respFlush.
+*/
+#include <stddef.h>
+
+#define REPLY_STATUS 1
+#define REPLY_ERROR 2
+#define REPLY_INTEGER 3
+#define REPLY_STRING 4
+#define REPLY_ARRAY 5
+#define REPLY_NIL 6
+
+typedef struct reply
+{
+    int type;
+    long long integer;
+    char* str; // status, error and string replies, NUL terminated
+    size_t len;
+    struct reply** elements;
+    size_t count;
+} Reply;
+
+typedef struct connection
+{
+    int fd;
+    char* in; // unparsed replies are in[pos ... len)
+    size_t pos, len, in_cap;
+    char* out; // pipelined commands not written yet
+    size_t out_len, out_cap;
+} Connection;
+
+// realloc that exits when out of memory
+void* respAlloc(void* ptr, size_t size);
+
+// connect over tcp, or over a unix socket when `socket_path` is given. returns NULL on failure.
+Connection* respConnect(const char* host, int port, const char* socket_path);
+// connect, then AUTH and SELECT when `password` and `db` are given. returns NULL on failure,
+// and explains a refused AUTH or SELECT on stderr.
+Connection* respOpen(const char* host, int port, const char* socket_path, const char* password, const char* db);
+void respDisconnect(Connection* conn);
+
+// pipeline a command, `argv_len` may be NULL for NUL terminated arguments
+void respAppendCommand(Connection* conn, int argc, const char** argv, const size_t* argv_len);
+// write the pipelined commands, returns -1 if the connection failed
+int respFlush(Connection* conn);
+// read the next reply, blocking until it is all in. returns NULL if the connection failed.
+Reply* respReadReply(Connection* conn);
+void respFreeReply(Reply* reply);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+* checks of the slot hashing and the shard keys of rede_cluster, no server needed.
+* built and run by `make test_rede_cluster`.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include "rede_cluster.h"
+
+static int _slot(const char* key)
+{
+    return clusterKeySlot(key, strlen(key));
+}
+
+static void _testKeySlot(void)
+{
+    // the CRC16 check value, and slots as Redis' CLUSTER KEYSLOT reports them
+    assert(_slot("123456789") == 0x31C3);
+    assert(_slot("foo") == 12182);
+    assert(_slot("bar") == 5061);
+    assert(_slot("hello") == 866);
+    assert(_slot("") == 0);
+
+    // only the hash tag is hashed
+    assert(_slot("{user1000}.following") == _slot("user1000"));
+    assert(_slot("{user1000}.followers") == 3443);
+    assert(_slot("foo{bar}{zap}") == _slot("bar"));
+    // an empty tag hashes the whole key, and the tag ends at the first '}'
+    assert(_slot("foo{}{bar}") == 8363);
+    assert(_slot("foo{{bar}}zap") == _slot("{bar"));
+    assert(_slot("foo{bar") == clusterKeySlot("foo{bar", 7));
+    printf("clusterKeySlot - passed\n");
+}
+
+static void _testShardKeys(void)
+{
+    static int shard_counts[] = {1, 3, 16, 100, 1000, 0};
+    int n, i;
+    for (n = 0; shard_counts[n]; ++n)
+    {
+        int shards = shard_counts[n];
+        ShardedDehydrator* dehydrator = shardedDehydrator(NULL, "spread", shards);
+        assert(dehydrator != NULL);
+        assert(dehydrator->shards == shards);
+        for (i = 0; i < shards; ++i)
+        {
+            // shard i is "spread:<i>{<tag>}", in the i-th of `shards` equal parts of the slots
+            const char* key = dehydrator->keys[i];
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "spread:%d{", i);
+            assert(strncmp(key, prefix, strlen(prefix)) == 0);
+            assert(_slot(key) == dehydrator->slots[i]);
+            assert(dehydrator->slots[i] >= (long long)i * CLUSTER_SLOTS / shards);
+            assert(dehydrator->slots[i] < (long long)(i + 1) * CLUSTER_SLOTS / shards);
+        }
+        shardedFree(dehydrator);
+    }
+
+    // the same name and count give the same keys
+    ShardedDehydrator* first = shardedDehydrator(NULL, "same", 16);
+    ShardedDehydrator* second = shardedDehydrator(NULL, "same", 16);
+    for (i = 0; i < 16; ++i)
+    {
+        assert(strcmp(first->keys[i], second->keys[i]) == 0);
+    }
+    shardedFree(first);
+    shardedFree(second);
+
+    assert(shardedDehydrator(NULL, "has{tag}", 16) == NULL);
+    assert(shardedDehydrator(NULL, "spread", 0) == NULL);
+    assert(shardedDehydrator(NULL, "spread", CLUSTER_SLOTS + 1) == NULL);
+    printf("shardedDehydrator - passed\n");
+}
+
+static void _testShardOf(void)
+{
+    // ids spread evenly over the shards, within 5% of the mean
+    int shards = 16, ids = 160000;
+    int counts[16] = {0};
+    ShardedDehydrator* dehydrator = shardedDehydrator(NULL, "ids", shards);
+    int i;
+    for (i = 0; i < ids; ++i)
+    {
+        char id[16];
+        int len = snprintf(id, sizeof(id), "%d", i);
+        int shard = shardedShardOf(dehydrator, id, len);
+        assert((shard >= 0) && (shard < shards));
+        ++counts[shard];
+    }
+    for (i = 0; i < shards; ++i)
+    {
+        assert(abs(counts[i] - ids / shards) <= ids / shards / 20);
+    }
+    shardedFree(dehydrator);
+    printf("shardedShardOf - passed\n");
+}
+
+int main(int argc, char** argv)
+{
+    _testKeySlot();
+    _testShardKeys();
+    _testShardOf();
+    return 0;
+}
@@ -3,6 +3,8 @@ import redis
 import time
 import random
 import sys
+import os
+import subprocess
 
 def run_internal_test(redis_service):
     sys.stdout.write("module functional test (internal) - ")
@@ -40,53 +42,52 @@ def function_test_dehydrator(redis_service):
     print("PASS")
     redis_service.execute_command("DEL", "python_test_dehydrator")
 
-def load_test_dehydrator(redis_service, cycles=1000000, timeouts=[1,2,4,16,32,100,200,1000]):
-    redis_service.execute_command("DEL", "python_load_test_dehydrator")
-    print "starting load tests"
-
-    print "measuring PUSH"
+def function_test_blocking_poll(redis_service):
+    redis_service.execute_command("DEL", "python_test_dehydrator")
+    sys.stdout.write("module blocking poll test (external) - ")
+    sys.stdout.flush()
+    #  "nothing to wait for - bpoll times out"
     start = time.time()
-    # test push
-    for i in range(cycles):
-        redis_service.execute_command("rede.push", "python_load_test_dehydrator", random.choice(timeouts)*1000, "payload", "%d" % i)
-    push_end = time.time()
-
-
-    print "measuring GIDPUSH (auto generating ids)"
-    # test push
-    for i in range(cycles):
-        redis_service.execute_command("rede.gidpush", "python_load_test_dehydrator", random.choice(timeouts)*1000, "payload")
-    gid_push_end = time.time()
-
-
-    print "measuring PULL"
-    for i in range(cycles):
-        redis_service.execute_command("rede.pull", "python_load_test_dehydrator", "%d" % i)
-    pull_end = time.time()
-
-    print "preparing POLL"
-    start_i = 0
-    end_i = cycles/3
-    for j in range(3):
-        for i in range(start_i,end_i):
-            redis_service.execute_command("rede.push", "python_load_test_dehydrator", "%d" % i, "payload", 1000*(3-j+random.choice([1,2,3])))
-        start_i += cycles/3
-        end_i += cycles/3
-        time.sleep(1)
+    assert(redis_service.execute_command("rede.bpoll", "python_test_dehydrator", 500) is None)
+    assert(time.time() - start >= 0.5)
+    #  "push element a (for 1 second) and block until it expires"
+    redis_service.execute_command("rede.push", "python_test_dehydrator", 1000, "test_element a", "a")
+    start = time.time()
+    bpoll_result = redis_service.execute_command("rede.bpoll", "python_test_dehydrator", 5000)
+    assert(len(bpoll_result) == 1 and bpoll_result[0] == "test_element a")
+    assert(0.9 <= time.time() - start < 1.5)
+    print("PASS")
+    redis_service.execute_command("DEL", "python_test_dehydrator")
 
-    print "measuring POLL"
-    poll_sum = 0
-    for j in range(10):
-        time.sleep(1)
-        poll_start = time.time()
-        redis_service.execute_command("rede.poll", "python_load_test_dehydrator")
-        poll_end = time.time()
-        poll_sum += poll_end-poll_start
+def function_test_dispatch(redis_service):
+    redis_service.execute_command("DEL", "python_test_dehydrator", "python_test_dispatch_list")
+    sys.stdout.write("module dispatch test (external) - ")
+    sys.stdout.flush()
+    #  "expired elements are pushed to the list by the server"
+    redis_service.execute_command("rede.dispatch", "python_test_dehydrator", "LIST", "python_test_dispatch_list")
+    redis_service.execute_command("rede.push", "python_test_dehydrator", 1000, "test_element a", "a")
+    redis_service.execute_command("rede.push", "python_test_dehydrator", 500, "test_element b", "b")
+    assert(redis_service.blpop("python_test_dispatch_list", 3) == ("python_test_dispatch_list", "test_element b"))
+    assert(redis_service.blpop("python_test_dispatch_list", 3) == ("python_test_dispatch_list", "test_element a"))
+    assert(len(redis_service.execute_command("rede.poll", "python_test_dehydrator")) == 0)
+    print("PASS")
+    redis_service.execute_command("DEL", "python_test_dehydrator", "python_test_dispatch_list")
 
-    print "mean push velocity =", cycles/(push_end-start), "per second"
-    print "mean push(generating ids) velocity =", cycles/(gid_push_end-push_end), "per second"
-    print "mean pull velocity =", cycles/(pull_end-gid_push_end), "per second"
-    print "mean poll velocity = ", cycles/poll_sum, "per second"
+def load_test_dehydrator(redis_service, seconds=10, timeouts=[1,2,4,16,32,100,200,1000]):
+    # the load itself comes from src/rede_load (built with the module), which keeps many
+    # pipelined connections busy so the server is measured rather than this script
+    load = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "rede_load")
+    if not os.path.exists(load):
+        print "load test skipped - build src/rede_load first (make)"
+        return
+    connection = redis_service.connection_pool.connection_kwargs
+    ttls = "list:" + ",".join("%d" % (t*1000) for t in timeouts)
+    print "starting load tests"
+    for ratios in ["1:0:0", "0:1:0", "8:1:1", "0:0:0:1"]:
+        print "measuring push:pull:poll:gidpush", ratios
+        subprocess.call([load, "-h", connection.get("host", "localhost"), "-p", str(connection.get("port", 6379)),
+            "-k", "python_load_test_dehydrator", "-d", str(seconds), "-t", ttls, "-r", ratios,
+            "-f", "100000", "-i", "100000"])
     redis_service.execute_command("DEL", "python_load_test_dehydrator")
 
 if __name__ == "__main__":
@@ -116,5 +117,7 @@ if __name__ == "__main__":
         run_internal_test(r)
     if test_external:
         function_test_dehydrator(r)
+        function_test_blocking_poll(r)
+        function_test_dispatch(r)
     if load_test:
         load_test_dehydrator(r)